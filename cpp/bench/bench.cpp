@@ -0,0 +1,613 @@
+// Microbenchmarks of the struct utilities, over synthetic documents and
+// the test corpus. Reports ns/op, allocations/op and bytes/op (of the
+// heap: built with VOXGIG_STRUCT_ARENA, calls allocate in an arena).
+//
+// Built with VOXGIG_STRUCT_STATS, the counters of each operation are shown at the end.
+//
+// Usage: bench.out [--size N] [--depth N] [--time MS] [--corpus FILE] [--filter TEXT]
+//   --size    keys (or elements) per node of the synthetic document (default 8).
+//   --depth   levels of nesting of the synthetic document (default 3).
+//   --time    minimum time to run each benchmark, in milliseconds (default 200).
+//   --corpus  the test corpus (default ../build/test/test.json).
+//   --filter  only run benchmarks with names containing TEXT.
+
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include <nlohmann/json.hpp>
+
+#include <voxgig_struct.hpp>
+#include <voxgig_lazy.hpp>
+
+
+using namespace VoxgigStruct;
+
+
+// Allocation counting: every allocation in the process goes through these.
+
+namespace counters {
+  std::atomic<size_t> allocs(0);
+  std::atomic<size_t> bytes(0);
+}
+
+void* operator new(size_t size) {
+  counters::allocs.fetch_add(1, std::memory_order_relaxed);
+  counters::bytes.fetch_add(size, std::memory_order_relaxed);
+  stats_alloc();
+
+  void* p = std::malloc(0 == size ? 1 : size);
+  if(nullptr == p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return operator new(size);
+  } catch(const std::bad_alloc&) {
+    return nullptr;
+  }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  std::free(p);
+}
+
+
+struct Options {
+  int size = 8;
+  int depth = 3;
+  double time = 200;
+  std::string corpus = "../build/test/test.json";
+  std::string filter;
+};
+
+Options options;
+
+// Results are added here, so the work is not optimized away.
+size_t sink = 0;
+
+// Run f repeatedly for at least options.time, and report the cost of one call.
+template<class F>
+void bench(const std::string& name, F&& f) {
+  if(!options.filter.empty() && std::string::npos == name.find(options.filter)) {
+    return;
+  }
+
+#ifdef VOXGIG_STRUCT_ARENA
+  // Each call allocates in an arena, freed after the call.
+  Arena arena;
+  const auto call = [&arena, &f]() {
+    {
+      ArenaScope scope(arena);
+      f();
+    }
+    arena.reset();
+  };
+#else
+  F& call = f;
+#endif
+
+  // Warm up (and find the cost of a single call).
+  call();
+
+  size_t n = 1;
+  double elapsed = 0;
+  size_t allocs = 0;
+  size_t bytes = 0;
+
+  while(true) {
+    const size_t allocs0 = counters::allocs.load();
+    const size_t bytes0 = counters::bytes.load();
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for(size_t i = 0; i < n; i++) {
+      call();
+    }
+
+    elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    allocs = counters::allocs.load() - allocs0;
+    bytes = counters::bytes.load() - bytes0;
+
+    if(options.time * 1e6 <= elapsed || (size_t(1) << 40) <= n) {
+      break;
+    }
+
+    // Aim past the target time, growing at most 100 times per step.
+    const double per = elapsed / n;
+    const size_t want = 0 < per ? static_cast<size_t>(1.2 * options.time * 1e6 / per) : 100 * n;
+    n = want < 2 * n ? 2 * n : (100 * n < want ? 100 * n : want);
+  }
+
+  std::printf("%-28s %12zu %14.1f %12.1f %14.1f\n", name.c_str(), n,
+      elapsed / n, static_cast<double>(allocs) / n, static_cast<double>(bytes) / n);
+}
+
+// A document of nested maps and lists: size children per node, depth levels.
+json synthetic(int size, int depth, int level = 0) {
+  if(depth <= level) {
+    switch(level % 4) {
+      case 0: return level * 1000 + size;
+      case 1: return "s" + std::to_string(level * 1000 + size);
+      case 2: return 0.5 + level;
+      default: return 0 == size % 2;
+    }
+  }
+
+  json node = 0 == level % 2 ? json::object() : json::array();
+  for(int i = 0; i < size; i++) {
+    json child = 0 == i % 3 ? synthetic(i, level + 1, level + 1) : synthetic(size, depth, level + 1);
+    if(node.is_object()) {
+      node["k" + std::to_string(i)] = std::move(child);
+    } else {
+      node.push_back(std::move(child));
+    }
+  }
+  return node;
+}
+
+// The path to the first (deepest) leaf of a synthetic document.
+json firstpath(const json& doc) {
+  json path = json::array();
+  const json* node = &doc;
+  while(isnode(*node) && !node->empty()) {
+    if(node->is_object()) {
+      path.push_back(node->begin().key());
+      node = &node->begin().value();
+    } else {
+      path.push_back(0);
+      node = &(*node)[0];
+    }
+  }
+  return path;
+}
+
+// Run the struct utility benchmarks of one document.
+void benchdoc(const std::string& prefix, const json& doc) {
+  const json keys = keysof(doc);
+
+  bench(prefix + "getprop", [&]() {
+    for(const json& key : keys) {
+      sink += getprop(doc, key).is_null() ? 0 : 1;
+    }
+  });
+
+  KeyTable table;
+  std::vector<Key> resolved;
+  for(const json& key : keys) {
+    resolved.push_back(table.key(key));
+  }
+  bench(prefix + "getprop/key", [&]() {
+    for(const Key& key : resolved) {
+      sink += getprop(doc, key).is_null() ? 0 : 1;
+    }
+  });
+
+  bench(prefix + "items", [&]() {
+    for(const json& item : items(doc)) {
+      sink += item[1].is_null() ? 0 : 1;
+    }
+  });
+
+  bench(prefix + "items_view", [&]() {
+    for(auto item : items_view(doc)) {
+      sink += item.val.is_null() ? 0 : 1;
+    }
+  });
+
+  json target = doc;
+  bench(prefix + "setprop", [&]() {
+    for(const json& key : keys) {
+      setprop(target, key, static_cast<int>(sink & 0xff));
+    }
+  });
+
+  json walked = doc;
+  bench(prefix + "walk", [&]() {
+    walk(walked, [](const std::string&, json& val, const json&, const WalkPath&) {
+      sink += val.is_number() ? 1 : 0;
+    });
+  });
+
+  // The callbacks run concurrently, so count into an atomic.
+  bench(prefix + "walk/parallel", [&]() {
+    std::atomic<size_t> numbers(0);
+    walk_parallel(walked, [&numbers](const std::string&, json& val, const json&, const WalkPath&) {
+      numbers += val.is_number() ? 1 : 0;
+    }, nullptr);
+    sink += numbers;
+  });
+
+  bench(prefix + "merge", [&]() {
+    sink += merge(json::array({ doc, target })).size();
+  });
+
+  bench(prefix + "merge/parallel", [&]() {
+    sink += merge_parallel(json::array({ doc, target })).size();
+  });
+
+  bench(prefix + "stringify", [&]() {
+    sink += stringify(doc).size();
+  });
+
+  bench(prefix + "stringify/80", [&]() {
+    sink += stringify(doc, 80).size();
+  });
+
+  bench(prefix + "clone", [&]() {
+    sink += clone(doc).size();
+  });
+
+  // Handing a value over as text, or as binary.
+  bench(prefix + "clone/text", [&]() {
+    sink += json::parse(doc.dump()).size();
+  });
+
+  bench(prefix + "clone/binary", [&]() {
+    sink += clone_via_buffer(doc).size();
+  });
+
+  bench(prefix + "to_binary", [&]() {
+    sink += to_binary(doc).size();
+  });
+
+  bench(prefix + "digest", [&]() {
+    sink += binary_digest(doc).size();
+  });
+
+  bench(prefix + "struct_hash", [&]() {
+    sink += struct_hash(doc) & 1;
+  });
+
+  // Equality of documents differing in their last value: compared, or told apart by cached hashes.
+  json changed = doc;
+  json* last = nullptr;
+  walk(changed, [&last](const std::string&, json& val, const json&, const WalkPath&) {
+    if(!isnode(val)) {
+      last = &val;
+    }
+  }, nullptr);
+  if(nullptr != last) {
+    *last = "changed";
+  }
+  bench(prefix + "equal/changed", [&]() {
+    sink += doc == changed;
+  });
+
+  const HashedJson hdoc(doc);
+  const HashedJson hchanged(changed);
+  bench(prefix + "equal/changed/hashed", [&]() {
+    sink += hdoc == hchanged;
+  });
+
+  const SharedJson shared(doc);
+  const SharedJson sharedtarget(target);
+  const Path first(firstpath(doc));
+  bench(prefix + "shared/clone", [&]() {
+    sink += clone(shared).size();
+  });
+
+  bench(prefix + "shared/setpath", [&]() {
+    SharedJson copy = clone(shared);
+    sink += copy.setpath(first, sharedtarget) ? 1 : 0;
+  });
+
+  bench(prefix + "shared/merge", [&]() {
+    sink += merge({ shared, sharedtarget }).size();
+  });
+
+  // Reading the current version of a frozen document, and publishing the next.
+  FrozenSlot slot{ FrozenJson(doc) };
+  bench(prefix + "frozen/getpath", [&]() {
+    sink += slot.snapshot().getpath(first).size();
+  });
+
+  bench(prefix + "frozen/update", [&]() {
+    sink += slot.update(target).value().size();
+  });
+}
+
+// Built with VOXGIG_STRUCT_STATS, show the operation counters of the run.
+int finish() {
+  if(Stats::enabled) {
+    std::printf("\nstats: %s\n", stats().dump(2).c_str());
+  }
+  return 0 == sink ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+  for(int aI = 1; aI + 1 < argc; aI += 2) {
+    const std::string arg = argv[aI];
+    if("--size" == arg) {
+      options.size = std::atoi(argv[aI + 1]);
+    } else if("--depth" == arg) {
+      options.depth = std::atoi(argv[aI + 1]);
+    } else if("--time" == arg) {
+      options.time = std::atof(argv[aI + 1]);
+    } else if("--corpus" == arg) {
+      options.corpus = argv[aI + 1];
+    } else if("--filter" == arg) {
+      options.filter = argv[aI + 1];
+    } else {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      return 1;
+    }
+  }
+
+  const json doc = synthetic(options.size, options.depth);
+
+  std::printf("synthetic document: size %d, depth %d, %zu characters\n\n",
+      options.size, options.depth, stringify(doc).size());
+  std::printf("%-28s %12s %14s %12s %14s\n", "benchmark", "iterations", "ns/op", "allocs/op", "bytes/op");
+
+  benchdoc("", doc);
+
+  const json parts = json::array({ "http://example.com/", "/a//b/", "c", "/d/" });
+  bench("joinurl", [&]() {
+    sink += joinurl(parts).size();
+  });
+
+  // A long query parameter value, mostly safe characters.
+  std::string param;
+  for(int pI = 0; pI < 32; pI++) {
+    param += "search_term-" + std::to_string(pI) + (0 == pI % 4 ? " & " : "~");
+  }
+  bench("escurl/" + std::to_string(param.size()), [&]() {
+    sink += escurl(param).size();
+  });
+  bench("escre/" + std::to_string(param.size()), [&]() {
+    sink += escre(param).size();
+  });
+
+  const Utility utilities(STRUCT_UTILITIES);
+  bench("registry/lookup", [&]() {
+    sink += nullptr == utilities["transform"] ? 0 : 1;
+  });
+
+  const json pathlist = firstpath(doc);
+  const Path path(pathlist);
+  bench("getpath", [&]() {
+    sink += getpath(doc, path).is_null() ? 0 : 1;
+  });
+
+  // A compiled path is looked up without allocating.
+  sink += getpath(doc, path).is_null() ? 0 : 1;
+  const size_t getpath_allocs = counters::allocs.load();
+  sink += getpath(doc, path).is_null() ? 0 : 1;
+  if(getpath_allocs != counters::allocs.load()) {
+    std::cerr << "getpath with a compiled path allocates" << std::endl;
+    return 1;
+  }
+
+  bench("getpath/parse", [&]() {
+    sink += getpath(doc, pathlist).is_null() ? 0 : 1;
+  });
+
+  std::string pathstr;
+  for(const json& part : pathlist) {
+    pathstr += (pathstr.empty() ? "" : ".") + strkey(part);
+  }
+  const json spec = {
+    { "a", "`" + pathstr + "`" },
+    { "b", "x`" + pathstr + "`y" },
+    { "k0", { { "k1", "`$COPY`" } } },
+    { "e", { "`$EACH`", "", { { "k", "`$KEY`" } } } },
+  };
+
+  bench("inject", [&]() {
+    sink += inject(spec, doc).size();
+  });
+
+  const CompiledInject compiledinject(spec);
+  bench("inject/compiled", [&]() {
+    sink += compiledinject.apply(doc).size();
+  });
+
+  bench("transform", [&]() {
+    sink += transform(doc, spec).size();
+  });
+
+  const CompiledTransform compiled(spec);
+  bench("transform/compiled", [&]() {
+    sink += compiled.apply(doc).size();
+  });
+
+  // A template reading every leaf of the synthetic document, updated for a change to one.
+  json leaves = json::object();
+  int leaf = 0;
+  json leafdoc = doc;
+  walk(leafdoc, [&leaves, &leaf](const std::string&, json& val, const json&, const WalkPath& path) {
+    if(!isnode(val)) {
+      std::string ref;
+      for(const std::string& part : path) {
+        ref += (ref.empty() ? "" : ".") + part;
+      }
+      leaves["v" + std::to_string(leaf++)] = "`" + ref + "`";
+    }
+  });
+
+  IncrementalTransform live(leaves);
+  live.apply(doc);
+  bench("transform/leaves", [&]() {
+    sink += transform(doc, leaves).size();
+  });
+
+  const std::vector<json> changed = { pathlist };
+  bench("transform/leaves/update", [&]() {
+    sink += live.update(doc, changed).size();
+  });
+
+  // A schema matching the synthetic document: its own leaves as defaults, and open nodes.
+  json schema = doc;
+  walk(schema, [](const std::string&, json& val, const json&, const WalkPath&) {
+    if(val.is_string()) {
+      val = "`$STRING`";
+    }
+  });
+
+  bench("validate", [&]() {
+    sink += validate(doc, schema).size();
+  });
+
+  const Validator validator = compile_schema(schema);
+  bench("validate/compiled", [&]() {
+    sink += validator.check(doc).size();
+  });
+
+  bench("validate/budget", [&]() {
+    json errs = json::array();
+    InjectDef injdef;
+    injdef.errs = &errs;
+    injdef.maxerrs = 1;
+    sink += validator.check(json::object(), injdef).size();
+  });
+
+  // A batch of copies of the synthetic document.
+  const std::vector<json> docs(64, doc);
+  bench("transform/batch/64", [&]() {
+    sink += transform_batch(docs, compiled).size();
+  });
+
+  Batch parallel;
+  parallel.parallel = true;
+  bench("transform/batch/64/parallel", [&]() {
+    sink += transform_batch(docs, compiled, parallel).size();
+  });
+
+  // A record of 8 lookups that each block for 1ms: one after another, or all at once.
+  const auto lookup = [](const json& val, const json&) -> json {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return val;
+  };
+  json lookupspec = json::object();
+  for(int lI = 0; lI < 8; lI++) {
+    lookupspec["f" + std::to_string(lI)] = { "`$APPLY`", "lookup", lI };
+  }
+  AsyncApplies blocking;
+  blocking["lookup"] = [lookup](const json& val, const FrozenJson& store) -> AsyncJson { return lookup(val, store.value()); };
+  TaskPool lookups(9);
+  AsyncApplies concurrent;
+  concurrent["lookup"] = async_apply(lookup, &lookups);
+  bench("transform/apply/8x1ms", [&]() {
+    sink += transform_async(json::object(), lookupspec, blocking).get().size();
+  });
+  bench("transform/apply/8x1ms/async", [&]() {
+    sink += transform_async(json::object(), lookupspec, concurrent).get().size();
+  });
+
+  bench("validate/batch/64", [&]() {
+    sink += validate_batch(docs, validator).size();
+  });
+
+  // A catalog of records, selected by an equality and a comparison.
+  json catalog = json::object();
+  for(int i = 0; i < 20000; i++) {
+    catalog["sku" + std::to_string(i)] = { { "kind", "k" + std::to_string(i % 1000) }, { "price", i % 97 } };
+  }
+  const Selector selector({ { "kind", "k7" }, { "price", { { "`$LT`", 50 } } } });
+  bench("select/20000", [&]() {
+    sink += selector.select(catalog).size();
+  });
+
+  const SelectIndex index(catalog, { "kind" });
+  bench("select/20000/index", [&]() {
+    sink += index.select(selector).size();
+  });
+
+  // Loading one value of the catalog from a file: parsed whole, or lazily.
+  const std::string lazyfile = "bench_lazy.json";
+  const std::string catalogtext = json({ { "catalog", catalog } }).dump();
+  std::ofstream(lazyfile) << catalogtext;
+  const std::string kb = std::to_string(catalogtext.size() / 1024) + "k";
+  bench("load/parse/" + kb, [&]() {
+    std::ifstream in(lazyfile);
+    sink += getpath(json::parse(in), "catalog.sku9999.price").get<int>();
+  });
+  bench("load/lazy/" + kb, [&]() {
+    sink += LazyJson::open(lazyfile).getpath("catalog.sku9999.price").to_json().get<int>();
+  });
+  bench("load/lazy/items/" + kb, [&]() {
+    for(const LazyJson::Item& item : LazyJson::open(lazyfile).getprop("catalog").items()) {
+      sink += item.second.getprop("price").to_json().get<int>();
+    }
+  });
+
+  // Summing the prices of the catalog text: walked once parsed, or as it is parsed.
+  auto addprice = [](const std::string& key, json& val, const json&, const WalkPath&) {
+    if("price" == key) {
+      sink += val.get<int>();
+    }
+  };
+  bench("load/parse+walk/" + kb, [&]() {
+    json parsed = json::parse(catalogtext);
+    walk(parsed, addprice);
+  });
+  bench("load/walk_stream/" + kb, [&]() {
+    walk_stream(catalogtext, nullptr, addprice);
+  });
+  std::remove(lazyfile.c_str());
+
+  // The test corpus.
+  std::ifstream f(options.corpus);
+  if(!f) {
+    std::cerr << "\nNo corpus at " << options.corpus << std::endl;
+    return finish();
+  }
+
+  const json corpus = json::parse(f);
+  std::printf("\ncorpus: %s, %zu characters\n", options.corpus.c_str(), stringify(corpus).size());
+
+  benchdoc("corpus/", corpus);
+
+  // Each transform and validate test entry that succeeds.
+  const json& tests = getprop(corpus, "struct");
+  for(const std::string name : { "transform", "validate" }) {
+    json entries = json::array();
+    const json& group = getprop(tests, name);
+    for(json::const_iterator set = group.begin(); set != group.end(); ++set) {
+      for(const json& entry : getprop(set.value(), "set")) {
+        const json& in = getprop(entry, "in");
+        if(!entry.contains("err") && in.contains("spec")) {
+          entries.push_back(in);
+        }
+      }
+    }
+
+    bench("corpus/" + name + "/" + std::to_string(entries.size()), [&]() {
+      for(const json& in : entries) {
+        try {
+          sink += ("transform" == name ? transform(getprop(in, "data"), in["spec"]) :
+              validate(getprop(in, "data"), in["spec"])).size();
+        } catch(const std::exception&) {
+          sink++;
+        }
+      }
+    });
+  }
+
+  return finish();
+}
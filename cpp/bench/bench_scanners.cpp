@@ -0,0 +1,194 @@
+// Compares the scanner based escre, join(url) and stringify with the
+// std::regex versions they replace (and escurl with its former
+// std::ostringstream version): checks both give the same output over
+// generated inputs, then reports ns/op for each.
+
+#include <iostream>
+#include <random>
+
+#include <nlohmann/json.hpp>
+
+#include <voxgig_struct.hpp>
+
+
+using namespace VoxgigStruct;
+
+namespace regex_ref {
+
+  inline std::string escre(const std::string& s) {
+    const std::regex pattern(R"([.*+?^${}()|[\]\\])");
+
+    return std::regex_replace(s, pattern, R"(\$&)");
+  }
+
+  inline std::string join(const json& arr, const std::string& sep = ",", bool url = false) {
+    if(!islist(arr)) {
+      return S::empty;
+    }
+
+    const int sarr = static_cast<int>(arr.size());
+    const bool single = sep.size() == 1;
+    const std::string sepre = single ? escre(sep) : S::empty;
+
+    std::vector<std::string> parts;
+    int i = 0;
+
+    for(json::const_iterator it = arr.begin(); it != arr.end(); it++) {
+      if(!it->is_string() || it->get_ref<const std::string&>().empty()) {
+        continue;
+      }
+
+      std::string s = it->get<std::string>();
+
+      if(single) {
+        if(url && 0 == i) {
+          s = std::regex_replace(s, std::regex(sepre + "+$"), "");
+        } else {
+          if(0 < i) {
+            s = std::regex_replace(s, std::regex("^" + sepre + "+"), "");
+          }
+
+          if(i < sarr - 1 || !url) {
+            s = std::regex_replace(s, std::regex(sepre + "+$"), "");
+          }
+
+          s = std::regex_replace(s, std::regex("([^" + sepre + "])" + sepre + "+([^" + sepre + "])"),
+              "$1" + sep + "$2", std::regex_constants::format_first_only);
+        }
+      }
+
+      i++;
+
+      if(!s.empty()) {
+        parts.push_back(s);
+      }
+    }
+
+    std::string out;
+    for(size_t pI = 0; pI < parts.size(); pI++) {
+      out += (0 == pI ? "" : sep) + parts[pI];
+    }
+    return out;
+  }
+
+  inline std::string escurl(const std::string& s) {
+    std::ostringstream escaped;
+    escaped.fill('0');
+    escaped << std::hex;
+
+    for (unsigned char c : s) {
+      if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+        escaped << c;
+      } else {
+        escaped << '%' << std::uppercase << std::setw(2) << int(c);
+        escaped << std::nouppercase;
+      }
+    }
+
+    return escaped.str();
+  }
+
+  inline std::string stringify(const json& val) {
+    return val.is_string() ? val.get<std::string>() : std::regex_replace(val.dump(), std::regex("(\")"), "");
+  }
+
+}
+
+template<class F>
+double nsop(size_t n, F&& f) {
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(size_t i = 0; i < n; i++) {
+    f(i);
+  }
+  const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / n;
+}
+
+void report(const std::string& name, double scanner, double regex) {
+  std::cout << name << ": scanner " << scanner << " ns/op, regex " << regex << " ns/op, x" <<
+    (0 < scanner ? regex / scanner : 0) << std::endl;
+}
+
+int main() {
+  std::mt19937 rng(20251014);
+  const std::string alphabet = "ab/,./*$()[\\\"";
+  const std::string urlalphabet = "abcdefghijklmnopqrstuvwxyz0123456789-_.~ /?&=%\xC3\xA9";
+
+  std::vector<std::string> strs;
+  for(int sI = 0; sI < 2000; sI++) {
+    std::string s(rng() % 12, ' ');
+    for(char& c : s) {
+      c = alphabet[rng() % alphabet.size()];
+    }
+    strs.push_back(s);
+  }
+
+  // Longer strings, to cross the 16 byte blocks of the vector scan.
+  std::vector<std::string> urls;
+  for(int sI = 0; sI < 500; sI++) {
+    std::string s(rng() % 200, ' ');
+    for(char& c : s) {
+      c = urlalphabet[rng() % urlalphabet.size()];
+    }
+    urls.push_back(s);
+  }
+
+  std::vector<json> parts;
+  for(size_t sI = 0; sI + 4 <= strs.size(); sI += 4) {
+    parts.push_back(json::array({ strs[sI], strs[sI + 1], strs[sI + 2], strs[sI + 3] }));
+  }
+
+  json doc = json::object();
+  for(size_t sI = 0; sI < strs.size(); sI++) {
+    doc["k" + std::to_string(sI)] = json::array({ strs[sI], static_cast<int>(sI), { { "s", strs[sI] } } });
+  }
+
+  // Same output.
+  for(const std::string& s : strs) {
+    if(escre(s) != regex_ref::escre(s)) {
+      std::cerr << "escre differs: " << s << std::endl;
+      return 1;
+    }
+  }
+  for(const std::string& s : urls) {
+    if(escurl(s) != regex_ref::escurl(s) || escre(s) != regex_ref::escre(s)) {
+      std::cerr << "escurl or escre differs: " << s << std::endl;
+      return 1;
+    }
+  }
+  for(const json& p : parts) {
+    for(const std::string& sep : { "/", ",", "::" }) {
+      for(bool url : { false, true }) {
+        if(join(p, sep, url) != regex_ref::join(p, sep, url)) {
+          std::cerr << "join differs: " << p.dump() << " " << sep << " " << url << std::endl;
+          return 1;
+        }
+      }
+    }
+  }
+  if(stringify(doc) != regex_ref::stringify(doc)) {
+    std::cerr << "stringify differs" << std::endl;
+    return 1;
+  }
+
+  size_t sink = 0;
+  const size_t n = 20000;
+
+  report("escre",
+      nsop(n, [&](size_t i) { sink += escre(strs[i % strs.size()]).size(); }),
+      nsop(n, [&](size_t i) { sink += regex_ref::escre(strs[i % strs.size()]).size(); }));
+
+  report("escurl (ostringstream)",
+      nsop(n, [&](size_t i) { sink += escurl(urls[i % urls.size()]).size(); }),
+      nsop(n, [&](size_t i) { sink += regex_ref::escurl(urls[i % urls.size()]).size(); }));
+
+  report("joinurl",
+      nsop(n, [&](size_t i) { sink += joinurl(parts[i % parts.size()]).size(); }),
+      nsop(n, [&](size_t i) { sink += regex_ref::join(parts[i % parts.size()], "/", true).size(); }));
+
+  report("stringify",
+      nsop(20, [&](size_t) { sink += stringify(doc).size(); }),
+      nsop(20, [&](size_t) { sink += regex_ref::stringify(doc).size(); }));
+
+  return 0 == sink ? 1 : 0;
+}
@@ -4,13 +4,42 @@
 #define UTILITY_DECLS
 
 #include <sstream>
+#include <algorithm>
 #include <iomanip>
 #include <cmath>
+#include <limits>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <ctime>
+#include <cstring>
+#include <cstdio>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <initializer_list>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <regex>
 
+#include "voxgig_arena.hpp"
+
 
+// Define VOXGIG_STRUCT_ARENA to allocate every value with ArenaAllocator.
+#ifdef VOXGIG_STRUCT_ARENA
+using json = VoxgigStruct::arena_json;
+#else
 using json = nlohmann::json;
+#endif
 
 // TODO: Don't use std::vector due to performance concerns as it is creating double copies, being the initializer_list first. However, this improvement is optimal due to the way the runner is written where arguments are read dynamically from parsed json
 using args_container = std::vector<json>;
@@ -21,22 +50,48 @@ using JsonFunction = std::function<json(args_container&&)>;
 template<class T_K, class T_V>
 using hash_table = std::unordered_map<T_K, T_V>;
 
+// A utility function and its name.
+struct UtilityEntry {
+  const char* name;
+  function_pointer fn;
+};
+
+// A table of utility functions, sorted by name, that a Utility refers to.
+// Look a name up once (a binary search) and keep the function pointer.
 class Utility {
   private:
-    hash_table<std::string, function_pointer> table;
+    const UtilityEntry* entries = nullptr;
+    size_t count = 0;
 
   public:
     Utility() = default;
 
-    void set_key(const std::string&, function_pointer);
+    template<size_t N>
+    constexpr Utility(const UtilityEntry (&entries)[N]) : entries{entries}, count{N} {}
+
+    // The function named key, or nullptr.
+    function_pointer get_key(const std::string& key) const {
+      const UtilityEntry* end = entries + count;
+      const UtilityEntry* found = std::lower_bound(entries, end, key,
+          [](const UtilityEntry& entry, const std::string& name) { return 0 < name.compare(entry.name); });
+      return found != end && key == found->name ? found->fn : nullptr;
+    }
 
-    function_pointer& get_key(const std::string&);
+    function_pointer operator[](const std::string& key) const {
+      return get_key(key);
+    }
 
-    void set_table(hash_table<std::string, function_pointer>&&);
+    const UtilityEntry* begin() const {
+      return entries;
+    }
 
-    function_pointer& operator[](const std::string&);
+    const UtilityEntry* end() const {
+      return entries + count;
+    }
 
-    ~Utility() = default;
+    size_t size() const {
+      return count;
+    }
 
 };
 
@@ -50,7 +105,8 @@ class Provider {
     static Provider test(const json&);
     static Provider test(void);
 
-    hash_table<std::string, Utility> utility(void);
+    // The utilities of each group, built once.
+    const hash_table<std::string, Utility>& utility(void) const;
 };
 
 namespace Auxiliary {
@@ -70,6 +126,37 @@ namespace Auxiliary {
 
   }
 
+  // Parse a non-empty string of decimal digits in one pass. Returns false if str is not one, or overflows.
+  inline bool parse_index(const std::string& str, int& index) {
+    if(str.empty()) {
+      return false;
+    }
+
+    long long out = 0;
+    for(char c : str) {
+      if(c < '0' || c > '9') {
+        return false;
+      }
+      out = out * 10 + (c - '0');
+      if(out > std::numeric_limits<int>::max()) {
+        return false;
+      }
+    }
+
+    index = static_cast<int>(out);
+    return true;
+  }
+
+  // Resolve a list key: an integer, or a string of digits. Returns false if the key is not an index.
+  inline bool list_index(const json& key, int& index) {
+    if(key.is_number()) {
+      index = key.get<int>();
+      return true;
+    }
+
+    return key.is_string() && parse_index(key.get_ref<const std::string&>(), index);
+  }
+
 }
 
 #endif
@@ -0,0 +1,181 @@
+#ifndef VOXGIG_ARENA
+
+#define VOXGIG_ARENA
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+// Arena (monotonic) allocation for JSON values.
+//
+// ArenaAllocator allocates from the arena made current by an ArenaScope on
+// this thread, and otherwise from the heap. An arena frees its allocations
+// all at once (reset, or destruction), so a request's documents can be built
+// in one arena and dropped together. Values allocated in an arena must be
+// destroyed before the arena is reset or destroyed.
+//
+// Build with VOXGIG_STRUCT_ARENA defined to use arena_json as the json type
+// of the whole library (see utility_decls.hpp).
+
+
+namespace VoxgigStruct {
+
+  class Arena {
+    public:
+      explicit Arena(size_t blocksize = 64 * 1024) : blocksize{blocksize} {}
+
+      ~Arena() {
+        for(Block& block : blocks) {
+          ::operator delete(block.data);
+        }
+      }
+
+      Arena(const Arena&) = delete;
+      Arena& operator=(const Arena&) = delete;
+
+      void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        while(true) {
+          if(current < blocks.size()) {
+            Block& block = blocks[current];
+            const size_t at = (offset + align - 1) & ~(align - 1);
+            if(at + size <= block.size) {
+              offset = at + size;
+              inuse += size;
+              return block.data + at;
+            }
+          }
+
+          // Move to the next block, adding one (at least twice as large) if needed.
+          if(current + 1 < blocks.size() && size + align <= blocks[current + 1].size) {
+            current++;
+          } else {
+            const size_t last = blocks.empty() ? blocksize / 2 : blocks.back().size;
+            const size_t bsize = size + align <= 2 * last ? 2 * last : size + align;
+            blocks.push_back({ static_cast<char*>(::operator new(bsize)), bsize });
+            current = blocks.size() - 1;
+          }
+          offset = 0;
+        }
+      }
+
+      // Free every allocation at once. The blocks are kept for reuse.
+      void reset() {
+        current = 0;
+        offset = 0;
+        inuse = 0;
+      }
+
+      // Bytes allocated since the last reset.
+      size_t used() const {
+        return inuse;
+      }
+
+      // Bytes held in blocks.
+      size_t capacity() const {
+        size_t total = 0;
+        for(const Block& block : blocks) {
+          total += block.size;
+        }
+        return total;
+      }
+
+    private:
+      struct Block {
+        char* data;
+        size_t size;
+      };
+
+      size_t blocksize;
+      std::vector<Block> blocks;
+      size_t current = 0;
+      size_t offset = 0;
+      size_t inuse = 0;
+  };
+
+  namespace Auxiliary {
+
+    // The arena of the innermost ArenaScope on this thread, or nullptr.
+    inline Arena*& current_arena() {
+      static thread_local Arena* arena = nullptr;
+      return arena;
+    }
+
+  }
+
+  // While in scope, ArenaAllocator allocates from arena on this thread.
+  class ArenaScope {
+    public:
+      explicit ArenaScope(Arena& arena) : prior{Auxiliary::current_arena()} {
+        Auxiliary::current_arena() = &arena;
+      }
+
+      ~ArenaScope() {
+        Auxiliary::current_arena() = prior;
+      }
+
+      ArenaScope(const ArenaScope&) = delete;
+      ArenaScope& operator=(const ArenaScope&) = delete;
+
+    private:
+      Arena* prior;
+  };
+
+  // A stateless allocator for ArenaScope's arena. Each allocation is
+  // prefixed with the arena it came from (nullptr for the heap), so it is
+  // freed correctly whichever scope is current then.
+  template<class T>
+  struct ArenaAllocator {
+    using value_type = T;
+
+    static constexpr size_t HEADER = alignof(std::max_align_t);
+
+    ArenaAllocator() noexcept = default;
+
+    template<class U>
+    ArenaAllocator(const ArenaAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+      Arena* arena = Auxiliary::current_arena();
+      const size_t size = HEADER + n * sizeof(T);
+
+      char* base = static_cast<char*>(nullptr != arena ? arena->allocate(size) : ::operator new(size));
+      *reinterpret_cast<Arena**>(base) = arena;
+
+      return reinterpret_cast<T*>(base + HEADER);
+    }
+
+    void deallocate(T* p, size_t) noexcept {
+      char* base = reinterpret_cast<char*>(p) - HEADER;
+
+      // Arena allocations are freed with the arena.
+      if(nullptr == *reinterpret_cast<Arena**>(base)) {
+        ::operator delete(base);
+      }
+    }
+  };
+
+  template<class T>
+  constexpr size_t ArenaAllocator<T>::HEADER;
+
+  template<class T, class U>
+  bool operator==(const ArenaAllocator<T>&, const ArenaAllocator<U>&) noexcept {
+    return true;
+  }
+
+  template<class T, class U>
+  bool operator!=(const ArenaAllocator<T>&, const ArenaAllocator<U>&) noexcept {
+    return false;
+  }
+
+  // nlohmann::json with nodes (maps, lists and strings) allocated by ArenaAllocator.
+  // NOTE: String contents stay on the heap (beyond the short string buffer),
+  // as the string type remains std::string.
+  using arena_json = nlohmann::basic_json<std::map, std::vector, std::string, bool,
+        std::int64_t, std::uint64_t, double, ArenaAllocator>;
+
+}
+
+#endif
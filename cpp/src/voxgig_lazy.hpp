@@ -0,0 +1,497 @@
+#ifndef VOXGIG_LAZY
+
+#define VOXGIG_LAZY
+
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define VOXGIG_LAZY_MMAP
+#endif
+
+#include "voxgig_struct.hpp"
+
+// Lazily parsed JSON documents.
+//
+// LazyJson::open maps a file into memory (or, without mmap, reads it), and
+// LazyJson values refer to the text of a value in it. Nothing is parsed
+// up front: getprop and getpath scan the members of each node on the path,
+// skipping over the text of the other members without parsing them, and
+// to_json parses just the value reached. Skipped text is only checked for
+// balanced brackets and strings; to_json checks the value it parses. A path
+// that is not all plain keys is the exception: see LazyJson::getpath.
+
+
+namespace VoxgigStruct {
+
+  namespace Auxiliary {
+
+    // The text of a lazy document: a mapped file, or a string.
+    class LazySource {
+      public:
+        explicit LazySource(std::string text) : text{std::move(text)} {
+          data = this->text.data();
+          size = this->text.size();
+        }
+
+        explicit LazySource(const std::string& filename, bool) {
+#ifdef VOXGIG_LAZY_MMAP
+          const int fd = ::open(filename.c_str(), O_RDONLY);
+          if(fd < 0) {
+            throw std::runtime_error("Cannot open " + filename);
+          }
+
+          struct stat st;
+          if(0 != ::fstat(fd, &st)) {
+            ::close(fd);
+            throw std::runtime_error("Cannot stat " + filename);
+          }
+
+          size = static_cast<size_t>(st.st_size);
+          if(0 < size) {
+            void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(MAP_FAILED == mapped) {
+              ::close(fd);
+              throw std::runtime_error("Cannot map " + filename);
+            }
+            mapping = mapped;
+            data = static_cast<const char*>(mapped);
+          }
+          ::close(fd);
+#else
+          std::ifstream f(filename, std::ios::binary);
+          if(!f) {
+            throw std::runtime_error("Cannot open " + filename);
+          }
+          text.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+          data = text.data();
+          size = text.size();
+#endif
+        }
+
+        ~LazySource() {
+#ifdef VOXGIG_LAZY_MMAP
+          if(nullptr != mapping) {
+            ::munmap(mapping, size);
+          }
+#endif
+        }
+
+        LazySource(const LazySource&) = delete;
+        LazySource& operator=(const LazySource&) = delete;
+
+        const char* data = "";
+        size_t size = 0;
+
+      private:
+        std::string text;
+        void* mapping = nullptr;
+    };
+
+    // Bytes that end the skip of a string, and of a node.
+    inline const ByteSet& lazy_string_bytes() {
+      static const ByteSet set("\"\\");
+      return set;
+    }
+
+    inline const ByteSet& lazy_node_bytes() {
+      static const ByteSet set("\"{}[]");
+      return set;
+    }
+
+    inline const ByteSet& lazy_scalar_end_bytes() {
+      static const ByteSet set(",}] \t\n\r");
+      return set;
+    }
+
+    // Scanning over the text of a lazy document. Offsets past the text are errors.
+    struct LazyScan {
+      const char* data;
+      size_t size;
+
+      [[noreturn]] void fail(size_t at, const char* expected) const {
+        throw std::runtime_error(std::string("Invalid JSON at offset ") + std::to_string(at) +
+            ": expected " + expected);
+      }
+
+      size_t ws(size_t at) const {
+        while(at < size && (' ' == data[at] || '\t' == data[at] || '\n' == data[at] || '\r' == data[at])) {
+          at++;
+        }
+        return at;
+      }
+
+      // The end of the string starting (with its quote) at at.
+      size_t string_end(size_t at) const {
+        const char* end = data + size;
+        const char* p = data + at + 1;
+        while(true) {
+          p = lazy_string_bytes().scan(p, end);
+          if(p == end) {
+            fail(at, "the end of the string");
+          }
+          if('"' == *p) {
+            return p - data + 1;
+          }
+          p += 2;
+          if(end < p) {
+            fail(at, "the end of the string");
+          }
+        }
+      }
+
+      // The end of the map key (a string) at at, and the start of its value.
+      size_t value(size_t at) const {
+        const size_t colon = ws(string_end(at));
+        if(size <= colon || ':' != data[colon]) {
+          fail(colon, ":");
+        }
+        return ws(colon + 1);
+      }
+
+      // The start of the next member or element after the value at at, or
+      // npos at the end of the node.
+      size_t next(size_t at, char close) const {
+        at = ws(skip(at));
+        if(at < size && close == data[at]) {
+          return std::string::npos;
+        }
+        if(size <= at || ',' != data[at]) {
+          fail(at, '}' == close ? ", or }" : ", or ]");
+        }
+        return ws(at + 1);
+      }
+
+      // The key of the map member at at.
+      std::string key(size_t at) const {
+        const size_t end = string_end(at);
+        if(nullptr == std::memchr(data + at + 1, '\\', end - at - 2)) {
+          return std::string(data + at + 1, end - at - 2);
+        }
+        return json::parse(data + at, data + end).get<std::string>();
+      }
+
+      // The end of the value starting at at (after any whitespace).
+      size_t skip(size_t at) const {
+        if(size <= at) {
+          fail(at, "a value");
+        }
+
+        const char c = data[at];
+        if('"' == c) {
+          return string_end(at);
+        }
+
+        if('{' == c || '[' == c) {
+          const char* end = data + size;
+          const char* p = data + at + 1;
+          size_t depth = 1;
+          while(0 < depth) {
+            p = lazy_node_bytes().scan(p, end);
+            if(p == end) {
+              fail(at, "the end of the node");
+            }
+            if('"' == *p) {
+              p = data + string_end(p - data);
+            } else {
+              depth += '{' == *p || '[' == *p ? 1 : -1;
+              p++;
+            }
+          }
+          return p - data;
+        }
+
+        const char* end = lazy_scalar_end_bytes().scan(data + at, data + size);
+        if(end == data + at) {
+          fail(at, "a value");
+        }
+        return end - data;
+      }
+
+      // The first member or element of the node at at, or npos if it is empty.
+      size_t first(size_t at) const {
+        const char close = '{' == data[at] ? '}' : ']';
+        at = ws(at + 1);
+        return at < size && close == data[at] ? std::string::npos : at;
+      }
+
+      // Call f(start) for the start of each member of the map at at (a key),
+      // or each element of the list at at, in one pass, until f returns false.
+      template<class F>
+      void each(size_t at, F f) const {
+        const char close = '{' == data[at] ? '}' : ']';
+        for(size_t p = first(at); std::string::npos != p; ) {
+          if('}' == close && (size <= p || '"' != data[p])) {
+            fail(p, "a key");
+          }
+          if(!f(p)) {
+            return;
+          }
+          p = next('}' == close ? value(p) : p, close);
+        }
+      }
+
+      // The offset of the value of member key of the map at at, or npos.
+      size_t member(size_t at, const std::string& key) const {
+        size_t found = std::string::npos;
+        each(at, [this, &key, &found](size_t p) {
+          if(keyis(p, string_end(p), key)) {
+            found = value(p);
+            return false;
+          }
+          return true;
+        });
+        return found;
+      }
+
+      // The offset of element index of the list at at, or npos.
+      size_t element(size_t at, size_t index) const {
+        size_t found = std::string::npos;
+        size_t eI = 0;
+        each(at, [index, &eI, &found](size_t p) {
+          if(eI++ == index) {
+            found = p;
+            return false;
+          }
+          return true;
+        });
+        return found;
+      }
+
+      // Is the string at [at, end) key? Strings with escapes are decoded.
+      bool keyis(size_t at, size_t end, const std::string& key) const {
+        const size_t n = end - at - 2;
+        if(nullptr == std::memchr(data + at + 1, '\\', n)) {
+          return n == key.size() && 0 == std::memcmp(data + at + 1, key.data(), n);
+        }
+        return json::parse(data + at, data + end).get_ref<const std::string&>() == key;
+      }
+    };
+
+  }
+
+  // A value in a lazily parsed document (see above), or absent. Values are
+  // cheap to copy, and keep the document alive.
+  class LazyJson {
+    public:
+      using Item = std::pair<std::string, LazyJson>;
+
+      LazyJson() = default;
+
+      // Map the file (read it, without mmap) as a lazy document.
+      static LazyJson open(const std::string& filename) {
+        return root(std::make_shared<const Auxiliary::LazySource>(filename, true));
+      }
+
+      // The text as a lazy document.
+      static LazyJson parse(std::string text) {
+        return root(std::make_shared<const Auxiliary::LazySource>(std::move(text)));
+      }
+
+      bool isvalid() const {
+        return nullptr != src || nullptr != node;
+      }
+
+      bool ismap() const {
+        return nullptr != node ? node->is_object() : nullptr != src && '{' == src->data[at];
+      }
+
+      bool islist() const {
+        return nullptr != node ? node->is_array() : nullptr != src && '[' == src->data[at];
+      }
+
+      bool isnode() const {
+        return ismap() || islist();
+      }
+
+      // The child at key (a map key, or a list index), or absent.
+      LazyJson getprop(const std::string& key) const {
+        int index;
+        if(nullptr != node) {
+          if(node->is_object()) {
+            json::const_iterator it = node->find(key);
+            return it == node->end() ? LazyJson() : parsed(doc, &*it);
+          }
+          return islist() && ::Auxiliary::parse_index(key, index) ? getprop(static_cast<size_t>(index)) : LazyJson();
+        } else if(ismap()) {
+          return child(scan().member(at, key));
+        } else if(islist() && ::Auxiliary::parse_index(key, index)) {
+          return child(scan().element(at, static_cast<size_t>(index)));
+        }
+        return LazyJson();
+      }
+
+      // Each call scans the list from its start: to visit every element, use items.
+      LazyJson getprop(size_t index) const {
+        if(nullptr != node) {
+          return node->is_array() && index < node->size() ? parsed(doc, &(*node)[index]) : LazyJson();
+        }
+        return islist() ? child(scan().element(at, index)) : getprop(std::to_string(index));
+      }
+
+      // The value at path, as getpath finds it in the parsed document. Only
+      // plain keys are followed lazily: from the first other part of the path
+      // (such as the empty part, or $GET), the node reached is parsed whole,
+      // once, and the rest of the path is found in it. The value found is a
+      // part of that parsed node. As the scan finds them, nulls are values.
+      LazyJson getpath(const Path& path) const {
+        if(!path.valid || !path.meta.empty()) {
+          return LazyJson();
+        }
+
+        LazyJson cur = *this;
+        for(size_t pI = 0; pI < path.size() && cur.isvalid(); pI++) {
+          const Path::Part& part = path.parts[pI];
+          if(Path::KEY != part.kind) {
+            Path rest;
+            rest.valid = true;
+            rest.parts.assign(path.parts.begin() + pI, path.parts.end());
+            return cur.find(rest);
+          }
+          cur = cur.getprop(part.key);
+        }
+        return cur;
+      }
+
+      LazyJson getpath(const json& path) const {
+        return getpath(Path(path));
+      }
+
+      // The number of children of a node (one scan of its text), otherwise 0.
+      size_t size() const {
+        if(nullptr != node) {
+          return node->is_structured() ? node->size() : 0;
+        }
+
+        size_t count = 0;
+        if(isnode()) {
+          scan().each(at, [&count](size_t) {
+            count++;
+            return true;
+          });
+        }
+        return count;
+      }
+
+      // The children of a node, with their keys (list indexes for a list), in
+      // one scan of its text: otherwise empty.
+      std::vector<Item> items() const {
+        std::vector<Item> out;
+        if(nullptr != node && node->is_structured()) {
+          size_t index = 0;
+          for(json::const_iterator it = node->begin(); it != node->end(); ++it) {
+            out.emplace_back(node->is_object() ? it.key() : std::to_string(index++), parsed(doc, &*it));
+          }
+        } else if(nullptr == node && isnode()) {
+          const Auxiliary::LazyScan s = scan();
+          const bool map = ismap();
+          s.each(at, [this, &s, map, &out](size_t p) {
+            out.emplace_back(map ? s.key(p) : std::to_string(out.size()), child(map ? s.value(p) : p));
+            return true;
+          });
+        }
+        return out;
+      }
+
+      // The text of the value.
+      std::string text() const {
+        if(nullptr != node) {
+          return node->dump();
+        }
+        return isvalid() ? std::string(src->data + at, scan().skip(at) - at) : S::empty;
+      }
+
+      // The parsed value (NONE if absent).
+      json to_json() const {
+        if(nullptr != node) {
+          return *node;
+        }
+        if(!isvalid()) {
+          return NONE;
+        }
+        return json::parse(src->data + at, src->data + scan().skip(at));
+      }
+
+    private:
+      std::shared_ptr<const Auxiliary::LazySource> src;
+      size_t at = 0;
+
+      // Or, a value in a parsed node (see getpath), kept alive by doc.
+      std::shared_ptr<const json> doc;
+      const json* node = nullptr;
+
+      static LazyJson root(std::shared_ptr<const Auxiliary::LazySource> source) {
+        LazyJson out;
+        const size_t start = Auxiliary::LazyScan{ source->data, source->size }.ws(0);
+        if(start < source->size) {
+          out.src = std::move(source);
+          out.at = start;
+        }
+        return out;
+      }
+
+      static LazyJson parsed(std::shared_ptr<const json> doc, const json* node) {
+        LazyJson out;
+        out.doc = std::move(doc);
+        out.node = node;
+        return out;
+      }
+
+      Auxiliary::LazyScan scan() const {
+        return Auxiliary::LazyScan{ src->data, src->size };
+      }
+
+      LazyJson child(size_t offset) const {
+        LazyJson out;
+        if(std::string::npos != offset) {
+          out.src = src;
+          out.at = offset;
+        }
+        return out;
+      }
+
+      // The rest of a path, found by getpath in this value, parsed. getpath
+      // gives NONE for a null as for nothing found, so a null is looked for
+      // again with the nulls marked.
+      LazyJson find(const Path& rest) const {
+        std::shared_ptr<const json> whole = nullptr != node ? doc : std::make_shared<const json>(to_json());
+        const json& base = nullptr != node ? *node : *whole;
+
+        const json& found = VoxgigStruct::getpath(base, rest);
+        if(!found.is_null()) {
+          return parsed(whole, &found);
+        }
+
+        json marked = base;
+        mark_nulls(marked);
+        if(null_mark() != VoxgigStruct::getpath(marked, rest)) {
+          return LazyJson();
+        }
+        std::shared_ptr<const json> value = std::make_shared<const json>(nullptr);
+        return parsed(value, value.get());
+      }
+
+      // Stands for a null: a binary value, which JSON text cannot hold.
+      static const json& null_mark() {
+        static const json mark = json::binary({ 'n', 'u', 'l', 'l' });
+        return mark;
+      }
+
+      static void mark_nulls(json& val) {
+        if(val.is_null()) {
+          val = null_mark();
+        } else if(val.is_structured()) {
+          for(json& item : val) {
+            mark_nulls(item);
+          }
+        }
+      }
+  };
+
+}
+
+#endif
@@ -1,3 +1,7 @@
+#ifndef VOXGIG_STRUCT
+
+#define VOXGIG_STRUCT
+
 #include "utility_decls.hpp"
 
 // Struct Utility Functions
@@ -23,10 +27,22 @@ namespace VoxgigStruct {
     const std::string scalar = "scalar";
     const std::string node = "node";
     const std::string viz = ": ";
+    const std::string DKEY = "$KEY";
+    const std::string DSPEC = "$SPEC";
+    const std::string DTOP = "$TOP";
+    const std::string DERRS = "$ERRS";
+    const std::string BKEY = "`$KEY`";
+    const std::string BANNO = "`$ANNO`";
+    const std::string BVAL = "`$VAL`";
+    const std::string KEY = "KEY";
+    const std::string BEXACT = "`$EXACT`";
+    const std::string BOPEN = "`$OPEN`";
+    const std::string BONE = "`$ONE`";
+    const std::string object = "object";
   };
 
   // Type constants - bitfield integers matching TypeScript canonical.
-  constexpr int T_any      = (1 << 31) - 1;
+  constexpr int T_any      = (1u << 31) - 1;
   constexpr int T_noval    = 1 << 30;
   constexpr int T_boolean  = 1 << 29;
   constexpr int T_decimal  = 1 << 28;
@@ -42,6 +58,15 @@ namespace VoxgigStruct {
   constexpr int T_scalar   = 1 << 7;
   constexpr int T_node     = 1 << 6;
 
+  constexpr const char* TYPENAME_CSTR[] = {
+    "any", "nil", "boolean", "decimal", "integer", "number", "string",
+    "function", "symbol", "null",
+    "", "", "", "", "", "", "",
+    "list", "map", "instance",
+    "", "", "", "",
+    "scalar", "node",
+  };
+
   const std::string TYPENAME[] = {
     S::any, S::nil, S::boolean_s, S::decimal, S::integer, S::number, S::string_s,
     S::function_s, S::symbol, S::null_s,
@@ -52,117 +77,384 @@ namespace VoxgigStruct {
   };
   constexpr int TYPENAME_LEN = 26;
 
-  // Get type name string from type bitfield value.
-  inline std::string typename_of(int t) {
-    std::string tname = "";
-    for (int tI = 0; tI < TYPENAME_LEN; tI++) {
-      if (!TYPENAME[tI].empty() && 0 < (t & (1 << (31 - tI)))) {
-        tname = TYPENAME[tI];
-      }
+  namespace Auxiliary {
+
+    // The TYPENAME index of the highest bit set in t (counted from bit 31), or TYPENAME_LEN
+    // for none that have names.
+    constexpr int typename_index_bits(unsigned int t, int tI) {
+      return TYPENAME_LEN <= tI ? TYPENAME_LEN : 0 != (t & (1u << (31 - tI))) ? tI : typename_index_bits(t, tI + 1);
     }
-    return tname;
+
+    constexpr int typename_index(int t) {
+#if defined(__GNUC__) || defined(__clang__)
+      return 0 == t ? TYPENAME_LEN :
+        __builtin_clz(static_cast<unsigned int>(t)) < TYPENAME_LEN ? __builtin_clz(static_cast<unsigned int>(t)) : TYPENAME_LEN;
+#else
+      return typename_index_bits(static_cast<unsigned int>(t), 0);
+#endif
+    }
+
+  }
+
+  // Get type name from type bitfield value: the name of the highest bit set.
+  constexpr const char* typename_cstr(int t) {
+    return TYPENAME_LEN == Auxiliary::typename_index(t) ? TYPENAME_CSTR[0] : TYPENAME_CSTR[Auxiliary::typename_index(t)];
+  }
+
+  // As typename_cstr, as a string.
+  inline const std::string& typename_of(int t) noexcept {
+    const int tI = Auxiliary::typename_index(t);
+    return TYPENAME_LEN == tI ? S::any : TYPENAME[tI];
   }
 
   // Determine the type of a value as a bitfield integer.
-  inline int typify(const json& value) {
-    if (value.is_null()) {
-      return T_noval;
+  inline int typify(const json& value) noexcept {
+    switch(value.type()) {
+      case json::value_t::null:
+        return T_noval;
+      case json::value_t::boolean:
+        return T_scalar | T_boolean;
+      case json::value_t::number_integer:
+      case json::value_t::number_unsigned:
+        return T_scalar | T_number | T_integer;
+      case json::value_t::number_float:
+        return std::isnan(*value.get_ptr<const json::number_float_t*>()) ? T_noval : T_scalar | T_number | T_decimal;
+      case json::value_t::string:
+        return T_scalar | T_string;
+      case json::value_t::array:
+        return T_node | T_list;
+      case json::value_t::object:
+        return T_node | T_map;
+      default:
+        return T_any;
     }
+  }
+
+  // Absent value. Typed functions use this as the default for optional arguments.
+  const json NONE = nullptr;
+
+  // Default max depth (for walk etc).
+  const int MAXDEPTH = 32;
+
+  // Statistics
+  // ==========
+
+  // Operations that count their calls when built with VOXGIG_STRUCT_STATS.
+  struct Stats {
+    enum Op { WALK, MERGE, GETPROP, SETPROP, DELPROP, GETPATH, SETPATH, STRINGIFY, CLONE,
+      INJECT, TRANSFORM, VALIDATE, SELECT, COUNT };
+
+    static constexpr bool enabled =
+#ifdef VOXGIG_STRUCT_STATS
+      true;
+#else
+      false;
+#endif
+  };
+
+  constexpr const char* STATS_NAMES[Stats::COUNT] = {
+    "walk", "merge", "getprop", "setprop", "delprop", "getpath", "setpath", "stringify", "clone",
+    "inject", "transform", "validate", "select",
+  };
+
+  namespace Auxiliary {
 
-    if (value.is_boolean()) {
-      return T_scalar | T_boolean;
+    struct StatCounters {
+      std::atomic<unsigned long long> calls;
+      std::atomic<unsigned long long> nodes;
+      std::atomic<unsigned long long> allocs;
+      std::atomic<unsigned long long> nanos;
+    };
+
+    inline StatCounters* stat_counters() {
+      static StatCounters counters[Stats::COUNT] = {};
+      return counters;
     }
 
-    if (value.is_number_integer()) {
-      return T_scalar | T_number | T_integer;
+    // The state of this thread: the allocations noted by stats_alloc, the
+    // number of open scopes of each operation, and the innermost operation.
+    struct StatThread {
+      unsigned long long allocs = 0;
+      int open[Stats::COUNT] = {};
+      int inner = -1;
+    };
+
+    inline StatThread& stat_thread() {
+      static thread_local StatThread state;
+      return state;
     }
 
-    if (value.is_number_float()) {
-      double d = value.get<double>();
-      if (std::isnan(d)) {
-        return T_noval;
+    // Counts a call of op while in scope. Time and allocations are counted
+    // by the outermost scope of op on a thread, so recursion counts once.
+    class StatScope {
+      public:
+        explicit StatScope(Stats::Op op) : op{op}, state(stat_thread()), outer{0 == state.open[op]++},
+          inner{state.inner}, allocs{state.allocs} {
+          state.inner = op;
+          if(outer) {
+            start = std::chrono::steady_clock::now();
+          }
+        }
+
+        ~StatScope() {
+          StatCounters& counters = stat_counters()[op];
+          counters.calls.fetch_add(1, std::memory_order_relaxed);
+          if(outer) {
+            counters.nanos.fetch_add(static_cast<unsigned long long>(
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count()), std::memory_order_relaxed);
+            counters.allocs.fetch_add(state.allocs - allocs, std::memory_order_relaxed);
+          }
+          state.open[op]--;
+          state.inner = inner;
+        }
+
+        StatScope(const StatScope&) = delete;
+        StatScope& operator=(const StatScope&) = delete;
+
+      private:
+        const Stats::Op op;
+        StatThread& state;
+        const bool outer;
+        const int inner;
+        const unsigned long long allocs;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // Count nodes visited by the innermost operation in scope on this thread.
+    inline void stat_nodes(size_t count) {
+      const int inner = stat_thread().inner;
+      if(0 <= inner) {
+        stat_counters()[inner].nodes.fetch_add(count, std::memory_order_relaxed);
       }
-      return T_scalar | T_number | T_decimal;
     }
 
-    if (value.is_string()) {
-      return T_scalar | T_string;
-    }
+  }
 
-    if (value.is_array()) {
-      return T_node | T_list;
+  // Instrument the enclosing function as operation op (a Stats::Op), and
+  // count nodes it visits. Without VOXGIG_STRUCT_STATS both are empty.
+#ifdef VOXGIG_STRUCT_STATS
+#define VOXGIG_STAT(op) const VoxgigStruct::Auxiliary::StatScope voxgig_stat_scope(VoxgigStruct::Stats::op)
+#define VOXGIG_STAT_NODES(count) VoxgigStruct::Auxiliary::stat_nodes(count)
+#else
+#define VOXGIG_STAT(op)
+#define VOXGIG_STAT_NODES(count)
+#endif
+
+  // Note an allocation made on this thread, counted against the operations
+  // in scope. Call it from a replacement operator new (see bench/bench.cpp).
+  inline void stats_alloc() {
+#ifdef VOXGIG_STRUCT_STATS
+    Auxiliary::stat_thread().allocs++;
+#endif
+  }
+
+  // The counters of each operation as JSON: a map from operation name to
+  // { calls, nodes, allocs, ns }. A snapshot while other threads are counting
+  // is a consistent count per counter, not across them.
+  inline json stats() {
+    json out = json::object();
+    for(int oI = 0; oI < Stats::COUNT; oI++) {
+      const Auxiliary::StatCounters& counters = Auxiliary::stat_counters()[oI];
+      out[STATS_NAMES[oI]] = {
+        { "calls", counters.calls.load(std::memory_order_relaxed) },
+        { "nodes", counters.nodes.load(std::memory_order_relaxed) },
+        { "allocs", counters.allocs.load(std::memory_order_relaxed) },
+        { "ns", counters.nanos.load(std::memory_order_relaxed) },
+      };
     }
+    return out;
+  }
 
-    if (value.is_object()) {
-      return T_node | T_map;
+  // Set every counter to zero.
+  inline void stats_reset() {
+    for(int oI = 0; oI < Stats::COUNT; oI++) {
+      Auxiliary::StatCounters& counters = Auxiliary::stat_counters()[oI];
+      counters.calls.store(0, std::memory_order_relaxed);
+      counters.nodes.store(0, std::memory_order_relaxed);
+      counters.allocs.store(0, std::memory_order_relaxed);
+      counters.nanos.store(0, std::memory_order_relaxed);
     }
+  }
 
-    return T_any;
+  // Value is a node - defined, and a map (hash) or list (array).
+  inline bool isnode(const json& val) noexcept {
+    switch(val.type()) {
+      case json::value_t::array:
+      case json::value_t::object:
+        return true;
+      default:
+        return false;
+    }
   }
 
   inline json isnode(args_container&& args) {
-    json val = args.size() == 0 ? nullptr : std::move(args[0]);
+    return isnode(args.size() == 0 ? NONE : args[0]);
+  }
 
-    return static_cast<bool>(val.is_array() || val.is_object());
+  // Value is a defined map (hash) with string keys.
+  inline bool ismap(const json& val) noexcept {
+    return json::value_t::object == val.type();
   }
 
   inline json ismap(args_container&& args) {
-    json val = args.size() == 0 ? nullptr : std::move(args[0]);
+    return ismap(args.size() == 0 ? NONE : args[0]);
+  }
 
-    // NOTE: explicit static_case not needed but let's stay explicit in case we change the library
-    return static_cast<bool>(val.is_object());
+  // Value is a defined list (array) with integer keys (indexes).
+  inline bool islist(const json& val) noexcept {
+    return json::value_t::array == val.type();
   }
 
   inline json islist(args_container&& args) {
-    json val = args.size() == 0 ? nullptr : std::move(args[0]);
-
-    return static_cast<bool>(val.is_array());
+    return islist(args.size() == 0 ? NONE : args[0]);
   }
 
-
-  json iskey(args_container&& args) {
-    json val = args.size() == 0 ? nullptr : std::move(args[0]);
-
-    // TODO: Refactor the if statements
-    if(val.is_string()) {
-      return (val.get<std::string>()).length() > 0;
+  // Value is a defined string (non-empty) or number key.
+  inline bool iskey(const json& val) noexcept {
+    switch(val.type()) {
+      case json::value_t::string:
+        return !val.get_ptr<const json::string_t*>()->empty();
+      case json::value_t::number_integer:
+      case json::value_t::number_unsigned:
+      case json::value_t::number_float:
+        return true;
+      default:
+        return false;
     }
+  }
 
-    if(val.is_boolean()) {
-      return false;
-    }
+  inline json iskey(args_container&& args) {
+    return iskey(args.size() == 0 ? NONE : args[0]);
+  }
 
-    if(val.is_number_integer()) {
-      return true;
+  // Convert a key to a string: strings as-is, numbers floored, anything else empty.
+  inline std::string strkey(const json& key = NONE) {
+    if(key.is_string()) {
+      return key.get<std::string>();
+    } else if(key.is_number_integer()) {
+      return key.dump();
+    } else if(key.is_number()) {
+      return std::to_string(static_cast<long long>(std::floor(key.get<double>())));
     }
 
+    return S::empty;
+  }
 
-    return false;
+  inline json strkey(args_container&& args) {
+    return strkey(args.size() == 0 ? NONE : args[0]);
   }
 
-  json isempty(args_container&& args) {
-    json val = args.size() == 0 ? nullptr : std::move(args[0]);
+  // A property key, resolved once: its name (for maps) and list index, so
+  // that repeated getprop, setprop, delprop and haskey calls skip resolving
+  // it. Keys that are neither a string nor a number are not valid, and are
+  // ignored, as with the json key versions.
+  class Key {
+    public:
+      Key() = default;
 
-    // val.is_null()
-    if(val == nullptr) {
-      return true;
-    }
+      explicit Key(const std::string& key) : name{key}, valid{true} {
+        hasindex = ::Auxiliary::parse_index(key, index);
+      }
 
-    if(val == S::empty) {
-      return true;
-    }
+      explicit Key(const char* key) : Key(std::string(key)) {}
 
-    if(islist({ val }) && val.size() == 0) {
-      return true;
-    }
+      explicit Key(int key) : valid{true}, hasindex{true}, index{key} {
+        char buf[16];
+        name.assign(buf, static_cast<size_t>(std::snprintf(buf, sizeof(buf), "%d", key)));
+      }
 
-    if(ismap({ val }) && val.size() == 0) {
-      return true;
-    }
+      explicit Key(const json& key) {
+        if(key.is_string()) {
+          name = key.get_ref<const std::string&>();
+          valid = true;
+          hasindex = ::Auxiliary::parse_index(name, index);
+        } else if(key.is_number()) {
+          name = key.dump();
+          valid = true;
+          hasindex = ::Auxiliary::list_index(key, index);
+        }
+      }
+
+      // The map key (numbers as json text).
+      const std::string& str() const {
+        return nullptr == interned ? name : *interned;
+      }
+
+      // A string or number.
+      bool isvalid() const {
+        return valid;
+      }
+
+      // As with iskey: a non-empty string, or a number.
+      bool iskey() const {
+        return valid && !str().empty();
+      }
+
+      // The list index, if the key has one.
+      bool listindex(int& out) const {
+        out = index;
+        return hasindex;
+      }
+
+    private:
+      friend class KeyTable;
 
+      std::string name;
+      const std::string* interned = nullptr;
+      bool valid = false;
+      bool hasindex = false;
+      int index = -1;
+  };
+
+  // Interned key names. A Key from a KeyTable refers to the table's copy of
+  // its name, so keys used across a map heavy document are copied without
+  // copying their names. Keys must not outlive their table, and a table
+  // must not be shared between threads while keys are added.
+  class KeyTable {
+    public:
+      Key key(const std::string& name) {
+        Key out;
+        out.interned = &*names.insert(name).first;
+        out.valid = true;
+        out.hasindex = ::Auxiliary::parse_index(name, out.index);
+        return out;
+      }
+
+      Key key(const char* name) {
+        return key(std::string(name));
+      }
+
+      Key key(const json& key) {
+        return key.is_string() ? this->key(key.get_ref<const std::string&>()) : Key(key);
+      }
+
+      size_t size() const {
+        return names.size();
+      }
+
+    private:
+      std::unordered_set<std::string> names;
+  };
 
+  // Check for an "empty" value - absent, empty string, array, object.
+  inline bool isempty(const json& val) noexcept {
+    switch(val.type()) {
+      case json::value_t::null:
+        return true;
+      case json::value_t::string:
+        return val.get_ptr<const json::string_t*>()->empty();
+      case json::value_t::array:
+        return val.get_ptr<const json::array_t*>()->empty();
+      case json::value_t::object:
+        return val.get_ptr<const json::object_t*>()->empty();
+      default:
+        return false;
+    }
+  }
 
-    return false;
+  inline json isempty(args_container&& args) {
+    return isempty(args.size() == 0 ? NONE : args[0]);
   }
 
   // NOTE: Use template specialization
@@ -204,529 +496,5928 @@ namespace VoxgigStruct {
     }
 
 
-  json getprop(args_container&& args) {
-    json val = args.size() == 0 ? nullptr : std::move(args[0]);
-    json key = args.size() < 2 ? nullptr : std::move(args[1]);
-    json alt = args.size() < 3 ? nullptr : std::move(args[2]);
+  // Safely get a property of a node. Absent arguments return alt.
+  // If the key is not found, return the alternative value.
+  // NOTE: The result refers either into val or to alt. Copy it when alt is a temporary.
+  inline const json& getprop(const json& val, const json& key, const json& alt = NONE) {
+    VOXGIG_STAT(GETPROP);
 
-    if(val.is_null()) {
+    if(val.is_null() || key.is_null()) {
       return alt;
     }
 
-    if(key.is_null()) {
-      return alt;
-    }
+    if(val.is_object()) {
+      json::const_iterator it = key.is_string() ?
+        val.find(key.get_ref<const std::string&>()) : val.find(key.dump());
 
-    json out = alt;
+      if(it == val.end() || it->is_null()) {
+        return alt;
+      }
 
-    if(ismap({val})) {
-      out = val.value(key.is_string() ? key : json(key.dump()), alt);
+      return *it;
     }
-    else if(islist({val})) {
+    else if(val.is_array()) {
       int _key {0};
 
-      try {
-        _key = key.get<int>();
-      } catch(const json::exception&) {
-
-        try {
-          std::string __key = key.get<std::string>();
-          // TODO: Refactor: this is O(2n)
-          Auxiliary::validate_int(__key);
-          _key = std::stoi(__key);
-          goto try_access;
-
-        } catch(...) {}
-
+      if(!::Auxiliary::list_index(key, _key)) {
         return alt;
       }
 
-try_access:
-      if(0 <= _key && _key < val.size()) {
+      if(0 <= _key && _key < static_cast<int>(val.size()) && !val[_key].is_null()) {
         return val[_key];
-      } else {
-        return alt;
       }
-
-    }
-
-    if(out.is_null()) {
-      out = alt;
     }
 
-
-
-    return out;
+    return alt;
   }
 
+  // As above, with a resolved key.
+  inline const json& getprop(const json& val, const Key& key, const json& alt = NONE) {
+    VOXGIG_STAT(GETPROP);
 
-  json keysof(args_container&& args) {
-    json val = args.size() == 0 ? nullptr : args[0];
-
-    if(isnode({val}) == false) {
-      return json::array();
-    } else if(ismap({val})) {
-      json keys = json::array();
-      for(json::iterator it = val.begin(); it != val.end(); it++) {
-        keys.push_back(it.key());
-      }
-      return keys; // TODO: sorted(val.keys()). HOWEVER, the keys appear to be sorted (in order) by default. Try "std::cout << json::parse(R"({"b": 1, "a": 2})") << std::endl;"
-    } else {
-      json arr = json::array();
-      for(int i = 0; i < val.size(); i++) {
-        arr.push_back(std::to_string(i));
-      }
-      return arr;
+    int index;
+    if(!key.isvalid()) {
+      return alt;
+    } else if(val.is_object()) {
+      json::const_iterator it = val.find(key.str());
+      return it == val.end() || it->is_null() ? alt : *it;
+    } else if(val.is_array() && key.listindex(index) &&
+        0 <= index && index < static_cast<int>(val.size()) && !val[index].is_null()) {
+      return val[index];
     }
 
+    return alt;
   }
 
-  json haskey(args_container&& args) {
+  inline json getprop(args_container&& args) {
     json val = args.size() == 0 ? nullptr : std::move(args[0]);
     json key = args.size() < 2 ? nullptr : std::move(args[1]);
+    json alt = args.size() < 3 ? nullptr : std::move(args[2]);
 
-    return getprop({val, key}) != nullptr;
+    return getprop(val, key, alt);
   }
 
-  json items(args_container&& args) {
-    json val = args.size() == 0 ? nullptr : std::move(args[0]);
-
-    if(ismap({ val })) {
-      json _items = json::array();
-      for(json::iterator it = val.begin(); it != val.end(); it++) {
-        json pair = json::array();
-        pair.push_back(it.key());
-        pair.push_back(it.value());
 
-        _items.push_back(pair);
-      }
-      return _items;
-
-    } else if(islist({ val })) {
-      json _items = json::array();
-      int i = 0;
+  // Views
+  // =====
 
-      for(json::iterator it = val.begin(); it != val.end(); it++, i++) {
-        json pair = json::array();
-        pair.push_back(i);
-        pair.push_back(it.value());
-        _items.push_back(pair);
-      }
+  namespace Auxiliary {
 
-      return _items;
-    } else {
-      return json::array();
-    }
+    // Iterates the children of a node (J is json or const json) with their
+    // keys, without copying either. List indexes are formatted into a
+    // buffer short enough to never allocate.
+    template<class J>
+    class ItemsIterator {
+      public:
+        using Iterator = typename std::conditional<std::is_const<J>::value,
+              json::const_iterator, json::iterator>::type;
 
-  }
+        // A [key, value] item. In C++17: for(auto [key, val] : items_view(node)).
+        struct Item {
+          const std::string& key;
+          J& val;
+        };
 
-  json escre(args_container&& args) {
-    json s = args.size() == 0 ? nullptr : std::move(args[0]);
+        ItemsIterator(Iterator it, bool map) : it{it}, map{map} {
+          if(!map) {
+            setindex();
+          }
+        }
 
-    if(s == nullptr) {
-      s = S::empty;
-    }
+        const std::string& key() const {
+          return map ? it.key() : indexkey;
+        }
 
-    const std::string& s_string = s.get<std::string>();
+        J& value() const {
+          return *it;
+        }
 
-    const std::regex pattern(R"([.*+?^${}()|[\]\\])");
+        size_t index() const {
+          return i;
+        }
 
-    return std::regex_replace(s_string, pattern, R"(\$&)");
+        Item operator*() const {
+          return Item{ key(), value() };
+        }
 
-  }
+        ItemsIterator& operator++() {
+          ++it;
+          ++i;
+          if(!map) {
+            setindex();
+          }
+          return *this;
+        }
 
-  json escurl(args_container&& args) {
-    json s = args.size() == 0 ? nullptr : std::move(args[0]);
+        bool operator!=(const ItemsIterator& other) const {
+          return it != other.it;
+        }
 
-    if(s == nullptr) {
-      s = S::empty;
-    }
+        bool operator==(const ItemsIterator& other) const {
+          return it == other.it;
+        }
 
-    const std::string& s_string = s.get<std::string>();
+      private:
+        void setindex() {
+          char buf[24];
+          indexkey.assign(buf, static_cast<size_t>(std::snprintf(buf, sizeof(buf), "%zu", i)));
+        }
 
-    std::ostringstream escaped;
-    escaped.fill('0');
-    escaped << std::hex;
+        Iterator it;
+        bool map;
+        size_t i = 0;
+        std::string indexkey;
+    };
 
-    for (unsigned char c : s_string) {
-      // Encode non-alphanumeric characters except '-' '_' '.' '~'
-      if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
-        escaped << c;
-      } else {
-        escaped << '%' << std::uppercase << std::setw(2) << int(c);
-        escaped << std::nouppercase;
-      }
-    }
+    // As ItemsIterator, yielding only the keys.
+    template<class J>
+    class KeysIterator : public ItemsIterator<J> {
+      public:
+        using ItemsIterator<J>::ItemsIterator;
 
-    return escaped.str();
-  }
+        const std::string& operator*() const {
+          return this->key();
+        }
 
-  json joinurl(args_container&& args) {
-    json _sarr = args.size() == 0 ? nullptr : std::move(args[0]);
+        KeysIterator& operator++() {
+          ItemsIterator<J>::operator++();
+          return *this;
+        }
+    };
 
-    std::vector<std::string> sarr;
+    // A range over the children of a node. Scalars (and absent values) have none.
+    template<class I, class J>
+    class NodeView {
+      public:
+        explicit NodeView(J& val) : val{isnode(val) ? &val : none()}, map{ismap(val)} {}
 
-    std::vector<std::string> parts;
+        I begin() const {
+          return I(val->begin(), map);
+        }
 
-    for(json::iterator it = _sarr.begin(); it != _sarr.end(); it++) {
-      json v = it.value();
-      if(v != nullptr && v != "") {
-        sarr.push_back(v.get<std::string>());
-      }
-    }
+        I end() const {
+          return I(val->end(), map);
+        }
 
+        size_t size() const {
+          return val->size();
+        }
 
-    // Refactor: double loop
-    for (size_t i = 0; i < sarr.size(); ++i) {
-      std::string s = sarr[i];
+        bool empty() const {
+          return val->empty();
+        }
 
-      if(i == 0) {
-            s = std::regex_replace(s, std::regex(R"(([^/])/+)"), "$1/");
-            s = std::regex_replace(s, std::regex(R"(/+$)"), "");
-      } else {
-            s = std::regex_replace(s, std::regex(R"(([^/])/+)"), "$1/"); // Merge multiple slashes after a character
-            s = std::regex_replace(s, std::regex(R"(^/+)"), ""); // Remove leading slashes
-            s = std::regex_replace(s, std::regex(R"(/+$)"), "");
-      }
+      private:
+        // An empty list, never changed, to iterate for scalars.
+        static J* none() {
+          static json none = json::array();
+          return &none;
+        }
 
-      if (!s.empty()) {
-        parts.push_back(s);
-      }
+        J* val;
+        bool map;
+    };
 
-    }
+  }
 
-    std::string out = parts.empty() ? "" : std::accumulate(parts.begin() + 1, parts.end(), parts[0],
-        [](const std::string& a, const std::string& b) {
-          return a + "/" + b;
-        });
+  using ItemsView = Auxiliary::NodeView<Auxiliary::ItemsIterator<const json>, const json>;
+  using MutableItemsView = Auxiliary::NodeView<Auxiliary::ItemsIterator<json>, json>;
+  using KeysView = Auxiliary::NodeView<Auxiliary::KeysIterator<const json>, const json>;
 
-    return out;
+  // The [key, value] items of a node in items order, as references: nothing
+  // is copied, and list indexes are strings (as with items) that do not allocate.
+  // The view refers to val, and is invalidated as its iterators are.
+  inline ItemsView items_view(const json& val) {
+    return ItemsView(val);
+  }
 
+  // As above, with values that can be changed in place.
+  inline MutableItemsView items_view(json& val) {
+    return MutableItemsView(val);
   }
 
-  json stringify(args_container&& args) {
-    json val = args.size() == 0 ? nullptr : std::move(args[0]);
-    json maxlen = args.size() < 2 ? nullptr : std::move(args[1]);
+  // The keys of a node in keysof order, as references.
+  inline KeysView keys_view(const json& val) {
+    return KeysView(val);
+  }
 
-    json _json = S::empty;
+  // Sorted keys of a map, or indexes (as strings) of a list.
+  inline json keysof(const json& val) {
+    json keys = json::array();
 
-    if(args.size() == 0){
-      return S::empty;
+    // NOTE: nlohmann::json objects are std::map based, so keys are already sorted.
+    const KeysView view = keys_view(val);
+    keys.get_ptr<json::array_t*>()->reserve(view.size());
+    for(const std::string& key : view) {
+      keys.push_back(key);
     }
 
-    try {
-      _json = val.dump();
-    } catch(const json::exception&) {
-      _json = val; // TODO: Possibly an edge case
-    }
+    return keys;
+  }
+
+  inline json keysof(args_container&& args) {
+    return keysof(args.size() == 0 ? NONE : args[0]);
+  }
+
+  // Value of property with name key in node val is defined.
+  inline bool haskey(const json& val, const json& key) {
+    return !getprop(val, key).is_null();
+  }
 
-    std::string _jsonstr = std::regex_replace(_json.get<std::string>(), std::regex("(\")"), "");
+  inline bool haskey(const json& val, const Key& key) {
+    return !getprop(val, key).is_null();
+  }
 
-    if(maxlen != nullptr) {
-      int _maxlen = maxlen.get<int>();
+  inline json haskey(args_container&& args) {
+    return haskey(
+        args.size() == 0 ? NONE : args[0],
+        args.size() < 2 ? NONE : args[1]);
+  }
 
-      std::string js = _jsonstr.substr(0, _maxlen);
+  // List the sorted keys of a map or list as an array of tuples of the form [key, value].
+  // As with keysof, list indexes are converted to strings.
+  inline json items(const json& val) {
+    json _items = json::array();
 
-      _jsonstr = _maxlen < _jsonstr.length() ? (js.substr(0, _maxlen-3)) + "..." : _jsonstr;
+    const ItemsView view = items_view(val);
+    _items.get_ptr<json::array_t*>()->reserve(view.size());
+    for(auto item : view) {
+      _items.push_back(json::array({ item.key, item.val }));
     }
 
-    return _jsonstr;
+    return _items;
   }
-  
-  json clone(args_container&& args) {
-    json val = args.size() == 0 ? nullptr : std::move(args[0]);
 
-    if(val.is_null()) {
-      return nullptr;
-    }
+  inline json items(args_container&& args) {
+    return items(args.size() == 0 ? NONE : args[0]);
+  }
 
-    /* NOTE: Simple clone without replace/reviver as this use case is impractical in C++ unless we do it in as part of our own interface */
+  namespace Auxiliary {
 
-    /*
-    if(val.is_array()) {
-      json arr = json::array();
+    // A set of bytes, as a lookup table and as up to 8 ranges of bytes (or the bytes outside
+    // them, if negated). scan finds the first byte in the set, testing 16 bytes at a time
+    // against the ranges where SSE2 is available (and byte by byte otherwise).
+    class ByteSet {
+      public:
+        static const int MAXRANGES = 8;
 
-      for(json::iterator item = val.begin(); item != val.end(); item++) {
-        arr.push_back(
-            clone({item.value()})
-        );
-      }
+        // The bytes of chars (or, negated, all other bytes).
+        explicit ByteSet(const char* chars, bool negate = false) {
+          bool in[256] = { false };
+          for(const char* c = chars; '\0' != *c; c++) {
+            in[static_cast<unsigned char>(*c)] = true;
+          }
+          build(in, negate);
+        }
 
-      return arr;
+        // The bytes in ranges of lo, hi pairs (or, negated, all other bytes).
+        ByteSet(std::initializer_list<std::pair<unsigned char, unsigned char>> ranges, bool negate) {
+          bool in[256] = { false };
+          for(const std::pair<unsigned char, unsigned char>& range : ranges) {
+            for(int c = range.first; c <= range.second; c++) {
+              in[c] = true;
+            }
+          }
+          build(in, negate);
+        }
 
-    } else if(val.is_object()) {
-      json obj = json::object();
+        bool has(unsigned char c) const {
+          return table[c];
+        }
 
-      for(json::iterator item = val.begin(); item != val.end(); item++) {
-        obj[item.key()] = clone({ item.value() });
-      }
+        // The first byte of [at, end) in the set, or end.
+        const char* scan(const char* at, const char* end) const {
+#ifdef __SSE2__
+          if(0 <= nranges && 16 <= end - at) {
+            const int n = nranges;
+            __m128i los[MAXRANGES];
+            __m128i spans[MAXRANGES];
+            for(int rI = 0; rI < n; rI++) {
+              los[rI] = _mm_set1_epi8(static_cast<char>(lo[rI]));
+              spans[rI] = _mm_set1_epi8(static_cast<char>(hi[rI] - lo[rI]));
+            }
+            const int flip = negate ? 0xFFFF : 0;
+
+            for(; 16 <= end - at; at += 16) {
+              const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(at));
+              __m128i inside = _mm_setzero_si128();
+              for(int rI = 0; rI < n; rI++) {
+                // c is in [lo, hi] when c - lo (wrapping) is at most hi - lo.
+                const __m128i over = _mm_subs_epu8(_mm_sub_epi8(block, los[rI]), spans[rI]);
+                inside = _mm_or_si128(inside, _mm_cmpeq_epi8(over, _mm_setzero_si128()));
+              }
+              const int mask = _mm_movemask_epi8(inside) ^ flip;
+              if(0 != mask) {
+                return at + __builtin_ctz(static_cast<unsigned>(mask));
+              }
+            }
+          }
+#endif
+          while(at < end && !table[static_cast<unsigned char>(*at)]) {
+            at++;
+          }
+          return at;
+        }
+
+      private:
+        // The ranges are the runs of in. With more than MAXRANGES, nranges is -1 and only the
+        // table is used.
+        void build(const bool (&in)[256], bool neg) {
+          negate = neg;
+          nranges = 0;
+          for(int c = 0; c < 256; c++) {
+            table[c] = in[c] != negate;
+            if(in[c] && (0 == c || !in[c - 1]) && 0 <= nranges) {
+              if(MAXRANGES == nranges) {
+                nranges = -1;
+                continue;
+              }
+              lo[nranges] = static_cast<unsigned char>(c);
+              hi[nranges] = static_cast<unsigned char>(c);
+              nranges++;
+            } else if(in[c] && 0 < nranges) {
+              hi[nranges - 1] = static_cast<unsigned char>(c);
+            }
+          }
+        }
 
-      return obj;
+        unsigned char lo[MAXRANGES];
+        unsigned char hi[MAXRANGES];
+        int nranges = 0;
+        bool negate = false;
+        bool table[256];
+    };
+
+    // Bytes escaped by escre.
+    inline const ByteSet& escre_bytes() {
+      static const ByteSet set(".*+?^${}()|[]\\");
+      return set;
     }
-    */
-    
-    return val;
-  }
 
-  json setprop(args_container&& args) {
-    json parent = args.size() == 0 ? nullptr : std::move(args[0]);
-    json key = args.size() < 2 ? nullptr : std::move(args[1]);
-    json val = args.size() < 3 ? nullptr : std::move(args[2]);
+    // Bytes escaped by escurl: all but alphanumerics and - _ . ~
+    inline const ByteSet& escurl_bytes() {
+      static const ByteSet set({ { '0', '9' }, { 'A', 'Z' }, { 'a', 'z' },
+          { '-', '.' }, { '_', '_' }, { '~', '~' } }, true);
+      return set;
+    }
 
-    if(iskey({key}) == false) {
-      return parent;
+    // Bytes of a string inside a node that are escaped in JSON: controls, quote and backslash.
+    inline const ByteSet& jsonesc_bytes() {
+      static const ByteSet set({ { 0x00, 0x1F }, { '"', '"' }, { '\\', '\\' } }, false);
+      return set;
     }
 
-    if(ismap({parent})) {
-      std::string _key;
-      try {
-        _key = key.get<std::string>();
-      } catch(const json::exception&) {
-        _key = key.dump();
-      }
+    // Bytes of non ASCII text.
+    inline const ByteSet& nonascii_bytes() {
+      static const ByteSet set({ { 0x80, 0xFF } }, false);
+      return set;
+    }
 
-      if(val.is_null()) {
-        parent.erase(_key);
-      } else {
-        // NOTE: [json.exception.type_error.305] cannot use operator[] with a numeric argument with object
-        parent[_key] = val;
+    // Append s to out without the bytes in drop.
+    inline void append_without(std::string& out, const std::string& s, const ByteSet& drop) {
+      const char* at = s.data();
+      const char* end = at + s.size();
+      while(at < end) {
+        const char* stop = drop.scan(at, end);
+        out.append(at, stop - at);
+        at = stop + (stop < end ? 1 : 0);
       }
+    }
 
-    } else if(islist({parent})) {
-      int key_i;
-      try {
-        key_i = key.get<int>();
-      } catch(const json::exception&) {
-        return parent;
+  }
+
+  // Escape regular expression.
+  inline std::string escre(const std::string& s) {
+    const Auxiliary::ByteSet& special = Auxiliary::escre_bytes();
+
+    std::string out;
+    out.reserve(s.size() + 8);
+
+    const char* at = s.data();
+    const char* end = at + s.size();
+    while(at < end) {
+      const char* stop = special.scan(at, end);
+      out.append(at, stop - at);
+      if(stop < end) {
+        out += '\\';
+        out += *stop++;
       }
+      at = stop;
+    }
 
-      if(val.is_null()) {
-        if(0 <= key_i && key_i < parent.size()) {
-          // Shift items left
-          for(int pI = key_i; pI < parent.size() - 1; pI++) {
-            parent[pI] = parent[pI + 1];
-          }
-          // STL - vector pointer
-          // NOTE: parent.get<std::vector<json>>().pop_back(); // WON'T CUT IT. See the note below
-          std::vector<json>* parent_arr = parent.get_ptr<std::vector<json>*>();
-          parent_arr->pop_back();
-          // Inefficient: parent.erase(parent.size() - 1);
+    return out;
+  }
 
-        }
-      } else {
-        // Non-empty insert
-        if(key_i >= 0) {
-          if(key_i >= parent.size()) {
-            parent.push_back(val);
-          } else {
-            parent[key_i] = val;
-          }
-        } else {
-          /*
-          // NOTE: This is bad due to the implicit copy operator
-          std::vector<json> json_vector = parent.get<std::vector<json>>();
-          json_vector.emplace(json_vector.begin(), val);
-          // This won't cut it either
-          std::vector<json> json_vector;
-          parent.get_to(json_vector);
+  inline json escre(args_container&& args) {
+    json s = args.size() == 0 ? nullptr : std::move(args[0]);
 
-          json_vector.insert(json_vector.begin(), val);
-          */
+    if(s == nullptr) {
+      s = S::empty;
+    }
 
-          std::vector<json>* parent_arr = parent.get_ptr<std::vector<json>*>();
-          parent_arr->insert(parent_arr->begin(), val);
+    return escre(s.get_ref<const std::string&>());
+  }
 
-          // Alternatively: parent.insert(parent.begin(), val);
-        }
+  // Escape URLs.
+  inline std::string escurl(const std::string& s) {
+    static const char hex[] = "0123456789ABCDEF";
+    const Auxiliary::ByteSet& unsafe = Auxiliary::escurl_bytes();
+
+    std::string out;
+    out.reserve(s.size() + s.size() / 4);
+
+    // Runs of safe characters are copied whole.
+    const char* at = s.data();
+    const char* end = at + s.size();
+    while(at < end) {
+      const char* stop = unsafe.scan(at, end);
+      out.append(at, stop - at);
+      if(stop < end) {
+        const unsigned char c = static_cast<unsigned char>(*stop++);
+        const char esc[3] = { '%', hex[c >> 4], hex[c & 0xF] };
+        out.append(esc, 3);
       }
-
-
+      at = stop;
     }
 
-    return parent;
-
+    return out;
   }
 
-  json walk(args_container&& args) {
-    // These arguments are the public interface.
-    json val = args.size() == 0 ? nullptr : std::move(args[0]);
-    json apply = args.size() < 2 ? nullptr : std::move(args[1]);
+  inline json escurl(args_container&& args) {
+    json s = args.size() == 0 ? nullptr : std::move(args[0]);
 
-    // These arguments are used for recursive state.
-    json key = args.size() < 3 ? nullptr : std::move(args[2]);
-    json parent = args.size() < 4 ? nullptr : std::move(args[3]);
-    json path = args.size() < 5 ? nullptr : std::move(args[4]);
+    if(s == nullptr) {
+      s = S::empty;
+    }
 
+    return escurl(s.get_ref<const std::string&>());
+  }
 
-    // NOTE: CHEAT SINCE WE CAN'T PASS A DATA STRUCTURE LIKE THIS INTO JSON SAFELY
+  // Concatenate string parts, merging sep char as needed. Non-string and empty parts are skipped.
+  // With url, the first part keeps its leading separators and the last part its trailing ones.
+  inline std::string join(const json& arr, const std::string& sep = ",", bool url = false) {
+    if(!islist(arr)) {
+      return S::empty;
+    }
+
+    const int sarr = static_cast<int>(arr.size());
+    const bool single = sep.size() == 1;
+    const char sc = single ? sep[0] : '\0';
+
+    std::vector<std::string> parts;
+    int i = 0;
+
+    for(json::const_iterator it = arr.begin(); it != arr.end(); it++) {
+      if(!it->is_string() || it->get_ref<const std::string&>().empty()) {
+        continue;
+      }
+
+      std::string s = it->get<std::string>();
+
+      if(single) {
+        // Trailing separators (sep+$).
+        if((url && 0 == i) || i < sarr - 1 || !url) {
+          s.erase(s.find_last_not_of(sc) + 1);
+        }
+
+        if(!url || 0 < i) {
+          // Leading separators (^sep+).
+          if(0 < i) {
+            s.erase(0, s.find_first_not_of(sc));
+          }
+
+          // The first inner run of separators becomes one: ([^sep])sep+([^sep]).
+          const size_t first = s.find_first_not_of(sc);
+          const size_t run = std::string::npos == first ? first : s.find(sc, first);
+          const size_t end = std::string::npos == run ? run : s.find_first_not_of(sc, run);
+          if(std::string::npos != end) {
+            s.erase(run + 1, end - run - 1);
+          }
+        }
+      }
+
+      i++;
+
+      if(!s.empty()) {
+        parts.push_back(s);
+      }
+    }
+
+    std::string out = parts.empty() ? "" : std::accumulate(parts.begin() + 1, parts.end(), parts[0],
+        [&sep](const std::string& a, const std::string& b) {
+          return a + sep + b;
+        });
+
+    return out;
+  }
+
+  inline json join(args_container&& args) {
+    json arr = args.size() == 0 ? nullptr : std::move(args[0]);
+    json sep = args.size() < 2 ? nullptr : std::move(args[1]);
+    json url = args.size() < 3 ? nullptr : std::move(args[2]);
+
+    return join(arr,
+        sep.is_string() ? sep.get_ref<const std::string&>() : ",",
+        url.is_boolean() && url.get<bool>());
+  }
+
+  // Concatenate url part strings, merging forward slashes as needed.
+  inline std::string joinurl(const json& sarr) {
+    return join(sarr, "/", true);
+  }
+
+  inline json joinurl(args_container&& args) {
+    return joinurl(args.size() == 0 ? NONE : args[0]);
+  }
+
+  namespace Auxiliary {
+
+    // The terminal colour of a JSON level.
+    inline std::string stringify_level(int d) {
+      static const int colors[] = { 81, 118, 213, 39, 208, 201, 45, 190, 129, 51, 160, 121, 226, 33, 207, 69 };
+      return "\x1b[38;5;" + std::to_string(colors[((d % 16) + 16) % 16]) + "m";
+    }
+
+    // Colour deeper JSON levels differently, for terminals (simplistic wrt strings).
+    // Appends n coloured characters of s to t. The level d carries over between calls.
+    inline void stringify_colour(std::string& t, const char* s, size_t n, int& d) {
+      std::string o = stringify_level(d);
+      t.reserve(t.size() + n * 12);
+
+      for(const char* stop = s + n; s < stop; s++) {
+        const char ch = *s;
+        // Continuation bytes belong to the character before.
+        if(0x80 == (static_cast<unsigned char>(ch) & 0xC0)) {
+          t += ch;
+        } else if('{' == ch || '[' == ch) {
+          o = stringify_level(++d);
+          t += o + ch;
+        } else if('}' == ch || ']' == ch) {
+          t += o + ch;
+          o = stringify_level(--d);
+        } else {
+          t += o + ch;
+        }
+      }
+    }
+
+    // Where stringify text goes: appended to str, but not past end. With a
+    // stream, str only buffers a chunk, which is written out (coloured, if
+    // pretty) as it fills, so the whole text is never held.
+    struct StringifyOut {
+      std::string& str;
+      size_t end;
+      std::ostream* stream;
+      bool pretty;
+      int depth = 0;       // Level of the text written, for colours.
+      size_t written = 0;  // Characters already written to stream.
+
+      StringifyOut(std::string& str, size_t end, std::ostream* stream = nullptr, bool pretty = false) :
+        str(str), end{end}, stream{stream}, pretty{pretty} {}
+
+      size_t size() const {
+        return written + str.size();
+      }
+
+      void write(const char* s, size_t n) {
+        if(pretty) {
+          std::string t;
+          stringify_colour(t, s, n, depth);
+          stream->write(t.data(), t.size());
+        } else {
+          stream->write(s, n);
+        }
+        written += n;
+      }
+
+      void flush() {
+        write(str.data(), str.size());
+        str.clear();
+      }
+    };
+
+    // Append n characters of s to out, but not past end. Returns false if cut short.
+    inline bool stringify_put(StringifyOut& out, const char* s, size_t n) {
+      const size_t room = out.end - out.size();
+      const bool whole = n <= room;
+      if(!whole) {
+        n = room;
+      }
+
+      if(nullptr != out.stream && 4096 <= out.str.size() + n) {
+        out.flush();
+        out.write(s, n);
+      } else {
+        out.str.append(s, n);
+      }
+      return whole;
+    }
+
+    // A string inside a node: as dumped in JSON, without the quotes.
+    inline bool stringify_str(StringifyOut& out, const std::string& str) {
+      const char* at = str.data();
+      const char* stop = at + str.size();
+
+      // Non ASCII text is left to the JSON serializer, which checks it is valid UTF-8.
+      if(stop != nonascii_bytes().scan(at, stop)) {
+        static const ByteSet quote("\"");
+        std::string dumped;
+        append_without(dumped, json(str).dump(), quote);
+        return stringify_put(out, dumped.data(), dumped.size());
+      }
+
+      const ByteSet& escaped = jsonesc_bytes();
+      while(at < stop) {
+        const char* next = escaped.scan(at, stop);
+        if(!stringify_put(out, at, next - at)) {
+          return false;
+        }
+        if(next == stop) {
+          return true;
+        }
+        at = next + 1;
+
+        const unsigned char c = static_cast<unsigned char>(*next);
+        char esc[8] = { '\\', 0 };
+        size_t len = 2;
+        switch(c) {
+          case '"': len = 1; break;
+          case '\\': esc[1] = '\\'; break;
+          case '\b': esc[1] = 'b'; break;
+          case '\f': esc[1] = 'f'; break;
+          case '\n': esc[1] = 'n'; break;
+          case '\r': esc[1] = 'r'; break;
+          case '\t': esc[1] = 't'; break;
+          default:
+            len = static_cast<size_t>(std::snprintf(esc, sizeof(esc), "\\u%04x", c));
+        }
+        if(!stringify_put(out, esc, len)) {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    // Append the stringify text of val to out, stopping at its end. Returns false once stopped.
+    inline bool stringify_node(StringifyOut& out, const json& val) {
+      VOXGIG_STAT_NODES(1);
+
+      if(val.is_object()) {
+        bool first = true;
+        if(!stringify_put(out, "{", 1)) {
+          return false;
+        }
+        for(json::const_iterator it = val.begin(); it != val.end(); ++it) {
+          if(!(first || stringify_put(out, ",", 1)) ||
+              !stringify_str(out, it.key()) ||
+              !stringify_put(out, ":", 1) ||
+              !stringify_node(out, it.value())) {
+            return false;
+          }
+          first = false;
+        }
+        return stringify_put(out, "}", 1);
+      }
+
+      if(val.is_array()) {
+        bool first = true;
+        if(!stringify_put(out, "[", 1)) {
+          return false;
+        }
+        for(const json& child : val) {
+          if(!(first || stringify_put(out, ",", 1)) || !stringify_node(out, child)) {
+            return false;
+          }
+          first = false;
+        }
+        return stringify_put(out, "]", 1);
+      }
+
+      if(val.is_string()) {
+        return stringify_str(out, val.get_ref<const std::string&>());
+      }
+
+      const std::string dumped = val.dump();
+      return stringify_put(out, dumped.data(), dumped.size());
+    }
+
+    // The stringify text of val into out. A failure replaces the text not yet written out.
+    inline void stringify_into(StringifyOut& out, const json& val) {
+      if(val.is_string()) {
+        const std::string& str = val.get_ref<const std::string&>();
+        stringify_put(out, str.data(), str.size());
+        return;
+      }
+
+      const size_t start = out.size();
+      try {
+        stringify_node(out, val);
+      } catch(const json::exception&) {
+        out.str.resize(start < out.written ? 0 : start - out.written);
+        out.str += "__STRINGIFY_FAILED__";
+      }
+    }
+
+  }
+
+  // Safely stringify a value for humans (NOT JSON!), appending to out.
+  // Map keys are sorted. A negative maxlen means no limit; otherwise
+  // serialization stops once the text is longer than maxlen, which is
+  // then cut to end with "...". With pretty, levels are coloured for terminals.
+  inline std::string& stringify_to(std::string& out, const json& val, int maxlen = -1, bool pretty = false) {
+    VOXGIG_STAT(STRINGIFY);
+
+    const size_t start = out.size();
+    Auxiliary::StringifyOut sink(out, maxlen < 0 ? std::string::npos : start + maxlen + 1);
+    Auxiliary::stringify_into(sink, val);
+
+    if(-1 < maxlen && static_cast<size_t>(maxlen) < out.size() - start) {
+      out.resize(start + (maxlen < 3 ? maxlen : maxlen - 3));
+      out += "...";
+    }
+
+    if(pretty) {
+      int d = 0;
+      std::string colored = Auxiliary::stringify_level(d);
+      Auxiliary::stringify_colour(colored, out.data() + start, out.size() - start, d);
+      out.replace(start, std::string::npos, colored + "\x1b[0m");
+    }
+
+    return out;
+  }
+
+  // As above, writing to out. Without maxlen the text is written as it is
+  // made, in chunks, so once one is written a failure can only add
+  // "__STRINGIFY_FAILED__" after it.
+  inline std::ostream& stringify_to(std::ostream& out, const json& val, int maxlen = -1, bool pretty = false) {
+    std::string str;
+
+    // A cut text is at most maxlen long, and made whole before it is cut.
+    if(-1 < maxlen) {
+      return out << stringify_to(str, val, maxlen, pretty);
+    }
+
+    VOXGIG_STAT(STRINGIFY);
+
+    if(pretty) {
+      out << Auxiliary::stringify_level(0);
+    }
+
+    Auxiliary::StringifyOut sink(str, std::string::npos, &out, pretty);
+    Auxiliary::stringify_into(sink, val);
+    sink.flush();
+
+    if(pretty) {
+      out << "\x1b[0m";
+    }
+
+    return out;
+  }
+
+  // Safely stringify a value for humans (NOT JSON!). A negative maxlen means no limit.
+  inline std::string stringify(const json& val, int maxlen = -1, bool pretty = false) {
+    std::string out;
+    return stringify_to(out, val, maxlen, pretty);
+  }
+
+  inline json stringify(args_container&& args) {
+    if(args.size() == 0){
+      return S::empty;
+    }
+
+    return stringify(args[0], args.size() < 2 || args[1].is_null() ? -1 : args[1].get<int>(),
+        2 < args.size() && true == args[2]);
+  }
+
+  // Clone a JSON-like data structure.
+  inline json clone(const json& val) {
+    VOXGIG_STAT(CLONE);
+
+    /* NOTE: Simple clone without replace/reviver as this use case is impractical in C++ unless we do it in as part of our own interface */
+    return val;
+  }
+
+  inline json clone(args_container&& args) {
+    json val = args.size() == 0 ? nullptr : std::move(args[0]);
+
+    // NOTE: The argument is already owned, so hand it back rather than copying it again.
+    return val;
+  }
+
+  // Binary serialization
+  // ====================
+
+  // The bytes of a value, in CBOR or MessagePack. These are smaller than the
+  // JSON text and quicker to read, so values are cheaper to hand between
+  // threads or processes, or to keep in a cache, as binary.
+  using Binary = std::vector<std::uint8_t>;
+
+  enum class BinaryFormat { CBOR, MSGPACK };
+
+  namespace Auxiliary {
+
+    // The head of a CBOR item: its major type and argument, in the shortest form.
+    inline void cbor_head(Binary& out, unsigned major, std::uint64_t arg) {
+      const std::uint8_t type = static_cast<std::uint8_t>(major << 5);
+      int bytes = 0;
+      if(arg < 24) {
+        out.push_back(static_cast<std::uint8_t>(type | arg));
+        return;
+      } else if(arg <= 0xff) {
+        out.push_back(type | 24);
+        bytes = 1;
+      } else if(arg <= 0xffff) {
+        out.push_back(type | 25);
+        bytes = 2;
+      } else if(arg <= 0xffffffff) {
+        out.push_back(type | 26);
+        bytes = 4;
+      } else {
+        out.push_back(type | 27);
+        bytes = 8;
+      }
+      for(int bI = bytes - 1; 0 <= bI; bI--) {
+        out.push_back(static_cast<std::uint8_t>(arg >> (8 * bI)));
+      }
+    }
+
+    inline void cbor_bytes(Binary& out, unsigned major, const char* data, size_t size) {
+      cbor_head(out, major, size);
+      out.insert(out.end(), data, data + size);
+    }
+
+    // Write val as CBOR, with the shortest heads. Floats are always doubles,
+    // so they stay floats. CBOR has one kind of integer that is not negative,
+    // so a number_integer of 0 or more is read back as a number_unsigned, as
+    // nlohmann's from_cbor reads it (equal, by ==, but of another type()).
+    inline void cbor_write(Binary& out, const json& val) {
+      switch(val.type()) {
+        case json::value_t::boolean:
+          out.push_back(val.get<bool>() ? 0xf5 : 0xf4);
+          break;
+        case json::value_t::number_integer: {
+          const std::int64_t num = val.get<std::int64_t>();
+          cbor_head(out, 0 <= num ? 0 : 1, 0 <= num ? num : -1 - num);
+          break;
+        }
+        case json::value_t::number_unsigned:
+          cbor_head(out, 0, val.get<std::uint64_t>());
+          break;
+        case json::value_t::number_float: {
+          const double num = val.get<double>();
+          std::uint64_t bits;
+          std::memcpy(&bits, &num, sizeof(bits));
+          out.push_back(0xfb);
+          for(int bI = 7; 0 <= bI; bI--) {
+            out.push_back(static_cast<std::uint8_t>(bits >> (8 * bI)));
+          }
+          break;
+        }
+        case json::value_t::string: {
+          const std::string& str = val.get_ref<const std::string&>();
+          cbor_bytes(out, 3, str.data(), str.size());
+          break;
+        }
+        case json::value_t::binary: {
+          const json::binary_t& bin = val.get_binary();
+          cbor_bytes(out, 2, reinterpret_cast<const char*>(bin.data()), bin.size());
+          break;
+        }
+        case json::value_t::array:
+          cbor_head(out, 4, val.size());
+          for(const json& child : val) {
+            cbor_write(out, child);
+          }
+          break;
+        case json::value_t::object:
+          cbor_head(out, 5, val.size());
+          for(json::const_iterator it = val.begin(); it != val.end(); ++it) {
+            cbor_bytes(out, 3, it.key().data(), it.key().size());
+            cbor_write(out, it.value());
+          }
+          break;
+        default:
+          out.push_back(0xf6);
+      }
+    }
+
+    // Read the CBOR that cbor_write writes. Anything else (indefinite lengths,
+    // tags, half floats, trailing or missing bytes) stops the read, so that
+    // the caller can hand the input to nlohmann's complete reader instead.
+    struct CborReader {
+      const std::uint8_t* at;
+      const std::uint8_t* end;
+
+      bool arg(std::uint8_t info, std::uint64_t& out) {
+        const int bytes = info < 24 ? 0 : 24 == info ? 1 : 25 == info ? 2 : 26 == info ? 4 : 27 == info ? 8 : -1;
+        if(bytes < 0 || end - at < bytes) {
+          return false;
+        }
+        out = info < 24 ? info : 0;
+        for(int bI = 0; bI < bytes; bI++) {
+          out = (out << 8) | *at++;
+        }
+        return true;
+      }
+
+      bool text(std::uint64_t size, std::string& out) {
+        if(static_cast<std::uint64_t>(end - at) < size) {
+          return false;
+        }
+        out.assign(reinterpret_cast<const char*>(at), static_cast<size_t>(size));
+        at += size;
+        return true;
+      }
+
+      bool read(json& out) {
+        if(at == end) {
+          return false;
+        }
+
+        const std::uint8_t head = *at++;
+        const std::uint8_t info = head & 31;
+        std::uint64_t n = 0;
+
+        if(7 == head >> 5) {
+          if(20 == info || 21 == info) {
+            out = 21 == info;
+          } else if(22 == info) {
+            out = nullptr;
+          } else if((26 == info || 27 == info) && arg(info, n)) {
+            if(26 == info) {
+              float num;
+              const std::uint32_t bits = static_cast<std::uint32_t>(n);
+              std::memcpy(&num, &bits, sizeof(num));
+              out = static_cast<double>(num);
+            } else {
+              double num;
+              std::memcpy(&num, &n, sizeof(num));
+              out = num;
+            }
+          } else {
+            return false;
+          }
+          return true;
+        }
+
+        if(!arg(info, n)) {
+          return false;
+        }
+
+        switch(head >> 5) {
+          case 0:
+            out = n;
+            return true;
+          case 1:
+            if(static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max()) < n) {
+              return false;
+            }
+            out = -1 - static_cast<std::int64_t>(n);
+            return true;
+          case 2:
+            if(static_cast<std::uint64_t>(end - at) < n) {
+              return false;
+            }
+            out = json::binary(json::binary_t::container_type(at, at + n));
+            at += n;
+            return true;
+          case 3:
+            out = std::string();
+            return text(n, *out.get_ptr<std::string*>());
+          case 4: {
+            // Each element takes at least a byte, so the size is checked before reserving.
+            if(static_cast<std::uint64_t>(end - at) < n) {
+              return false;
+            }
+            out = json::array();
+            json::array_t& list = *out.get_ptr<json::array_t*>();
+            list.resize(static_cast<size_t>(n));
+            for(json& child : list) {
+              if(!read(child)) {
+                return false;
+              }
+            }
+            return true;
+          }
+          case 5: {
+            out = json::object();
+            json::object_t& map = *out.get_ptr<json::object_t*>();
+            std::string key;
+            std::uint64_t size = 0;
+            for(std::uint64_t kI = 0; kI < n; kI++) {
+              if(at == end || 3 != *at >> 5 || !arg(*at++ & 31, size) || !text(size, key)) {
+                return false;
+              }
+              // The keys of cbor_write are in order, so each goes at the end.
+              if(!read(map.emplace_hint(map.end(), std::move(key), json())->second)) {
+                return false;
+              }
+            }
+            return true;
+          }
+          default:
+            return false;
+        }
+      }
+    };
+
+  }
+
+  // Append val to out in format.
+  inline Binary& to_binary(Binary& out, const json& val, BinaryFormat format = BinaryFormat::CBOR) {
+    if(BinaryFormat::MSGPACK == format) {
+      json::to_msgpack(val, out);
+    } else {
+      Auxiliary::cbor_write(out, val);
+    }
+    return out;
+  }
+
+  inline Binary to_binary(const json& val, BinaryFormat format = BinaryFormat::CBOR) {
+    Binary out;
+    return to_binary(out, val, format);
+  }
+
+  // The value in [data, data + size). Invalid bytes throw json::parse_error.
+  // CBOR as to_binary writes it is read directly; other CBOR by nlohmann.
+  inline json from_binary(const std::uint8_t* data, size_t size, BinaryFormat format = BinaryFormat::CBOR) {
+    if(BinaryFormat::MSGPACK == format) {
+      return json::from_msgpack(data, data + size);
+    }
+
+    json out;
+    Auxiliary::CborReader reader{ data, data + size };
+    if(reader.read(out) && reader.at == reader.end) {
+      return out;
+    }
+    return json::from_cbor(data, data + size);
+  }
+
+  inline json from_binary(const Binary& bytes, BinaryFormat format = BinaryFormat::CBOR) {
+    return from_binary(bytes.data(), bytes.size(), format);
+  }
+
+  // Clone val through a binary buffer rather than node by node: the copy is
+  // built by the thread (and in the arena) that calls this. The copy equals
+  // val, but integers that are not negative come back unsigned (see
+  // cbor_write), as with MessagePack, where clone keeps their type().
+  inline json clone_via_buffer(const json& val, BinaryFormat format = BinaryFormat::CBOR) {
+    static thread_local Binary buffer;
+    buffer.clear();
+    return from_binary(to_binary(buffer, val, format), format);
+  }
+
+  // A digest of val for cache keys in place of its stringify text, hex encoded:
+  // the 64 bit FNV-1a hash of its CBOR. Maps are sorted, so equal values have
+  // the same digest, except that 1 and 1.0 differ (as their text does). Unlike
+  // the text, the digest tells a string from the number it spells.
+  inline std::string binary_digest(const json& val) {
+    static thread_local Binary buffer;
+    buffer.clear();
+    to_binary(buffer, val);
+
+    std::uint64_t hash = 14695981039346656037ULL;
+    for(std::uint8_t byte : buffer) {
+      hash = (hash ^ byte) * 1099511628211ULL;
+    }
+
+    static const char* const HEX = "0123456789abcdef";
+    std::string out(16, '0');
+    for(int hI = 15; 0 <= hI; hI--, hash >>= 4) {
+      out[hI] = HEX[hash & 0xf];
+    }
+    return out;
+  }
+
+  // Delete a property in place. Missing keys and out of range indexes are ignored.
+  // List items after the index shift down by one (a single vector erase).
+  inline json& delprop(json& parent, const Key& key) {
+    VOXGIG_STAT(DELPROP);
+
+    int key_i;
+    if(!key.iskey()) {
+      return parent;
+    } else if(ismap(parent)) {
+      parent.erase(key.str());
+    } else if(islist(parent) && key.listindex(key_i) &&
+        0 <= key_i && key_i < static_cast<int>(parent.size())) {
+      parent.erase(static_cast<json::size_type>(key_i));
+    }
+
+    return parent;
+  }
+
+  inline json& delprop(json& parent, const json& key) {
+    return delprop(parent, Key(key));
+  }
+
+  inline json delprop(args_container&& args) {
+    json parent = args.size() == 0 ? nullptr : std::move(args[0]);
+    json key = args.size() < 2 ? nullptr : std::move(args[1]);
+
+    delprop(parent, key);
+
+    return parent;
+  }
+
+  // Set a property in place. A null value deletes the property.
+  // A list key past the end appends; a negative list key prepends.
+  // Returns parent, so calls can be chained.
+  inline json& setprop(json& parent, const Key& key, json&& val) {
+    VOXGIG_STAT(SETPROP);
+
+    int key_i;
+    if(!key.iskey()) {
+      return parent;
+    } else if(val.is_null()) {
+      return delprop(parent, key);
+    }
+
+    if(ismap(parent)) {
+      parent[key.str()] = std::move(val);
+    } else if(islist(parent) && key.listindex(key_i)) {
+      if(key_i >= 0) {
+        if(key_i >= static_cast<int>(parent.size())) {
+          parent.push_back(std::move(val));
+        } else {
+          parent[key_i] = std::move(val);
+        }
+      } else {
+        // NOTE: Insert on the underlying vector; parent.get<std::vector<json>>() would copy it.
+        json::array_t* parent_arr = parent.get_ptr<json::array_t*>();
+        parent_arr->insert(parent_arr->begin(), std::move(val));
+      }
+    }
+
+    return parent;
+  }
+
+  inline json& setprop(json& parent, const Key& key, const json& val) {
+    return setprop(parent, key, json(val));
+  }
+
+  inline json& setprop(json& parent, const json& key, json&& val) {
+    return setprop(parent, Key(key), std::move(val));
+  }
+
+  inline json& setprop(json& parent, const json& key, const json& val) {
+    return setprop(parent, key, json(val));
+  }
+
+  inline json setprop(args_container&& args) {
+    json parent = args.size() == 0 ? nullptr : std::move(args[0]);
+    json key = args.size() < 2 ? nullptr : std::move(args[1]);
+    json val = args.size() < 3 ? nullptr : std::move(args[2]);
+
+    setprop(parent, key, std::move(val));
+
+    return parent;
+  }
+
+  // Path from the root to the current node, one key per level. List indexes are decimal strings.
+  using WalkPath = std::vector<std::string>;
+
+  namespace Auxiliary {
+
+    // A nullptr callback is skipped.
+    inline void walk_call(std::nullptr_t, const std::string&, json&, const json&, const WalkPath&) {}
+
+    template<class F>
+    inline void walk_call(F& apply, const std::string& key, json& val, const json& parent, const WalkPath& path) {
+      apply(key, val, parent, path);
+    }
+
+    template<class B, class A>
+    void walk_node(json& val, B& before, A& after, int maxdepth, const std::string& key, const json& parent, WalkPath& path) {
+      VOXGIG_STAT_NODES(1);
+      walk_call(before, key, val, parent, path);
+
+      if(0 == maxdepth || (0 < maxdepth && maxdepth <= static_cast<int>(path.size()))) {
+        return;
+      }
+
+      // NOTE: A child left null is removed, as with setprop.
+      if(ismap(val)) {
+        for(json::iterator it = val.begin(); it != val.end();) {
+          path.push_back(it.key());
+          walk_node(it.value(), before, after, maxdepth, path.back(), val, path);
+          path.pop_back();
+
+          if(it->is_null()) {
+            it = val.erase(it);
+          } else {
+            ++it;
+          }
+        }
+      } else if(islist(val)) {
+        for(size_t i = 0, cI = 0, size = val.size(); i < size; i++) {
+          path.push_back(std::to_string(i));
+          walk_node(val[cI], before, after, maxdepth, path.back(), val, path);
+          path.pop_back();
+
+          if(val[cI].is_null()) {
+            delprop(val, static_cast<int>(cI));
+          } else {
+            cI++;
+          }
+        }
+      }
+
+      walk_call(after, key, val, parent, path);
+    }
+
+  }
+
+  // Walk a data structure depth first, in place. before is applied to a node
+  // before its children, after once they are done; either may be nullptr.
+  // Callbacks are called as f(key, val, parent, path) and may modify val.
+  // For the root node, key is empty, parent is NONE and path is empty.
+  // Use a negative maxdepth for the default (MAXDEPTH).
+  template<class B, class A>
+  inline json& walk(json& val, B&& before, A&& after, int maxdepth = MAXDEPTH) {
+    VOXGIG_STAT(WALK);
+
+    WalkPath path;
+    path.reserve(8);
+
+    Auxiliary::walk_node(val, before, after, 0 <= maxdepth ? maxdepth : MAXDEPTH, S::empty, NONE, path);
+
+    return val;
+  }
+
+  // Post-order walk, as with walk(val, nullptr, apply).
+  template<class F>
+  inline json& walk(json& val, F&& apply) {
+    return walk(val, nullptr, std::forward<F>(apply));
+  }
+
+  inline json walk(args_container&& args) {
+    json val = args.size() == 0 ? nullptr : std::move(args[0]);
+    json apply = args.size() < 2 ? nullptr : std::move(args[1]);
+
+    // NOTE: CHEAT SINCE WE CAN'T PASS A DATA STRUCTURE LIKE THIS INTO JSON SAFELY.
+    // Only this adapter takes a JsonFunction; C++ callers should use the template.
     JsonFunction* _apply = reinterpret_cast<JsonFunction*>(apply.get<intptr_t>());
 
-    /*
-      Walk a data structure depth-first, calling apply at each node (after children).
-    */
+    walk(val, [_apply](const std::string& key, json& v, const json& parent, const WalkPath& path) {
+        v = _apply->operator()({
+            path.empty() ? NONE : json(key), v, parent, json(path) });
+        });
+
+    return val;
+  }
+
+  // Streaming walk
+  // ==============
+
+  // A walk_stream before callback sets a node to this to have it built whole
+  // (see walk_stream). It is a binary value, which JSON text cannot hold.
+  inline const json& walk_stream_build() {
+    static const json mark = json::binary({ 'b', 'u', 'i', 'l', 'd' });
+    return mark;
+  }
+
+  namespace Auxiliary {
+
+    // SAX handler of walk_stream. Nodes above maxdepth are streamed: their
+    // callbacks get an empty node of the same type (a stub) in place of the
+    // node, and only the stubs of the ancestors are kept. Values at maxdepth
+    // are built whole, as walk would give them to before, and so are nodes
+    // that before asks for, which are then walked as walk does.
+    template<class B, class A>
+    class WalkStreamSax {
+      public:
+        WalkStreamSax(B& before, A& after, int maxdepth) :
+          before(before), after(after), maxdepth(maxdepth) {
+          path.reserve(8);
+        }
+
+        bool null() {
+          return value(json(nullptr));
+        }
+
+        bool boolean(bool val) {
+          return value(json(val));
+        }
+
+        bool number_integer(json::number_integer_t val) {
+          return value(json(val));
+        }
+
+        bool number_unsigned(json::number_unsigned_t val) {
+          return value(json(val));
+        }
+
+        bool number_float(json::number_float_t val, const std::string&) {
+          return value(json(val));
+        }
+
+        bool string(std::string& val) {
+          return value(json(std::move(val)));
+        }
+
+        bool binary(json::binary_t& val) {
+          return value(json(std::move(val)));
+        }
+
+        bool start_object(std::size_t) {
+          return start(json::object());
+        }
+
+        bool start_array(std::size_t) {
+          return start(json::array());
+        }
+
+        bool key(std::string& key) {
+          if(0 < skipping) {
+            return true;
+          }
+          if(!build.empty()) {
+            buildkey = std::move(key);
+          } else {
+            frames.back().key = std::move(key);
+          }
+          return true;
+        }
+
+        bool end_object() {
+          return end();
+        }
+
+        bool end_array() {
+          return end();
+        }
+
+        template<class Exception>
+        bool parse_error(std::size_t, const std::string&, const Exception& ex) {
+          throw ex;
+        }
+
+      private:
+        struct Frame {
+          json stub;
+          bool map;
+          size_t index;
+          std::string key;
+        };
+
+        B& before;
+        A& after;
+        const int maxdepth;
+
+        WalkPath path;
+        std::vector<Frame> frames;
+
+        // The depth of the node being skipped, if any.
+        size_t skipping = 0;
+
+        // The value being built, and the nodes in it that are still open.
+        json built;
+        std::vector<json*> build;
+        std::string buildkey;
+        bool asked = false;  // Before asked for the value (it is not at maxdepth).
+
+        const std::string& current() const {
+          return path.empty() ? S::empty : path.back();
+        }
+
+        const json& parent() const {
+          return frames.empty() ? NONE : frames.back().stub;
+        }
+
+        // Push the key of a new value onto the path.
+        void enter() {
+          if(!frames.empty()) {
+            Frame& frame = frames.back();
+            path.push_back(frame.map ? std::move(frame.key) : std::to_string(frame.index++));
+          }
+        }
+
+        void leave() {
+          if(!frames.empty()) {
+            path.pop_back();
+          }
+        }
+
+        bool atmaxdepth() const {
+          return maxdepth <= static_cast<int>(path.size());
+        }
+
+        json& add(json&& val) {
+          json& node = *build.back();
+          if(node.is_object()) {
+            return node[buildkey] = std::move(val);
+          }
+          node.push_back(std::move(val));
+          return node.back();
+        }
+
+        bool value(json&& val) {
+          if(0 < skipping) {
+            return true;
+          }
+          if(!build.empty()) {
+            add(std::move(val));
+            return true;
+          }
+
+          enter();
+          walk_call(before, current(), val, parent(), path);
+          if(!atmaxdepth()) {
+            walk_call(after, current(), val, parent(), path);
+          }
+          leave();
+          return true;
+        }
+
+        bool start(json&& stub) {
+          if(0 < skipping) {
+            skipping++;
+            return true;
+          }
+          if(!build.empty()) {
+            build.push_back(&add(std::move(stub)));
+            return true;
+          }
+
+          enter();
+          if(atmaxdepth()) {
+            built = std::move(stub);
+            build.push_back(&built);
+            return true;
+          }
+
+          const bool map = stub.is_object();
+          walk_call(before, current(), stub, parent(), path);
+
+          if(stub.is_binary() && stub == walk_stream_build()) {
+            built = map ? json::object() : json::array();
+            build.push_back(&built);
+            asked = true;
+            return true;
+          }
+
+          // As with walk, a node that before replaces (say, with null) has no children.
+          if(!stub.is_structured()) {
+            skipping = 1;
+          }
+          frames.push_back(Frame{ std::move(stub), map, 0, S::empty });
+          return true;
+        }
+
+        // Walk the children of a node that was built, as walk does.
+        void walk_children(json& val) {
+          if(atmaxdepth()) {
+            return;
+          }
+          if(val.is_object()) {
+            for(json::iterator it = val.begin(); it != val.end(); ++it) {
+              path.push_back(it.key());
+              walk_node(it.value(), before, after, maxdepth, path.back(), val, path);
+              path.pop_back();
+            }
+          } else {
+            for(size_t i = 0; i < val.size(); i++) {
+              path.push_back(std::to_string(i));
+              walk_node(val[i], before, after, maxdepth, path.back(), val, path);
+              path.pop_back();
+            }
+          }
+        }
+
+        bool end() {
+          if(1 < skipping) {
+            skipping--;
+            return true;
+          }
+          skipping = 0;
+
+          if(!build.empty()) {
+            build.pop_back();
+            if(build.empty()) {
+              json val = std::move(built);
+              if(asked) {
+                asked = false;
+                walk_children(val);
+                walk_call(after, current(), val, parent(), path);
+              } else {
+                walk_call(before, current(), val, parent(), path);
+              }
+              leave();
+            }
+            return true;
+          }
+
+          Frame frame = std::move(frames.back());
+          frames.pop_back();
+          walk_call(after, current(), frame.stub, frames.empty() ? NONE : frames.back().stub, path);
+          leave();
+          return true;
+        }
+    };
+
+  }
+
+  // Walk JSON text as it is parsed, without building it (nlohmann's SAX
+  // interface). Callbacks are called as with walk, in the same order and
+  // with the same keys and paths. Scalars are given as they are, nodes as
+  // an empty map or list, and parents likewise: only the path to the
+  // current value is kept in memory. Nodes at maxdepth are built and given
+  // whole to before, as walk gives them. A node that before sets to
+  // walk_stream_build() is built whole, and then walked as walk would: its
+  // descendants, and after for it, get whole values and parents. A node
+  // that before sets to null (or any other scalar) is skipped, and its
+  // children are not built. Changes to values are not kept. Invalid JSON
+  // throws json::parse_error.
+  template<class B, class A>
+  inline void walk_stream(std::istream& in, B&& before, A&& after, int maxdepth = MAXDEPTH) {
+    Auxiliary::WalkStreamSax<typename std::remove_reference<B>::type, typename std::remove_reference<A>::type>
+      sax(before, after, 0 <= maxdepth ? maxdepth : MAXDEPTH);
+    json::sax_parse(in, &sax);
+  }
+
+  // As above, over text in memory.
+  template<class B, class A>
+  inline void walk_stream(const std::string& text, B&& before, A&& after, int maxdepth = MAXDEPTH) {
+    Auxiliary::WalkStreamSax<typename std::remove_reference<B>::type, typename std::remove_reference<A>::type>
+      sax(before, after, 0 <= maxdepth ? maxdepth : MAXDEPTH);
+    json::sax_parse(text, &sax);
+  }
+
+  namespace Auxiliary {
+
+    // Merge over into dst in place, moving children out of over. Both are nodes
+    // of the same kind; depth is the depth of their children.
+    inline void merge_node(json& dst, json&& over, int maxdepth, int depth) {
+      VOXGIG_STAT_NODES(1);
+
+      const bool map = ismap(over);
+      size_t i = 0;
+
+      for(json::iterator it = over.begin(); it != over.end(); ++it, ++i) {
+        json* tval = nullptr;
+        if(map) {
+          json::iterator found = dst.find(it.key());
+          tval = found == dst.end() ? nullptr : &found.value();
+        } else if(i < dst.size()) {
+          tval = &dst[i];
+        }
+
+        // Scalars, nodes of a different kind, and anything at maxdepth override directly.
+        if(maxdepth <= depth || !isnode(*it) || nullptr == tval ||
+            ismap(*tval) != ismap(*it) || islist(*tval) != islist(*it)) {
+          if(nullptr != tval) {
+            *tval = std::move(*it);
+          } else if(map) {
+            dst.emplace(it.key(), std::move(*it));
+          } else {
+            dst.push_back(std::move(*it));
+          }
+        } else {
+          merge_node(*tval, std::move(*it), maxdepth, depth + 1);
+        }
+      }
+    }
+
+  }
+
+  // Merge a list of values into each other. Later values have
+  // precedence.  Nodes override scalars. Node kinds (list or map)
+  // override each other, and do *not* merge.  Lists merge by index.
+  // The first element's storage is reused, and later elements are
+  // moved from, so pass an rvalue to avoid copying.
+  inline json merge(json&& val, int maxdepth = MAXDEPTH) {
+    VOXGIG_STAT(MERGE);
+
+    if(!islist(val)) {
+      return std::move(val);
+    }
+
+    json::array_t& list = *val.get_ptr<json::array_t*>();
+
+    if(list.empty()) {
+      return NONE;
+    } else if(1 == list.size()) {
+      return std::move(list[0]);
+    }
+
+    const int md = maxdepth < 0 ? 0 : maxdepth;
+
+    if(0 == md) {
+      json& last = list.back();
+      return islist(last) ? json::array() : ismap(last) ? json::object() : std::move(last);
+    }
+
+    json out = list[0].is_null() ? json::object() : std::move(list[0]);
+
+    for(size_t oI = 1; oI < list.size(); oI++) {
+      json& obj = list[oI];
+
+      // Matching node kinds merge; otherwise the later value wins.
+      if(isnode(obj) && ismap(out) == ismap(obj) && islist(out) == islist(obj)) {
+        Auxiliary::merge_node(out, std::move(obj), md, 1);
+      } else {
+        out = std::move(obj);
+      }
+    }
+
+    return out;
+  }
+
+  inline json merge(const json& val, int maxdepth = MAXDEPTH) {
+    return merge(json(val), maxdepth);
+  }
+
+  inline json merge(args_container&& args) {
+    json val = args.size() == 0 ? nullptr : std::move(args[0]);
+    const int maxdepth = args.size() < 2 || args[1].is_null() ? MAXDEPTH : args[1].get<int>();
+
+    return merge(std::move(val), maxdepth);
+  }
+
+  // Structural hashing
+  // ==================
+
+  namespace Auxiliary {
+
+    // The splitmix64 finalizer: every bit of h affects every bit of the result.
+    inline std::uint64_t hash_mix(std::uint64_t h) {
+      h ^= h >> 30;
+      h *= 0xbf58476d1ce4e5b9ULL;
+      h ^= h >> 27;
+      h *= 0x94d049bb133111ebULL;
+      return h ^ (h >> 31);
+    }
+
+    inline std::uint64_t hash_bytes(const void* data, size_t size, std::uint64_t seed) {
+      const unsigned char* bytes = static_cast<const unsigned char*>(data);
+      std::uint64_t h = 14695981039346656037ULL ^ seed;
+      for(size_t bI = 0; bI < size; bI++) {
+        h = (h ^ bytes[bI]) * 1099511628211ULL;
+      }
+      return hash_mix(h);
+    }
+
+    // Type seeds, so that (say) [] and {} differ.
+    enum HashSeed : std::uint64_t { HASH_NULL = 1, HASH_BOOL, HASH_UINT, HASH_INT, HASH_FLOAT,
+      HASH_STRING, HASH_BINARY, HASH_LIST, HASH_MAP };
+
+    // Integers: non-negative ones hash as unsigned, whatever their type.
+    inline std::uint64_t hash_uint(std::uint64_t num) {
+      return hash_bytes(&num, sizeof(num), HASH_UINT);
+    }
+
+    inline std::uint64_t hash_int(std::int64_t num) {
+      return 0 <= num ? hash_uint(static_cast<std::uint64_t>(num)) : hash_bytes(&num, sizeof(num), HASH_INT);
+    }
+
+  }
+
+  // A hash of val as == compares it: map keys in any order, and numbers by
+  // value, so 1, 1u and 1.0 hash alike (integers past 2^53 may not match
+  // the double they equal). Equal values have equal hashes, so a mismatch
+  // shows two values differ without comparing them.
+  inline std::uint64_t struct_hash(const json& val) {
+    using namespace Auxiliary;
+
+    switch(val.type()) {
+      case json::value_t::boolean: {
+        const bool b = val.get<bool>();
+        return hash_bytes(&b, sizeof(b), HASH_BOOL);
+      }
+      case json::value_t::number_integer:
+        return hash_int(val.get<std::int64_t>());
+      case json::value_t::number_unsigned:
+        return hash_uint(val.get<std::uint64_t>());
+      case json::value_t::number_float: {
+        const double num = val.get<double>();
+        if(std::floor(num) == num && -9223372036854775808.0 <= num && num < 18446744073709551616.0) {
+          return 0 <= num ? hash_uint(static_cast<std::uint64_t>(num)) : hash_int(static_cast<std::int64_t>(num));
+        }
+        return hash_bytes(&num, sizeof(num), HASH_FLOAT);
+      }
+      case json::value_t::string: {
+        const std::string& str = val.get_ref<const std::string&>();
+        return hash_bytes(str.data(), str.size(), HASH_STRING);
+      }
+      case json::value_t::binary: {
+        const json::binary_t& bin = val.get_binary();
+        return hash_bytes(bin.data(), bin.size(), HASH_BINARY);
+      }
+      case json::value_t::array: {
+        std::uint64_t h = HASH_LIST;
+        for(const json& child : val) {
+          h = hash_mix(h + struct_hash(child));
+        }
+        return hash_mix(h + val.size());
+      }
+      case json::value_t::object: {
+        // Entries are summed, so their order does not matter.
+        std::uint64_t sum = 0;
+        for(json::const_iterator it = val.begin(); it != val.end(); ++it) {
+          sum += hash_mix(hash_bytes(it.key().data(), it.key().size(), HASH_MAP) ^ struct_hash(it.value()));
+        }
+        return hash_mix(HASH_MAP ^ hash_mix(sum + val.size()));
+      }
+      default:
+        return hash_bytes(nullptr, 0, HASH_NULL);
+    }
+  }
+
+  // struct_hash as a hasher, for unordered containers keyed by values.
+  struct StructHash {
+    size_t operator()(const json& val) const {
+      return static_cast<size_t>(struct_hash(val));
+    }
+  };
+
+  // A value with its struct_hash, worked out when first needed and kept, so
+  // that comparing values with different hashes takes no walk of them.
+  class HashedJson {
+    public:
+      HashedJson() = default;
+
+      explicit HashedJson(json val) : val(std::move(val)) {}
+
+      const json& value() const {
+        return val;
+      }
+
+      // The value, to change: the hash is worked out again when next needed.
+      json& mutate() {
+        hashed = false;
+        return val;
+      }
+
+      std::uint64_t hash() const {
+        if(!hashed) {
+          cached = struct_hash(val);
+          hashed = true;
+        }
+        return cached;
+      }
+
+      bool operator==(const HashedJson& other) const {
+        return hash() == other.hash() && val == other.val;
+      }
+
+      bool operator!=(const HashedJson& other) const {
+        return !(*this == other);
+      }
+
+      // Merge over into the value, as merge([value, over]). Returns whether
+      // the value changed. Merging an equal value is skipped, and a changed
+      // result is told by its hash, without comparing it to the old value.
+      bool merge(const HashedJson& over, int maxdepth = MAXDEPTH) {
+        if(over == *this) {
+          return false;
+        }
+
+        json merged = VoxgigStruct::merge(json::array({ val, over.val }), maxdepth);
+        const std::uint64_t mergedhash = struct_hash(merged);
+        const bool changed = mergedhash != hash() || merged != val;
+
+        val = std::move(merged);
+        cached = mergedhash;
+        hashed = true;
+        return changed;
+      }
+
+    private:
+      json val;
+      mutable std::uint64_t cached = 0;
+      mutable bool hashed = false;
+  };
+
+  // Parallel walk and merge
+  // =======================
+
+  // A fixed set of worker threads that help run the tasks of TaskPool::run.
+  // The calling thread runs tasks too, so a task can itself call run without
+  // waiting on a busy pool.
+  class TaskPool {
+    public:
+      // threads counts the calling thread, so threads - 1 workers are started.
+      explicit TaskPool(unsigned threads = std::thread::hardware_concurrency()) {
+        for(unsigned tI = 1; tI < threads; tI++) {
+          workers.emplace_back([this]() { work(); });
+        }
+      }
+
+      ~TaskPool() {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          stopping = true;
+        }
+        ready.notify_all();
+        for(std::thread& worker : workers) {
+          worker.join();
+        }
+      }
+
+      TaskPool(const TaskPool&) = delete;
+      TaskPool& operator=(const TaskPool&) = delete;
+
+      size_t size() const {
+        return workers.size();
+      }
+
+      // Call task(i) for each i in [0, n), in any order and on any thread, and
+      // return when all have. The first exception thrown by a task is rethrown
+      // (other tasks still run).
+      void run(size_t n, const std::function<void(size_t)>& task) {
+        if(n < 2 || workers.empty()) {
+          for(size_t i = 0; i < n; i++) {
+            task(i);
+          }
+          return;
+        }
+
+        std::shared_ptr<Job> job = std::make_shared<Job>(n, task);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          for(size_t hI = 1; hI < n && hI <= workers.size(); hI++) {
+            jobs.push_back(job);
+          }
+        }
+        ready.notify_all();
+
+        job->help();
+
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->finished.wait(lock, [&job]() { return job->done == job->n; });
+
+        if(job->error) {
+          std::rethrow_exception(job->error);
+        }
+      }
+
+      // Queue task for a worker, and return at once. A task submitted from a
+      // worker of the pool, or to a pool without workers, is run by the caller,
+      // so a worker never waits on tasks queued behind it. Exceptions thrown by
+      // the task are not caught: capture them (as std::packaged_task does).
+      void submit(std::function<void()> task) {
+        if(workers.empty() || this == current()) {
+          task();
+          return;
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          tasks.push_back(std::move(task));
+        }
+        ready.notify_one();
+      }
+
+    private:
+      struct Job {
+        Job(size_t n, const std::function<void(size_t)>& task) : n{n}, task{task} {}
+
+        // Run unclaimed tasks until there are none.
+        void help() {
+          for(size_t i = next++; i < n; i = next++) {
+            try {
+              task(i);
+            } catch(...) {
+              std::lock_guard<std::mutex> lock(mutex);
+              if(!error) {
+                error = std::current_exception();
+              }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if(++done == n) {
+              finished.notify_all();
+            }
+          }
+        }
+
+        const size_t n;
+        const std::function<void(size_t)>& task;
+        std::atomic<size_t> next{0};
+        size_t done = 0;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable finished;
+      };
+
+      // The pool the calling thread works for, if any.
+      static TaskPool*& current() {
+        static thread_local TaskPool* pool = nullptr;
+        return pool;
+      }
+
+      // Jobs of run come before submitted tasks, which may wait longer. Queued
+      // tasks are all run before the workers stop.
+      void work() {
+        current() = this;
+        while(true) {
+          std::shared_ptr<Job> job;
+          std::function<void()> task;
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [this]() { return stopping || !jobs.empty() || !tasks.empty(); });
+            if(!jobs.empty()) {
+              job = std::move(jobs.front());
+              jobs.pop_front();
+            } else if(!tasks.empty()) {
+              task = std::move(tasks.front());
+              tasks.pop_front();
+            } else {
+              return;
+            }
+          }
+          if(job) {
+            job->help();
+          } else {
+            task();
+          }
+        }
+      }
+
+      std::vector<std::thread> workers;
+      std::deque<std::shared_ptr<Job>> jobs;
+      std::deque<std::function<void()>> tasks;
+      std::mutex mutex;
+      std::condition_variable ready;
+      bool stopping = false;
+  };
+
+  namespace Auxiliary {
+
+    // The pool of walk_parallel and merge_parallel, when none is given.
+    inline TaskPool& default_pool() {
+      static TaskPool pool;
+      return pool;
+    }
+
+  }
+
+  // Options of walk_parallel and merge_parallel.
+  struct Parallel {
+    TaskPool* pool = nullptr;  // Default: a shared pool of a thread per core.
+    size_t threshold = 64;     // Fan out over nodes with at least this many children.
+  };
+
+  namespace Auxiliary {
+
+    template<class B, class A>
+    void walk_parallel_node(json& val, B& before, A& after, int maxdepth, const std::string& key,
+        const json& parent, WalkPath& path, TaskPool& pool, size_t threshold) {
+      walk_call(before, key, val, parent, path);
+
+      if(0 == maxdepth || (0 < maxdepth && maxdepth <= static_cast<int>(path.size()))) {
+        return;
+      }
+
+      if(isnode(val) && (path.empty() || threshold <= val.size())) {
+        // Each child is walked as a task of its own, with its own copy of the path.
+        const bool map = ismap(val);
+        std::vector<std::pair<const std::string*, json*>> children;
+        std::vector<std::string> indexes;
+        children.reserve(val.size());
+        if(map) {
+          for(json::iterator it = val.begin(); it != val.end(); ++it) {
+            children.emplace_back(&it.key(), &it.value());
+          }
+        } else {
+          indexes.reserve(val.size());
+          for(size_t i = 0; i < val.size(); i++) {
+            indexes.push_back(std::to_string(i));
+            children.emplace_back(&indexes.back(), &val[i]);
+          }
+        }
+
+        pool.run(children.size(), [&](size_t cI) {
+          WalkPath childpath(path);
+          childpath.push_back(*children[cI].first);
+          walk_parallel_node(*children[cI].second, before, after, maxdepth, childpath.back(),
+              val, childpath, pool, threshold);
+        });
+
+        // NOTE: A child left null is removed, as with setprop.
+        if(map) {
+          for(json::iterator it = val.begin(); it != val.end();) {
+            it = it->is_null() ? val.erase(it) : std::next(it);
+          }
+        } else {
+          json::array_t& list = *val.get_ptr<json::array_t*>();
+          list.erase(std::remove_if(list.begin(), list.end(),
+                [](const json& item) { return item.is_null(); }), list.end());
+        }
+      } else if(ismap(val)) {
+        // As walk_node, so that larger nodes further down can still fan out.
+        for(json::iterator it = val.begin(); it != val.end();) {
+          path.push_back(it.key());
+          walk_parallel_node(it.value(), before, after, maxdepth, path.back(), val, path, pool, threshold);
+          path.pop_back();
+          it = it->is_null() ? val.erase(it) : std::next(it);
+        }
+      } else if(islist(val)) {
+        for(size_t i = 0, cI = 0, size = val.size(); i < size; i++) {
+          path.push_back(std::to_string(i));
+          walk_parallel_node(val[cI], before, after, maxdepth, path.back(), val, path, pool, threshold);
+          path.pop_back();
+
+          if(val[cI].is_null()) {
+            delprop(val, static_cast<int>(cI));
+          } else {
+            cI++;
+          }
+        }
+      }
+
+      walk_call(after, key, val, parent, path);
+    }
+
+  }
+
+  // As walk, running the callbacks on the threads of a pool. The children of
+  // the root, and of any node with at least options.threshold children, are
+  // walked in parallel; each subtree is walked in the same order as by walk,
+  // and after is applied to a node once all of its children are walked.
+  // The callbacks must be safe to call concurrently, and should only read or
+  // change val: siblings (and so parent) may be changing at the same time.
+  // Null children are removed once all their siblings are walked.
+  template<class B, class A>
+  inline json& walk_parallel(json& val, B&& before, A&& after, int maxdepth = MAXDEPTH,
+      const Parallel& options = Parallel()) {
+    WalkPath path;
+    Auxiliary::walk_parallel_node(val, before, after, 0 <= maxdepth ? maxdepth : MAXDEPTH,
+        S::empty, NONE, path, nullptr == options.pool ? Auxiliary::default_pool() : *options.pool,
+        options.threshold);
+    return val;
+  }
+
+  // As merge. When every value is a map (or the first is absent), and one has
+  // at least options.threshold keys, the values of each top level key are
+  // merged in parallel, each key as a task, and the result (the same as
+  // merge) is assembled in key order. Maps with disjoint keys gain the most.
+  inline json merge_parallel(json&& val, int maxdepth = MAXDEPTH, const Parallel& options = Parallel()) {
+    if(!islist(val) || val.size() < 2 || maxdepth < 2) {
+      return merge(std::move(val), maxdepth);
+    }
+
+    // Small maps merge faster in sequence.
+    json::array_t& list = *val.get_ptr<json::array_t*>();
+    size_t largest = 0;
+    for(size_t oI = 0; oI < list.size(); oI++) {
+      if(!ismap(list[oI]) && !(0 == oI && list[oI].is_null())) {
+        return merge(std::move(val), maxdepth);
+      }
+      largest = std::max(largest, list[oI].size());
+    }
+    if(largest < options.threshold) {
+      return merge(std::move(val), maxdepth);
+    }
+
+    // The values of each key, in order.
+    std::map<std::string, json> values;
+    for(json& obj : list) {
+      for(json::iterator it = obj.begin(); it != obj.end(); ++it) {
+        json& slot = values[it.key()];
+        if(slot.is_null()) {
+          slot = json::array();
+        }
+        slot.push_back(std::move(*it));
+      }
+    }
+
+    std::vector<std::map<std::string, json>::iterator> keys;
+    keys.reserve(values.size());
+    for(std::map<std::string, json>::iterator it = values.begin(); it != values.end(); ++it) {
+      keys.push_back(it);
+    }
+
+    // A key's values merge as merge_node merges them, one level down.
+    TaskPool& pool = nullptr == options.pool ? Auxiliary::default_pool() : *options.pool;
+    pool.run(keys.size(), [&keys, maxdepth](size_t kI) {
+      json& vals = keys[kI]->second;
+      vals = 1 == vals.size() ? std::move(vals[0]) : merge(std::move(vals), maxdepth - 1);
+    });
+
+    json out = json::object();
+    for(std::pair<const std::string, json>& entry : values) {
+      out.emplace(entry.first, std::move(entry.second));
+    }
+
+    return out;
+  }
+
+
+  // A path into a node tree, parsed once. String paths split on ".";
+  // list paths are taken element by element. Each part keeps its unescaped
+  // key and, when the key is a list index, the resolved integer, so lookups
+  // do no parsing.
+  class Path {
+    public:
+      enum Kind {
+        KEY,     // Plain property name or index.
+        ASCEND,  // Empty part: the current data parent, or up one level.
+        DKEY,    // $KEY: the injection key.
+        GET,     // $GET:path$ - property named by a store value.
+        REF,     // $REF:path$ - property named by a spec value.
+        META     // $META:path$ - property named by a meta value.
+      };
+
+      struct Part {
+        Kind kind;
+        std::string key;    // Unescaped key. Used as-is when there is no injection.
+        std::string inner;  // Inner path for GET/REF/META.
+        int index;          // List index, or -1 if key is not one.
+        bool number;        // Given as a number in a list path (setpath creates a list).
+      };
+
+      std::vector<Part> parts;
+
+      // False if the source was not a string, number or list.
+      bool valid = false;
+
+      // Meta prefix (name$~rest) of a string path, and the first part without it.
+      std::string meta;
+      Part metapart = Part();
+
+      Path() = default;
+
+      explicit Path(const std::string& path) : valid{true} {
+        size_t start = 0;
+        for(size_t dot = path.find('.'); dot != std::string::npos; dot = path.find('.', start)) {
+          parts.push_back(part(path.substr(start, dot - start), false));
+          start = dot + 1;
+        }
+        parts.push_back(part(path.substr(start), false));
+
+        // name$~rest or name$=rest
+        const std::string& first = parts[0].key;
+        const size_t ds = first.find('$');
+        if(KEY == parts[0].kind && 0 < ds && ds != std::string::npos && ds + 2 < first.size() &&
+            ('~' == first[ds + 1] || '=' == first[ds + 1])) {
+          meta = first.substr(0, ds);
+          metapart = part(first.substr(ds + 2), false);
+        }
+      }
+
+      explicit Path(const json& path) {
+        if(path.is_string()) {
+          *this = Path(path.get_ref<const std::string&>());
+        } else if(path.is_number()) {
+          valid = true;
+          parts.push_back(part(strkey(path), false));
+        } else if(path.is_array()) {
+          valid = true;
+          parts.reserve(path.size());
+          for(const json& p : path) {
+            parts.push_back(part(strkey(p), p.is_number()));
+          }
+        }
+      }
+
+      size_t size() const {
+        return parts.size();
+      }
+
+    private:
+      static Part part(const std::string& raw, bool number) {
+        Kind kind = KEY;
+        std::string inner;
+
+        if(raw.empty()) {
+          kind = ASCEND;
+        } else if(S::DKEY == raw) {
+          kind = DKEY;
+        } else if(prefixed(raw, "$GET:")) {
+          kind = GET;
+          inner = raw.substr(5, raw.size() - 6);
+        } else if(prefixed(raw, "$REF:")) {
+          kind = REF;
+          inner = raw.substr(5, raw.size() - 6);
+        } else if(prefixed(raw, "$META:")) {
+          kind = META;
+          inner = raw.substr(6, raw.size() - 7);
+        }
+
+        std::string key = unescape(raw);
+
+        int index = -1;
+        if(!::Auxiliary::parse_index(key, index)) {
+          index = -1;
+        }
+
+        return Part{ kind, std::move(key), std::move(inner), index, number };
+      }
+
+      // $PREFIX:...$
+      static bool prefixed(const std::string& raw, const std::string& prefix) {
+        return prefix.size() < raw.size() && 0 == raw.compare(0, prefix.size(), prefix) && '$' == raw.back();
+      }
+
+      // $$ escapes $
+      static std::string unescape(std::string key) {
+        size_t at = key.find("$$");
+        while(at != std::string::npos) {
+          key.erase(at, 1);
+          at = key.find("$$", at + 1);
+        }
+        return key;
+      }
+  };
+
+  namespace Auxiliary {
+
+    // getprop, with the key already resolved.
+    inline const json& getpart(const json& val, const std::string& key, int index) {
+      if(val.is_object()) {
+        json::const_iterator it = val.find(key);
+        return it == val.end() || it->is_null() ? NONE : *it;
+      } else if(val.is_array()) {
+        return 0 <= index && index < static_cast<int>(val.size()) && !val[index].is_null() ? val[index] : NONE;
+      }
+      return NONE;
+    }
+
+    inline const json& getpart(const json& val, const std::string& key) {
+      int index;
+      return getpart(val, key, ::Auxiliary::parse_index(key, index) ? index : -1);
+    }
+
+    // The injection state a path is resolved against. Both the injdef map
+    // form of getpath and inject map onto this, so neither copies.
+    struct PathScope {
+      bool inj = false;                  // Relative and special parts apply.
+      const std::string* base = nullptr; // Store key of the data root.
+      const std::string* key = &S::empty;
+      const json* meta = &NONE;
+      const json* dparent = &NONE;
+      const json* dpath = &NONE;         // A list of keys.
+      const json* top = nullptr;         // Data at $TOP, when store does not hold it.
+    };
+
+    // The data root of store for base: top stands in for a $TOP key store lacks.
+    inline const json& store_base(const json& store, const std::string& base, const json* top) {
+      return nullptr != top && S::DTOP == base ? *top : getprop(store, base, store);
+    }
+
+    inline const json& getpath_in(const json& store, const Path& path, const PathScope& scope) {
+      if(!path.valid) {
+        return NONE;
+      }
+
+      const bool inj = scope.inj;
+      const json& src = nullptr == scope.base ? store : store_base(store, *scope.base, scope.top);
+      const size_t numparts = path.size();
+      const json& dparent = *scope.dparent;
+
+      // An empty path (incl empty string) just finds the store.
+      if(store.is_null() || (1 == numparts && Path::ASCEND == path.parts[0].kind)) {
+        return src;
+      }
+
+      const json* val = &src;
+
+      const json& meta = *scope.meta;
+      const bool usemeta = !path.meta.empty() && !meta.is_null();
+      if(usemeta) {
+        val = &getprop(meta, path.meta);
+      }
+
+      const json& dpath = *scope.dpath;
+
+      for(size_t pI = 0; !val->is_null() && pI < numparts; pI++) {
+        const Path::Part& part = 0 == pI && usemeta ? path.metapart : path.parts[pI];
+
+        if(Path::ASCEND == part.kind) {
+          size_t ascends = 0;
+          while(pI + 1 < numparts && Path::ASCEND == path.parts[pI + 1].kind) {
+            ascends++;
+            pI++;
+          }
+
+          if(inj && 0 < ascends) {
+            if(pI == numparts - 1) {
+              ascends--;
+            }
+
+            if(0 == ascends) {
+              val = &dparent;
+            } else {
+              const size_t dsize = dpath.is_array() ? dpath.size() : 0;
+              if(ascends > dsize) {
+                return NONE;
+              }
+
+              json fullpath = json::array();
+              for(size_t dI = 0; dI < dsize - ascends; dI++) {
+                fullpath.push_back(dpath[dI]);
+              }
+              for(size_t rI = pI + 1; rI < numparts; rI++) {
+                fullpath.push_back(path.parts[rI].key);
+              }
+
+              PathScope fullscope;
+              fullscope.top = scope.top;
+              return getpath_in(store, Path(fullpath), fullscope);
+            }
+          } else {
+            val = &dparent;
+          }
+        } else if(inj && Path::KEY != part.kind) {
+          std::string key;
+          if(Path::DKEY == part.kind) {
+            key = *scope.key;
+          } else {
+            const json& from =
+              Path::GET == part.kind ? src :
+              Path::REF == part.kind ? getprop(store, S::DSPEC) :
+              meta;
+            key = stringify(getpath_in(from, Path(part.inner), PathScope()));
+          }
+          val = &getpart(*val, key);
+        } else if(0 == pI && nullptr != scope.top && &store == val && S::DTOP == part.key) {
+          val = scope.top;
+        } else {
+          val = &getpart(*val, part.key, part.index);
+        }
+      }
+
+      return *val;
+    }
+
+  }
+
+  // Get the value at a path. Returns a reference into store (or injdef), or NONE.
+  // injdef is an optional map with: base, key, meta, dparent, dpath (a list).
+  // Relative paths (leading ".") and $KEY, $GET, $REF and $META parts need injdef.
+  inline const json& getpath(const json& store, const Path& path, const json& injdef = NONE) {
+    VOXGIG_STAT(GETPATH);
+
+    if(injdef.is_null()) {
+      return Auxiliary::getpath_in(store, path, Auxiliary::PathScope());
+    }
+
+    // NOTE: The field names are built once, so lookups do not allocate.
+    static const json BASE = "base", KEY = "key", META = "meta", DPARENT = "dparent", DPATH = "dpath";
+
+    Auxiliary::PathScope scope;
+    scope.inj = true;
+
+    const json& base = getprop(injdef, BASE);
+    if(base.is_string()) {
+      scope.base = &base.get_ref<const std::string&>();
+    }
+
+    const json& keyval = getprop(injdef, KEY);
+    const std::string key = keyval.is_string() ? std::string() : strkey(keyval);
+    scope.key = keyval.is_string() ? &keyval.get_ref<const std::string&>() : &key;
+    scope.meta = &getprop(injdef, META);
+    scope.dparent = &getprop(injdef, DPARENT);
+    scope.dpath = &getprop(injdef, DPATH);
+
+    return Auxiliary::getpath_in(store, path, scope);
+  }
+
+  inline const json& getpath(const json& store, const json& path, const json& injdef = NONE) {
+    // NOTE: The result never refers into the temporary Path.
+    return getpath(store, Path(path), injdef);
+  }
+
+  inline json getpath(args_container&& args) {
+    return getpath(
+        args.size() == 0 ? NONE : args[0],
+        args.size() < 2 ? NONE : args[1],
+        args.size() < 3 ? NONE : args[2]);
+  }
+
+  // Set a value at a path, creating missing parts: maps, or a list where the
+  // next part was given as a number. A null value deletes.
+  // Returns the parent of the final part, or nullptr if the path is not valid.
+  inline json* setpath(json& store, const Path& path, json&& val, const json& injdef = NONE) {
+    VOXGIG_STAT(SETPATH);
+
+    if(!path.valid) {
+      return nullptr;
+    }
+
+    const json& base = getprop(injdef, "base");
+    json* parent = &store;
+    if(base.is_string() && !getprop(store, base).is_null()) {
+      parent = &store[base.get<std::string>()];
+    }
+
+    const size_t numparts = path.size();
+
+    for(size_t pI = 0; pI + 1 < numparts; pI++) {
+      const Path::Part& part = path.parts[pI];
+      const json& next = Auxiliary::getpart(*parent, part.key, part.index);
+
+      if(!isnode(next)) {
+        setprop(*parent, part.key, path.parts[pI + 1].number ? json::array() : json::object());
+      }
+
+      parent = const_cast<json*>(&Auxiliary::getpart(*parent, part.key, part.index));
+
+      // The part could not be set (e.g. a non-index key on a list).
+      if(parent == &NONE) {
+        return nullptr;
+      }
+    }
+
+    const Path::Part& last = path.parts[numparts - 1];
+    if(val.is_null()) {
+      delprop(*parent, last.key);
+    } else {
+      setprop(*parent, last.key, std::move(val));
+    }
+
+    return parent;
+  }
+
+  inline json* setpath(json& store, const json& path, json&& val, const json& injdef = NONE) {
+    return setpath(store, Path(path), std::move(val), injdef);
+  }
+
+  inline json setpath(args_container&& args) {
+    json store = args.size() == 0 ? nullptr : std::move(args[0]);
+    json path = args.size() < 2 ? nullptr : std::move(args[1]);
+    json val = args.size() < 3 ? nullptr : std::move(args[2]);
+
+    json* parent = setpath(store, path, std::move(val), args.size() < 4 ? NONE : args[3]);
+
+    return nullptr == parent ? NONE : *parent;
+  }
+
+  // Shared documents
+  // ================
+
+  namespace Auxiliary {
+
+    struct SharedNode;
+    using SharedPtr = std::shared_ptr<SharedNode>;
+
+    // A node of a SharedJson: a scalar, or a map or list of shared children.
+    // Absent values (and JSON null) are nullptr, never a node.
+    struct SharedNode {
+      int kind = T_scalar;  // T_scalar, T_map or T_list.
+      json scalar;
+      std::map<std::string, SharedPtr> props;
+      std::vector<SharedPtr> items;
+    };
+
+    inline SharedPtr share(const json& val) {
+      if(val.is_null()) {
+        return nullptr;
+      }
+
+      SharedPtr node = std::make_shared<SharedNode>();
+      if(val.is_object()) {
+        node->kind = T_map;
+        for(json::const_iterator it = val.begin(); it != val.end(); ++it) {
+          SharedPtr child = share(*it);
+          if(nullptr != child) {
+            node->props.emplace_hint(node->props.end(), it.key(), std::move(child));
+          }
+        }
+      } else if(val.is_array()) {
+        node->kind = T_list;
+        node->items.reserve(val.size());
+        for(const json& item : val) {
+          node->items.push_back(share(item));
+        }
+      } else {
+        node->scalar = val;
+      }
+
+      return node;
+    }
+
+    // The node at ptr, copied first if it is shared. Only the node itself is
+    // copied: its children are shared with the original.
+    inline SharedNode& own(SharedPtr& ptr) {
+      if(1 != ptr.use_count()) {
+        ptr = std::make_shared<SharedNode>(*ptr);
+      }
+      return *ptr;
+    }
+
+    // The child slot of a node for key, or nullptr if there is none.
+    inline const SharedPtr* slot(const SharedPtr& node, const std::string& key, int index) {
+      if(nullptr == node) {
+        return nullptr;
+      } else if(T_map == node->kind) {
+        std::map<std::string, SharedPtr>::const_iterator it = node->props.find(key);
+        return it == node->props.end() ? nullptr : &it->second;
+      } else if(T_list == node->kind && 0 <= index && index < static_cast<int>(node->items.size())) {
+        return &node->items[index];
+      }
+      return nullptr;
+    }
+
+    // setprop on a node, with the key already resolved (index is only used, and
+    // must be valid, for a list). The node is owned by the caller.
+    inline void setpart(SharedNode& node, const std::string& key, int index, SharedPtr&& val) {
+      if(T_map == node.kind) {
+        if(nullptr == val) {
+          node.props.erase(key);
+        } else {
+          node.props[key] = std::move(val);
+        }
+      } else if(T_list == node.kind) {
+        std::vector<SharedPtr>& items = node.items;
+        if(nullptr == val) {
+          if(0 <= index && index < static_cast<int>(items.size())) {
+            items.erase(items.begin() + index);
+          }
+        } else if(0 <= index) {
+          if(index < static_cast<int>(items.size())) {
+            items[index] = std::move(val);
+          } else {
+            items.push_back(std::move(val));
+          }
+        } else {
+          items.insert(items.begin(), std::move(val));
+        }
+      }
+    }
+
+    inline void merge_shared(SharedPtr& dst, const SharedPtr& over, int maxdepth, int depth);
+
+    // Merge child into the slot tval, or replace it, sharing child.
+    // A node merged into itself is unchanged, so shared subtrees are skipped.
+    inline void merge_child(SharedPtr& tval, const SharedPtr& child, int maxdepth, int depth) {
+      if(tval == child) {
+        return;
+      } else if(maxdepth <= depth || nullptr == child || nullptr == tval ||
+          T_scalar == child->kind || tval->kind != child->kind) {
+        tval = child;
+      } else {
+        merge_shared(tval, child, maxdepth, depth + 1);
+      }
+    }
+
+    // merge_node for shared nodes: children of over that replace (rather
+    // than merge into) a child of dst are shared, not copied.
+    inline void merge_shared(SharedPtr& dst, const SharedPtr& over, int maxdepth, int depth) {
+      SharedNode& node = own(dst);
+
+      if(T_map == over->kind) {
+        for(const std::pair<const std::string, SharedPtr>& prop : over->props) {
+          std::map<std::string, SharedPtr>::iterator found = node.props.find(prop.first);
+          if(found == node.props.end()) {
+            node.props.emplace(prop.first, prop.second);
+          } else {
+            merge_child(found->second, prop.second, maxdepth, depth);
+          }
+        }
+      } else {
+        for(size_t i = 0; i < over->items.size(); i++) {
+          if(i < node.items.size()) {
+            merge_child(node.items[i], over->items[i], maxdepth, depth);
+          } else {
+            node.items.push_back(over->items[i]);
+          }
+        }
+      }
+    }
+
+    inline json unshare(const SharedPtr& node) {
+      if(nullptr == node) {
+        return NONE;
+      } else if(T_map == node->kind) {
+        json out = json::object();
+        for(const std::pair<const std::string, SharedPtr>& prop : node->props) {
+          out.emplace(prop.first, unshare(prop.second));
+        }
+        return out;
+      } else if(T_list == node->kind) {
+        json out = json::array();
+        for(const SharedPtr& item : node->items) {
+          out.push_back(unshare(item));
+        }
+        return out;
+      }
+      return node->scalar;
+    }
+
+  }
+
+  // A JSON value whose nodes are reference counted and shared between copies,
+  // so a copy (or clone) is O(1), whatever the size of the value. Changes
+  // (setprop, delprop, setpath and merge) copy a node only if it is shared,
+  // and then only the spine from the root to the change: untouched subtrees
+  // stay shared with the other copies, which never see the change.
+  // As with json, a value and its copies must not be changed in one thread
+  // while in use in another.
+  class SharedJson {
+    public:
+      SharedJson() = default;
+
+      explicit SharedJson(const json& val) : node{Auxiliary::share(val)} {}
+
+      bool is_null() const {
+        return nullptr == node;
+      }
+
+      bool isnode() const {
+        return nullptr != node && T_scalar != node->kind;
+      }
+
+      bool ismap() const {
+        return nullptr != node && T_map == node->kind;
+      }
+
+      bool islist() const {
+        return nullptr != node && T_list == node->kind;
+      }
+
+      // Number of children of a node, and 0 for a scalar.
+      size_t size() const {
+        return ismap() ? node->props.size() : islist() ? node->items.size() : 0;
+      }
+
+      // The value of a scalar, or NONE for a node.
+      const json& scalar() const {
+        return nullptr == node || T_scalar != node->kind ? NONE : node->scalar;
+      }
+
+      // Keys as with keysof.
+      json keysof() const {
+        json keys = json::array();
+        if(ismap()) {
+          for(const std::pair<const std::string, Auxiliary::SharedPtr>& prop : node->props) {
+            keys.push_back(prop.first);
+          }
+        } else if(islist()) {
+          for(size_t i = 0; i < node->items.size(); i++) {
+            keys.push_back(std::to_string(i));
+          }
+        }
+        return keys;
+      }
+
+      // As with getprop. The result shares the child.
+      SharedJson getprop(const json& key, const SharedJson& alt = SharedJson()) const {
+        std::string skey;
+        int index = -1;
+        if(!resolve(key, skey, index)) {
+          return alt;
+        }
+        const Auxiliary::SharedPtr* child = Auxiliary::slot(node, skey, index);
+        return nullptr == child || nullptr == *child ? alt : SharedJson(*child);
+      }
+
+      // Property lookup along a path (plain keys only, as getpath without injdef).
+      SharedJson getpath(const Path& path) const {
+        if(!path.valid) {
+          return SharedJson();
+        }
+        Auxiliary::SharedPtr at = node;
+        for(const Path::Part& part : path.parts) {
+          const Auxiliary::SharedPtr* child = Auxiliary::slot(at, part.key, part.index);
+          if(nullptr == child) {
+            return SharedJson();
+          }
+          at = *child;
+        }
+        return SharedJson(at);
+      }
+
+      SharedJson getpath(const json& path) const {
+        return getpath(Path(path));
+      }
+
+      // As with setprop: a null value deletes, a list key past the end appends,
+      // and a negative list key prepends. val is shared, not copied.
+      SharedJson& setprop(const json& key, const SharedJson& val) {
+        std::string skey;
+        int index = -1;
+        if(isnode() && resolve(key, skey, index)) {
+          Auxiliary::setpart(Auxiliary::own(node), skey, index, Auxiliary::SharedPtr(val.node));
+        }
+        return *this;
+      }
+
+      SharedJson& setprop(const json& key, const json& val) {
+        return setprop(key, SharedJson(val));
+      }
+
+      SharedJson& delprop(const json& key) {
+        return setprop(key, SharedJson());
+      }
+
+      // As with setpath (without injdef): missing parts are created as maps,
+      // or lists where the next part was given as a number. Only the nodes
+      // along the path are copied. Returns false if the path could not be set.
+      bool setpath(const Path& path, const SharedJson& val) {
+        if(!path.valid || !isnode()) {
+          return false;
+        }
+
+        // Own each node down the path, so the final change is not seen by copies.
+        Auxiliary::SharedPtr* at = &node;
+        const size_t numparts = path.size();
+        for(size_t pI = 0; pI + 1 < numparts; pI++) {
+          const Path::Part& part = path.parts[pI];
+          if(T_list == (*at)->kind && part.index < 0) {
+            return false;
+          }
+
+          Auxiliary::SharedNode& parent = Auxiliary::own(*at);
+          const Auxiliary::SharedPtr* child = Auxiliary::slot(*at, part.key, part.index);
+
+          if(nullptr == child || nullptr == *child || T_scalar == (*child)->kind) {
+            Auxiliary::SharedPtr created = std::make_shared<Auxiliary::SharedNode>();
+            created->kind = path.parts[pI + 1].number ? T_list : T_map;
+            Auxiliary::setpart(parent, part.key, part.index, std::move(created));
+            child = Auxiliary::slot(*at, part.key, part.index);
+
+            // The part could not be set (an index past the end appends, as for json).
+            if(nullptr == child) {
+              return false;
+            }
+          }
+
+          at = const_cast<Auxiliary::SharedPtr*>(child);
+        }
+
+        const Path::Part& last = path.parts[numparts - 1];
+        if(T_list == (*at)->kind && last.index < 0) {
+          return false;
+        }
+
+        Auxiliary::setpart(Auxiliary::own(*at), last.key, last.index, Auxiliary::SharedPtr(val.node));
+        return true;
+      }
+
+      bool setpath(const json& path, const SharedJson& val) {
+        return setpath(Path(path), val);
+      }
+
+      // A (deep) json copy of the value.
+      json to_json() const {
+        return Auxiliary::unshare(node);
+      }
+
+      // The two values are the same node, so are equal without comparing children.
+      bool shares(const SharedJson& other) const {
+        return node == other.node;
+      }
+
+      friend SharedJson merge(const std::vector<SharedJson>& vals, int maxdepth);
+
+    private:
+      explicit SharedJson(const Auxiliary::SharedPtr& node) : node{node} {}
+
+      // Resolve key for this node, as getprop does.
+      bool resolve(const json& key, std::string& skey, int& index) const {
+        if(ismap()) {
+          if(!key.is_string() && !key.is_number()) {
+            return false;
+          }
+          skey = key.is_string() ? key.get<std::string>() : key.dump();
+          return true;
+        } else if(islist()) {
+          return ::Auxiliary::list_index(key, index);
+        }
+        return false;
+      }
+
+      Auxiliary::SharedPtr node;
+  };
+
+  // O(1): the copy shares every node with val.
+  inline SharedJson clone(const SharedJson& val) {
+    return val;
+  }
+
+  // As with merge. Nothing is copied except the nodes that both a
+  // value and a later one change: the result shares the rest with vals.
+  inline SharedJson merge(const std::vector<SharedJson>& vals, int maxdepth = MAXDEPTH) {
+    if(vals.empty()) {
+      return SharedJson();
+    } else if(1 == vals.size()) {
+      return vals[0];
+    }
+
+    const int md = maxdepth < 0 ? 0 : maxdepth;
+
+    if(0 == md) {
+      const SharedJson& last = vals.back();
+      return last.islist() ? SharedJson(json::array()) : last.ismap() ? SharedJson(json::object()) : last;
+    }
+
+    SharedJson out = vals[0].is_null() ? SharedJson(json::object()) : vals[0];
+
+    for(size_t oI = 1; oI < vals.size(); oI++) {
+      const SharedJson& obj = vals[oI];
+
+      if(obj.isnode() && out.isnode() && obj.node->kind == out.node->kind) {
+        Auxiliary::merge_shared(out.node, obj.node, md, 1);
+      } else {
+        out = obj;
+      }
+    }
+
+    return out;
+  }
+
+  // Frozen documents
+  // ================
+
+  // An immutable JSON value. It is never changed once built, and json's const
+  // functions do not change a value, so any number of threads may read one
+  // concurrently without locks. getprop and getpath return references into
+  // the value (or to alt, or NONE) rather than copies; they stay valid for as
+  // long as any copy of the FrozenJson does. Copies share the value.
+  class FrozenJson {
+    public:
+      FrozenJson() : doc{std::make_shared<const json>()} {}
+
+      explicit FrozenJson(json val) : doc{std::make_shared<const json>(std::move(val))} {}
+
+      const json& value() const {
+        return *doc;
+      }
+
+      const json& getprop(const json& key, const json& alt = NONE) const {
+        return VoxgigStruct::getprop(*doc, key, alt);
+      }
+
+      const json& getprop(const Key& key, const json& alt = NONE) const {
+        return VoxgigStruct::getprop(*doc, key, alt);
+      }
+
+      const json& getpath(const Path& path) const {
+        return VoxgigStruct::getpath(*doc, path);
+      }
+
+      const json& getpath(const json& path) const {
+        return VoxgigStruct::getpath(*doc, Path(path));
+      }
+
+      ItemsView items() const {
+        return items_view(*doc);
+      }
+
+      KeysView keys() const {
+        return keys_view(*doc);
+      }
+
+      // A new document: this one with over merged in, as merge([value, over]).
+      FrozenJson merge(const json& over, int maxdepth = MAXDEPTH) const {
+        return FrozenJson(VoxgigStruct::merge(json::array({ *doc, over }), maxdepth));
+      }
+
+      // Are both the same value (not a comparison of the values)?
+      bool shares(const FrozenJson& other) const {
+        return doc == other.doc;
+      }
+
+    private:
+      std::shared_ptr<const json> doc;
+  };
+
+  // The current version of a frozen document, replaced atomically (read,
+  // copy, update): a snapshot is one version, unchanged for as long as it is
+  // held, while update publishes the next. Readers never wait for a writer
+  // to build a version; writers run one at a time. Snapshots are taken and
+  // published with the atomic shared_ptr functions, which may use a short
+  // internal lock for the pointer copy (C++11 has no atomic<shared_ptr>).
+  class FrozenSlot {
+    public:
+      explicit FrozenSlot(FrozenJson initial = FrozenJson(json::object())) :
+        current{std::make_shared<const FrozenJson>(std::move(initial))} {}
+
+      FrozenSlot(const FrozenSlot&) = delete;
+      FrozenSlot& operator=(const FrozenSlot&) = delete;
+
+      FrozenJson snapshot() const {
+        return *std::atomic_load(&current);
+      }
+
+      // Publish next as the current version.
+      void publish(FrozenJson next) {
+        std::lock_guard<std::mutex> lock(writer);
+        store(std::move(next));
+      }
+
+      // Publish the current version with over merged in, and return it.
+      FrozenJson update(const json& over, int maxdepth = MAXDEPTH) {
+        std::lock_guard<std::mutex> lock(writer);
+        FrozenJson next = snapshot().merge(over, maxdepth);
+        store(next);
+        return next;
+      }
+
+      // The number of versions published since the first.
+      unsigned long long version() const {
+        return versions.load(std::memory_order_acquire);
+      }
+
+    private:
+      std::shared_ptr<const FrozenJson> current;
+      std::mutex writer;
+      std::atomic<unsigned long long> versions{0};
+
+      void store(FrozenJson next) {
+        std::atomic_store(&current, std::shared_ptr<const FrozenJson>(
+              std::make_shared<const FrozenJson>(std::move(next))));
+        versions.fetch_add(1, std::memory_order_release);
+      }
+  };
+
+  // Injection
+  // =========
+
+  // Injection modes. Each child key is injected before (M_KEYPRE) and
+  // after (M_KEYPOST) its value (M_VAL).
+  const int M_KEYPRE = 1;
+  const int M_KEYPOST = 2;
+  const int M_VAL = 4;
+
+  // Returned by a handler to leave the current value untouched.
+  const json SKIP = { { "`$SKIP`", true } };
+
+  struct Injection;
+
+  // A command ($NAME), called as f(inj, val, ref, store). The result replaces the reference.
+  using Injector = std::function<json(Injection&, const json&, const std::string&, const json&)>;
+
+  // Resolves each reference, called as f(inj, val, cmd, ref, store): val is the
+  // value found at ref, or cmd the command ref names (otherwise nullptr).
+  using InjectHandler = std::function<json(Injection&, const json&, const Injector*, const std::string&, const json&)>;
+
+  // Called once a value is injected, as f(val, key, parent, inj, store).
+  using Modify = std::function<void(const json&, const std::string&, json&, Injection&, const json&)>;
+
+  using Injectors = hash_table<std::string, Injector>;
+
+  namespace Auxiliary {
+
+    // A backtick reference, with the $BT and $DS escapes applied.
+    struct InjectRef {
+      std::string ref;
+      std::string name;              // ref without dots, as given to handlers.
+      Path path;
+      const Injector* cmd = nullptr; // The command ref names, if resolved.
+      bool resolved = false;         // cmd was looked up when compiled.
+    };
+
+    // A string, scanned once for backtick references. A full injection
+    // ("`a.b`", "`$NAME1`") has a single ref. Otherwise text and refs
+    // interleave: text[0] refs[0] text[1] ... refs[n-1] text[n].
+    struct InjectToken {
+      bool full = false;
+      std::vector<std::string> text;
+      std::vector<InjectRef> refs;
+    };
+
+    inline void replace_all(std::string& s, const std::string& from, const std::string& to) {
+      for(size_t at = s.find(from); at != std::string::npos; at = s.find(from, at + to.size())) {
+        s.replace(at, from.size(), to);
+      }
+    }
+
+    inline InjectRef inject_ref(std::string ref) {
+      // Special escapes inside injection.
+      if(3 < ref.size()) {
+        replace_all(ref, "$BT", "`");
+        replace_all(ref, "$DS", "$");
+      }
+
+      InjectRef out;
+      out.name = ref;
+      out.name.erase(std::remove(out.name.begin(), out.name.end(), '.'), out.name.end());
+      out.path = Path(ref);
+      out.ref = std::move(ref);
+      return out;
+    }
+
+    // Scan a string for injections, matching the canonical patterns without a regex:
+    // full: ^`(\$[A-Z]+|[^`]*)[0-9]*`$, partial: `([^`]+)`.
+    inline InjectToken inject_token(const std::string& val) {
+      InjectToken token;
+      const size_t len = val.size();
+
+      if(2 <= len && '`' == val[0] && len - 1 == val.find('`', 1)) {
+        std::string inner = val.substr(1, len - 2);
+
+        // A command name drops its digit suffix (used to order commands).
+        size_t upper = 1;
+        while(upper < inner.size() && 'A' <= inner[upper] && inner[upper] <= 'Z') {
+          upper++;
+        }
+        size_t digits = upper;
+        while(digits < inner.size() && '0' <= inner[digits] && inner[digits] <= '9') {
+          digits++;
+        }
+        if(!inner.empty() && '$' == inner[0] && 1 < upper && digits == inner.size()) {
+          inner.resize(upper);
+        }
+
+        token.full = true;
+        token.refs.push_back(inject_ref(std::move(inner)));
+        return token;
+      }
+
+      std::string text;
+      size_t at = 0;
+      while(at < len) {
+        const size_t open = val.find('`', at);
+        const size_t close = open == std::string::npos ? open : val.find('`', open + 1);
+        if(close == std::string::npos) {
+          break;
+        }
+
+        // An empty pair is literal: the second backtick may open a reference.
+        if(close == open + 1) {
+          text.append(val, at, close - at);
+          at = close;
+          continue;
+        }
+
+        text.append(val, at, open - at);
+        token.text.push_back(std::move(text));
+        text.clear();
+        token.refs.push_back(inject_ref(val.substr(open + 1, close - open - 1)));
+        at = close + 1;
+      }
+      text.append(val, at, std::string::npos);
+      token.text.push_back(std::move(text));
+
+      return token;
+    }
+
+  }
+
+  using InjectTokens = hash_table<std::string, Auxiliary::InjectToken>;
+
+  // The state of an injection at the current node. Pointers refer into the
+  // node tree being injected (or the store), and stay valid while the node
+  // is processed.
+  struct Injection {
+    int mode = M_VAL;               // Injection mode: M_KEYPRE, M_VAL, M_KEYPOST.
+    bool full = false;              // Transform escape was the full string.
+    int keyI = 0;                   // Index of parent key in list of parent keys.
+    std::shared_ptr<std::vector<std::string>> keys; // Parent keys, shared with siblings.
+    std::string key = S::DTOP;      // Current parent key.
+    json* val = nullptr;            // Current child value, or nullptr if absent.
+    json* parent = nullptr;         // Current parent (in the transform specification).
+    WalkPath path;                  // Path to current node.
+    std::vector<json*> nodes;       // Stack of ancestor nodes.
+    InjectHandler handler;          // Custom handler for injections.
+    json* errs = nullptr;           // Error collector (a list).
+    json* meta = nullptr;           // Custom meta data (a map).
+    const json* dparent = &NONE;    // Current data parent node (contains current data value).
+    json dpath;                     // Current data value path (a list).
+    std::string base = S::DTOP;     // Base key for data in store.
+    const json* top = nullptr;      // Data at $TOP, when the store does not hold it.
+    Modify modify;                  // Modify injection output.
+    Injection* prior = nullptr;     // Parent (aka prior) injection.
+    const Injectors* commands = nullptr;
+    const InjectTokens* tokens = nullptr;
+    json result;                    // Holds the injected string value that val refers to.
+    bool detached = false;          // A command replaced parent: later writes are dropped.
+    size_t maxerrs = 0;             // Stop once errs holds this many errors (0: no limit).
+
+    // The data at dkey of dparent, with top standing in for $TOP of store.
+    const json& dval(const std::string& dkey, const json& store) const {
+      return nullptr != top && &store == dparent && S::DTOP == dkey ? *top : Auxiliary::getpart(*dparent, dkey);
+    }
+
+    // Follow path into the data: dparent becomes the node containing the current value.
+    void descend(const json& store) {
+      if(path.size() < 2) {
+        return;
+      }
+
+      const std::string& parentkey = path[path.size() - 2];
+
+      if(dparent->is_null()) {
+        // Even if there's no data, dpath should continue to match path, so that
+        // relative paths work properly.
+        if(1 < dpath.size()) {
+          dpath.push_back(parentkey);
+        }
+      } else {
+        dparent = &dval(parentkey, store);
+
+        if(!dpath.empty() && dpath.back() == "$:" + parentkey) {
+          dpath.erase(dpath.size() - 1);
+        } else {
+          dpath.push_back(parentkey);
+        }
+      }
+    }
+
+    Injection child(int keyI, const std::shared_ptr<std::vector<std::string>>& keys) {
+      Injection cinj;
+      cinj.key = keyI < static_cast<int>(keys->size()) ? (*keys)[keyI] : S::empty;
+      cinj.val = slot(val, cinj.key);
+      cinj.parent = val;
+      cinj.keyI = keyI;
+      cinj.keys = keys;
+
+      cinj.path = path;
+      cinj.path.push_back(cinj.key);
+      cinj.nodes = nodes;
+      cinj.nodes.push_back(val);
+
+      cinj.mode = mode;
+      cinj.handler = handler;
+      cinj.modify = modify;
+      cinj.base = base;
+      cinj.top = top;
+      cinj.meta = meta;
+      cinj.errs = errs;
+      cinj.maxerrs = maxerrs;
+      cinj.prior = this;
+      cinj.commands = commands;
+      cinj.tokens = tokens;
+
+      cinj.dpath = dpath;
+      cinj.dparent = dparent;
+
+      return cinj;
+    }
+
+    // Set the current value, or with NONE delete it. An ancestor of 2 or
+    // more sets the value in that ancestor instead. Returns the node set.
+    json* setval(const json& v, int ancestor = 0) {
+      json* target = parent;
+      const std::string* tkey = &key;
+
+      if(2 <= ancestor) {
+        if(nodes.size() < static_cast<size_t>(ancestor) || path.size() < static_cast<size_t>(ancestor)) {
+          return nullptr;
+        }
+        target = nodes[nodes.size() - ancestor];
+        tkey = &path[path.size() - ancestor];
+      } else if(detached) {
+        return parent;
+      }
+
+      if(nullptr != target) {
+        setprop(*target, *tkey, v);
+      }
+
+      return target;
+    }
+
+    // The error budget is used up: no further values are injected.
+    bool spent() const {
+      return 0 < maxerrs && nullptr != errs && maxerrs <= errs->size();
+    }
+
+    // Mutable getprop: the child at key, or nullptr if absent.
+    static json* slot(json* node, const std::string& key) {
+      if(nullptr == node) {
+        return nullptr;
+      }
+
+      if(node->is_object()) {
+        json::iterator it = node->find(key);
+        return it == node->end() ? nullptr : &it.value();
+      }
+
+      int index;
+      if(node->is_array() && ::Auxiliary::parse_index(key, index) && index < static_cast<int>(node->size())) {
+        return &(*node)[index];
+      }
+
+      return nullptr;
+    }
+  };
+
+  // Optional injection settings. Unset fields take their defaults.
+  struct InjectDef {
+    Modify modify;              // Called once each value is injected.
+    InjectHandler handler;      // Resolves references. Default: Auxiliary::inject_handler.
+    json* errs = nullptr;       // Collects errors. If not given, transform throws them.
+    json* meta = nullptr;       // Custom meta data (a map), for name$~path references.
+    json extra;                 // Extra transform data, merged under the source data.
+    Injectors commands;         // Commands, or for transform extra commands ({ "$NAME", f }).
+    size_t maxerrs = 0;         // Stop once this many errors are collected (0: no limit).
+  };
+
+  namespace Auxiliary {
+
+    // With instore false, paths are resolved in a node other than the store,
+    // so inj.top does not stand in for its $TOP.
+    inline PathScope scope_of(const Injection& inj, bool instore = true) {
+      PathScope scope;
+      scope.inj = true;
+      scope.base = &inj.base;
+      scope.key = &inj.key;
+      scope.meta = nullptr == inj.meta ? &NONE : inj.meta;
+      scope.dparent = inj.dparent;
+      scope.dpath = &inj.dpath;
+      scope.top = instore ? inj.top : nullptr;
+      return scope;
+    }
+
+    // Default handler: call commands, and set full value references.
+    inline json inject_handler(Injection& inj, const json& val, const Injector* cmd, const std::string& ref, const json& store) {
+      // Only call commands with a $ prefix.
+      if(nullptr != cmd && !ref.empty() && '$' == ref[0]) {
+        return (*cmd)(inj, val, ref, store);
+      } else if(M_VAL == inj.mode && inj.full) {
+        inj.setval(val);
+      }
+
+      return val;
+    }
+
+    // Resolve a reference: a single part naming a command finds the command,
+    // otherwise the path is found in store. The handler sees either.
+    inline json inject_getpath(const json& store, const InjectRef& ref, Injection& inj) {
+      const Injector* cmd = ref.cmd;
+      if(!ref.resolved && nullptr != inj.commands && 1 == ref.path.size()) {
+        Injectors::const_iterator it = inj.commands->find(ref.ref);
+        cmd = it == inj.commands->end() ? nullptr : &it->second;
+      }
+
+      const json& val = nullptr != cmd ? NONE : getpath_in(store, ref.path, scope_of(inj));
+
+      return inj.handler ? inj.handler(inj, val, cmd, ref.name, store) : json(val);
+    }
+
+    // Inject references in a string. A full reference ("`a.b`") returns the
+    // value found; references inside a longer string are stringified.
+    inline json injectstr(const std::string& val, const json& store, Injection& inj) {
+      if(val.empty()) {
+        return S::empty;
+      }
+
+      // Most strings (incl. list keys) have no references.
+      if(std::string::npos == val.find('`')) {
+        inj.full = true;
+        return inj.handler ? inj.handler(inj, val, nullptr, val, store) : json(val);
+      }
+
+      InjectToken parsed;
+      const InjectToken* token = nullptr;
+      if(nullptr != inj.tokens) {
+        InjectTokens::const_iterator it = inj.tokens->find(val);
+        token = it == inj.tokens->end() ? nullptr : &it->second;
+      }
+      if(nullptr == token) {
+        parsed = inject_token(val);
+        token = &parsed;
+      }
+
+      if(token->full) {
+        inj.full = true;
+        return inject_getpath(store, token->refs[0], inj);
+      }
+
+      std::string out = token->text[0];
+      for(size_t rI = 0; rI < token->refs.size(); rI++) {
+        inj.full = false;
+        const json found = inject_getpath(store, token->refs[rI], inj);
+
+        // Ensure inject value is a string.
+        if(found.is_string()) {
+          out += found.get_ref<const std::string&>();
+        } else if(!found.is_null()) {
+          out += found.dump();
+        }
+        out += token->text[rI + 1];
+      }
+
+      // Also call the handler on the entire string, providing the
+      // option for custom injection.
+      inj.full = true;
+      return inj.handler ? inj.handler(inj, out, nullptr, val, store) : json(out);
+    }
+
+    // Inject the value inj.val refers to, in place.
+    inline void inject_node(const json& store, Injection& inj) {
+      VOXGIG_STAT_NODES(1);
+
+      json* val = inj.val;
+      bool skip = false;
+
+      inj.descend(store);
+
+      if(nullptr != val && isnode(*val)) {
+        // Keys are sorted alphanumerically to ensure determinism.
+        // Injection transforms ($FOO) are processed *after* other keys.
+        // NOTE: the optional digits suffix of the transform can thus be
+        // used to order the transforms.
+        std::shared_ptr<std::vector<std::string>> nodekeys = std::make_shared<std::vector<std::string>>();
+        nodekeys->reserve(val->size());
+
+        if(val->is_object()) {
+          for(json::iterator it = val->begin(); it != val->end(); ++it) {
+            if(std::string::npos == it.key().find('$')) {
+              nodekeys->push_back(it.key());
+            }
+          }
+          for(json::iterator it = val->begin(); it != val->end(); ++it) {
+            if(std::string::npos != it.key().find('$')) {
+              nodekeys->push_back(it.key());
+            }
+          }
+        } else {
+          for(size_t i = 0; i < val->size(); i++) {
+            nodekeys->push_back(std::to_string(i));
+          }
+        }
+
+        // Each child key-value pair is processed in three injection phases:
+        // 1. M_KEYPRE - Key string is injected, returning a possibly altered key.
+        // 2. M_VAL - The child value is injected.
+        // 3. M_KEYPOST - Key string is injected again, allowing child mutation.
+        for(int nkI = 0; nkI < static_cast<int>(nodekeys->size()) && !inj.spent(); nkI++) {
+          Injection childinj = inj.child(nkI, nodekeys);
+          const std::string nodekey = childinj.key;
+          childinj.mode = M_KEYPRE;
+
+          const json prekey = injectstr(nodekey, store, childinj);
+
+          // The injection may modify child processing.
+          nkI = childinj.keyI;
+          nodekeys = childinj.keys;
+
+          // Prevent further processing by returning an undefined prekey.
+          if(!prekey.is_null()) {
+            childinj.val = Injection::slot(val, strkey(prekey));
+            childinj.mode = M_VAL;
+
+            inject_node(store, childinj);
+
+            nkI = childinj.keyI;
+            nodekeys = childinj.keys;
+
+            childinj.mode = M_KEYPOST;
+            injectstr(nodekey, store, childinj);
+
+            nkI = childinj.keyI;
+            nodekeys = childinj.keys;
+          }
+        }
+      }
+
+      // Inject paths into string scalars.
+      else if(nullptr != val && val->is_string()) {
+        inj.mode = M_VAL;
+
+        // NOTE: Copied, as setval may replace it.
+        const std::string str = val->get<std::string>();
+        inj.result = injectstr(str, store, inj);
+
+        skip = SKIP == inj.result;
+        if(!skip) {
+          inj.setval(inj.result);
+        }
+        inj.val = &inj.result;
+      }
+
+      // Custom modification.
+      if(inj.modify && !skip && !inj.detached && !inj.spent() && nullptr != inj.parent) {
+        json* mval = Injection::slot(inj.parent, inj.key);
+        inj.modify(nullptr == mval ? NONE : *mval, inj.key, *inj.parent, inj, store);
+      }
+    }
+
+    // Start an injection: val is placed in a virtual parent holder to simplify edge cases.
+    // A non-null top is the data at $TOP, in place of a $TOP key of store.
+    inline json inject_root(json&& val, const json& store, const InjectDef& injdef, json* errs,
+        const Injectors* commands, const InjectTokens* tokens, const json* top = nullptr) {
+      json holder = json::object();
+      holder[S::DTOP] = std::move(val);
+
+      json meta = json::object();
+
+      Injection inj;
+      inj.val = &holder[S::DTOP];
+      inj.parent = &holder;
+      inj.keys = std::make_shared<std::vector<std::string>>(1, S::DTOP);
+      inj.path.push_back(S::DTOP);
+      inj.nodes.push_back(&holder);
+      inj.dpath = json::array({ S::DTOP });
+      inj.dparent = &store;
+      inj.top = top;
+      inj.errs = errs;
+      inj.maxerrs = 0 == injdef.maxerrs ? 0 : errs->size() + injdef.maxerrs;
+      inj.meta = nullptr == injdef.meta ? &meta : injdef.meta;
+      inj.handler = injdef.handler ? injdef.handler : InjectHandler(inject_handler);
+      inj.modify = injdef.modify;
+      inj.commands = commands;
+      inj.tokens = tokens;
+
+      inject_node(store, inj);
+
+      json* out = Injection::slot(&holder, S::DTOP);
+      return nullptr == out ? NONE : std::move(*out);
+    }
+
+  }
+
+  // Inject values from a data store into a node or string. Backtick
+  // references ("`a.b`") are replaced by the value found at that path in
+  // store; a reference inside a longer string is stringified into it.
+  // References naming one of injdef.commands call it.
+  inline json inject(json val, const json& store, const InjectDef& injdef = InjectDef()) {
+    VOXGIG_STAT(INJECT);
+
+    json errs = json::array();
+    json* errp = nullptr != injdef.errs ? injdef.errs : &errs;
+
+    return Auxiliary::inject_root(std::move(val), store, injdef, errp, &injdef.commands, nullptr);
+  }
+
+  inline json inject(args_container&& args) {
+    json val = args.size() == 0 ? nullptr : std::move(args[0]);
+
+    return inject(std::move(val), args.size() < 2 ? NONE : args[1]);
+  }
+
+  namespace Auxiliary {
+
+    // Scan str once into tokens, if it holds a backtick. References naming
+    // one of commands are resolved to it.
+    inline void compile_token(const std::string& str, const Injectors& commands, InjectTokens& tokens) {
+      if(std::string::npos == str.find('`') || tokens.count(str)) {
+        return;
+      }
+
+      InjectToken& token = tokens[str] = inject_token(str);
+      for(InjectRef& ref : token.refs) {
+        ref.resolved = true;
+        if(1 == ref.path.size()) {
+          Injectors::const_iterator cmd = commands.find(ref.ref);
+          ref.cmd = cmd == commands.end() ? nullptr : &cmd->second;
+        }
+      }
+    }
+
+    // compile_token for each string of val, keys too.
+    inline void compile_tokens(const json& val, const Injectors& commands, InjectTokens& tokens) {
+      if(val.is_string()) {
+        compile_token(val.get_ref<const std::string&>(), commands, tokens);
+      } else if(val.is_object()) {
+        for(json::const_iterator it = val.begin(); it != val.end(); ++it) {
+          compile_token(it.key(), commands, tokens);
+          compile_tokens(it.value(), commands, tokens);
+        }
+      } else if(val.is_array()) {
+        for(const json& child : val) {
+          compile_tokens(child, commands, tokens);
+        }
+      }
+    }
+
+  }
+
+  // A template compiled for repeated injection: each string holding a
+  // backtick reference is scanned once, so apply(store) only walks a copy
+  // of the template, as with CompiledTransform.
+  class CompiledInject {
+    public:
+      // commands are those of InjectDef::commands.
+      explicit CompiledInject(const json& val, const Injectors& commands = Injectors()) :
+        val{std::make_shared<const json>(val)}, commands{commands} {
+        Auxiliary::compile_tokens(*this->val, this->commands, tokens);
+      }
+
+      // NOTE: Tokens refer to commands, so a copy would refer to the original.
+      CompiledInject(const CompiledInject&) = delete;
+      CompiledInject& operator=(const CompiledInject&) = delete;
+      CompiledInject(CompiledInject&&) = default;
+      CompiledInject& operator=(CompiledInject&&) = default;
+
+      // As inject(val, store, injdef). injdef.commands is not used: pass commands when compiling.
+      json apply(const json& store, const InjectDef& injdef = InjectDef()) const {
+        json errs = json::array();
+        json* errp = nullptr != injdef.errs ? injdef.errs : &errs;
+
+        return Auxiliary::inject_root(json(*val), store, injdef, errp, &commands, &tokens);
+      }
+
+      // The number of distinct strings with references.
+      size_t size() const {
+        return tokens.size();
+      }
+
+    private:
+      std::shared_ptr<const json> val;
+      Injectors commands;
+      InjectTokens tokens;
+  };
+
+
+  // Transform
+  // =========
+
+  namespace Auxiliary {
+
+    const std::string PLACEMENT[] = { "", "key", "key", "", "value" };
+
+    // Check a command is placed as expected: modes is a mask of modes, parentTypes of types.
+    inline bool check_placement(int modes, const std::string& ijname, int parentTypes, Injection& inj) {
+      if(0 == (modes & inj.mode)) {
+        std::string expected;
+        for(int m : { M_KEYPRE, M_KEYPOST, M_VAL }) {
+          if(0 != (modes & m)) {
+            expected += (expected.empty() ? "" : ",") + PLACEMENT[m];
+          }
+        }
+        inj.errs->push_back("$" + ijname + ": invalid placement as " + PLACEMENT[inj.mode] +
+            ", expected: " + expected + ".");
+        return false;
+      }
+
+      if(0 != parentTypes) {
+        const int ptype = typify(nullptr == inj.parent ? NONE : *inj.parent);
+        if(0 == (parentTypes & ptype)) {
+          inj.errs->push_back("$" + ijname + ": invalid placement in parent " + typename_of(ptype) +
+              ", expected: " + typename_of(parentTypes) + ".");
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    // Check the arguments args[offset...] have argTypes. Returns an error message, or "".
+    inline std::string injector_args(std::initializer_list<int> argTypes, const json& args, size_t offset) {
+      size_t argI = 0;
+      for(int argType : argTypes) {
+        const json& arg = args.is_array() && offset + argI < args.size() ? args[offset + argI] : NONE;
+        const int t = typify(arg);
+        if(0 == (argType & t)) {
+          return "invalid argument: " + stringify(arg, 22) +
+            " (" + typename_of(t) + " at position " + std::to_string(1 + argI) +
+            ") is not of type: " + typename_of(argType) + ".";
+        }
+        argI++;
+      }
+      return S::empty;
+    }
+
+    // The ancestor n levels up (1 is the parent), or the furthest there is.
+    inline json* ancestor(const Injection& inj, size_t n) {
+      if(inj.nodes.empty()) {
+        return nullptr;
+      }
+      return n <= inj.nodes.size() ? inj.nodes[inj.nodes.size() - n] : inj.nodes.front();
+    }
+
+    // The key n levels up the path (1 is the current key), or alt.
+    inline const std::string& pathkey(const Injection& inj, size_t n, const std::string& alt = S::empty) {
+      return n <= inj.path.size() ? inj.path[inj.path.size() - n] : alt;
+    }
+
+    inline json dropright(const WalkPath& path, size_t n) {
+      json out = json::array();
+      for(size_t pI = 0; pI + n < path.size(); pI++) {
+        out.push_back(path[pI]);
+      }
+      return out;
+    }
+
+    inline bool contains(const json& val, const std::string& str) {
+      if(val.is_string()) {
+        return str == val.get_ref<const std::string&>();
+      }
+      for(const json& child : val) {
+        if(isnode(child) || child.is_string() ? contains(child, str) : false) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // Data path of an $EACH or $PACK child: [$TOP, srcpath..., $:ckey(, $:pkey)],
+    // with tcur the matching parallel data structure.
+    inline void parallel(const Injection& inj, const std::string& srcpath, json&& tsrc, json& dpath, json& tcur) {
+      const std::string& ckey = pathkey(inj, 2);
+
+      dpath = json::array({ S::DTOP });
+      size_t start = 0;
+      for(size_t dot = srcpath.find('.'); dot != std::string::npos; dot = srcpath.find('.', start)) {
+        dpath.push_back(srcpath.substr(start, dot - start));
+        start = dot + 1;
+      }
+      dpath.push_back(srcpath.substr(start));
+      dpath.push_back("$:" + ckey);
+
+      tcur = json::object();
+      tcur[ckey] = std::move(tsrc);
+
+      if(2 < inj.path.size()) {
+        const std::string& pkey = pathkey(inj, 3, S::DTOP);
+        json outer = json::object();
+        outer[pkey] = std::move(tcur);
+        tcur = std::move(outer);
+        dpath.push_back("$:" + pkey);
+      }
+    }
+
+    // An injection of tval at the position of the command's parent node.
+    inline Injection parallel_child(Injection& inj, json* tval, json&& dpath, const json& tcur) {
+      const std::string& ckey = pathkey(inj, 2);
+
+      Injection tinj = inj.child(0, std::make_shared<std::vector<std::string>>(1, ckey));
+      tinj.path.assign(inj.path.begin(), inj.path.end() - 1);
+      tinj.nodes.assign(inj.nodes.begin(), inj.nodes.end() - 1);
+      tinj.parent = tinj.nodes.back();
+      tinj.val = tval;
+      tinj.dpath = std::move(dpath);
+      tinj.dparent = &tcur;
+
+      return tinj;
+    }
+
+    // Replace the command list ['`$FORMAT`', ...] with child, and inject it
+    // there. Returns the injected child.
+    inline json inject_child(json&& child, const json& store, Injection& inj) {
+      if(nullptr == inj.prior) {
+        return std::move(child);
+      }
+
+      Injection cinj = nullptr != inj.prior->prior ?
+        inj.prior->prior->child(inj.prior->keyI, inj.prior->keys) :
+        inj.prior->child(inj.keyI, inj.keys);
+
+      cinj.val = nullptr;
+      if(!child.is_null() && nullptr != cinj.parent) {
+        setprop(*cinj.parent, cinj.key, std::move(child));
+        cinj.val = Injection::slot(cinj.parent, cinj.key);
+      }
+
+      inject_node(store, cinj);
+
+      return nullptr == cinj.val ? NONE : *cinj.val;
+    }
+
+    // The transform_* functions are the commands (see Injector).
+
+    // Delete a key from a map or list.
+    inline json transform_DELETE(Injection& inj, const json&, const std::string&, const json&) {
+      inj.setval(NONE);
+      return NONE;
+    }
+
+    // Copy value from source data.
+    inline json transform_COPY(Injection& inj, const json&, const std::string&, const json& store) {
+      if(!check_placement(M_VAL, "COPY", T_any, inj)) {
+        return NONE;
+      }
+
+      json out = inj.dval(inj.key, store);
+      inj.setval(out);
+
+      return out;
+    }
+
+    // As a value, inject the key of the parent node.
+    // As a key, defined the name of the key property in the source object.
+    inline json transform_KEY(Injection& inj, const json&, const std::string&, const json&) {
+      // Do nothing in val mode - not an error.
+      if(M_VAL != inj.mode) {
+        return NONE;
+      }
+
+      // Key is defined by $KEY meta property.
+      const json keyspec = getprop(*inj.parent, S::BKEY);
+      if(!keyspec.is_null()) {
+        delprop(*inj.parent, S::BKEY);
+        return getprop(*inj.dparent, keyspec);
+      }
+
+      // Key is defined within general purpose $META object.
+      const json& anno = getprop(getprop(*inj.parent, S::BANNO), S::KEY);
+      return anno.is_null() ? json(pathkey(inj, 2)) : anno;
+    }
+
+    // Annotate node. Does nothing itself, just used by
+    // other commands, and is removed when called.
+    inline json transform_ANNO(Injection& inj, const json&, const std::string&, const json&) {
+      delprop(*inj.parent, S::BANNO);
+      return NONE;
+    }
+
+    // Merge a list of objects into the current object.
+    // Must be a key in an object. The value is merged over the current object.
+    // If the value is an array, the elements are first merged using `merge`.
+    // If the value is the empty string, merge the top level store.
+    // Format: { '`$MERGE`': '`source-path`' | ['`source-paths`', ...] }
+    inline json transform_MERGE(Injection& inj, const json&, const std::string&, const json&) {
+      if(M_KEYPRE == inj.mode) {
+        return inj.key;
+      }
+
+      // Operate after child values have been transformed.
+      if(M_KEYPOST == inj.mode) {
+        json args = getprop(*inj.parent, inj.key);
+        if(!islist(args)) {
+          args = json::array({ std::move(args) });
+        }
+
+        // Remove the $MERGE command from a parent map.
+        inj.setval(NONE);
+
+        // Literals in the parent have precedence, but we still merge onto
+        // the parent, so that node tree references are not changed.
+        // NOTE: As with merge, a scalar argument ends merging onto the parent.
+        json literals = *inj.parent;
+        json mergelist = json::array();
+        mergelist.push_back(std::move(*inj.parent));
+
+        bool onto = true;
+        for(json& arg : args) {
+          if(!isnode(arg)) {
+            onto = false;
+            break;
+          }
+          mergelist.push_back(std::move(arg));
+        }
+        if(onto) {
+          mergelist.push_back(std::move(literals));
+        }
+
+        *inj.parent = merge(std::move(mergelist));
+
+        return inj.key;
+      }
+
+      // Ensures $MERGE is removed from parent list (val mode).
+      return NONE;
+    }
+
+    // Convert a node to a list.
+    // Format: ['`$EACH`', '`source-path-of-node`', child-template]
+    inline json transform_EACH(Injection& inj, const json&, const std::string&, const json& store) {
+      if(!check_placement(M_VAL, "EACH", T_list, inj)) {
+        return NONE;
+      }
+
+      // Remove remaining keys to avoid spurious processing.
+      if(1 < inj.keys->size()) {
+        inj.keys->resize(1);
+      }
+
+      const std::string err = injector_args({ T_string, T_any }, *inj.parent, 1);
+      if(!err.empty()) {
+        inj.errs->push_back("$EACH: " + err);
+        return NONE;
+      }
+
+      const std::string srcpath = (*inj.parent)[1];
+      const json child = getprop(*inj.parent, 2);
+
+      // Source data.
+      const json& src = getpath_in(store_base(store, inj.base, inj.top), Path(srcpath), scope_of(inj, false));
+
+      // Create clones of the child template for each value of the current source.
+      json tval = json::array();
+      if(islist(src)) {
+        for(size_t i = 0; i < src.size(); i++) {
+          tval.push_back(child);
+        }
+      } else if(ismap(src)) {
+        for(json::const_iterator it = src.begin(); it != src.end(); ++it) {
+          // Make a note of the key for $KEY transforms.
+          tval.push_back(merge(json::array({ child, { { S::BANNO, { { S::KEY, it.key() } } } } }), 1));
+        }
+      }
+
+      const std::string tkey = pathkey(inj, 2);
+      json* target = ancestor(inj, 2);
+      json rval = json::array();
+
+      if(!tval.empty()) {
+        // Create parallel data structures: source entries :: child templates.
+        json tsrc = json::array();
+        for(const json& item : src) {
+          tsrc.push_back(item);
+        }
+
+        json dpath, tcur;
+        parallel(inj, srcpath, std::move(tsrc), dpath, tcur);
+
+        // The child templates replace the command list, and are injected in place.
+        Injection tinj = parallel_child(inj, nullptr, std::move(dpath), tcur);
+        setprop(*tinj.parent, tinj.key, std::move(tval));
+        tinj.val = Injection::slot(tinj.parent, tinj.key);
+
+        inject_node(store, tinj);
+
+        if(nullptr != tinj.val && tinj.parent == target && tinj.key == tkey) {
+          inj.detached = true;
+          return getprop(*tinj.val, 0);
+        }
+        rval = nullptr == tinj.val ? NONE : *tinj.val;
+      }
+
+      setprop(*target, tkey, rval);
+      inj.detached = true;
+
+      // Prevent callee from damaging first list entry (since we are in `val` mode).
+      return getprop(rval, 0);
+    }
+
+    // The key of a $PACK child, or NONE. A backtick keypath is injected with srcnode
+    // as the data; commands come from inj, so the rest of the store is not needed.
+    inline json pack_key(const json& keypath, size_t index, const json& srcnode, Injection& inj) {
+      if(keypath.is_null()) {
+        return std::to_string(index);
+      }
+
+      if(!keypath.is_string()) {
+        return NONE;
+      }
+
+      const std::string& kp = keypath.get_ref<const std::string&>();
+      if(!kp.empty() && '`' == kp[0]) {
+        json kstore = json::object();
+        kstore[S::DTOP] = srcnode;
+        return inject_root(json(kp), kstore, InjectDef(), inj.errs, inj.commands, inj.tokens);
+      }
+
+      return getpath_in(srcnode, Path(kp), scope_of(inj, false));
+    }
+
+    // Convert a node to a map.
+    // Format: { '`$PACK`':['source-path', child-template]}
+    inline json transform_PACK(Injection& inj, const json&, const std::string&, const json& store) {
+      if(!check_placement(M_KEYPRE, "EACH", T_map, inj)) {
+        return NONE;
+      }
+
+      // Get arguments.
+      json args = getprop(*inj.parent, inj.key);
+      const std::string err = injector_args({ T_string, T_any }, args, 0);
+      if(!err.empty()) {
+        inj.errs->push_back("$EACH: " + err);
+        return NONE;
+      }
+
+      const std::string srcpath = args[0];
+      json childspec = islist(args) && 1 < args.size() ? std::move(args[1]) : NONE;
+
+      // Find key and target node.
+      const std::string tkey = pathkey(inj, 2);
+      json* target = ancestor(inj, 2);
+
+      // Source data, as a list.
+      const json& found = getpath_in(store_base(store, inj.base, inj.top), Path(srcpath), scope_of(inj, false));
+
+      json src = json::array();
+      if(islist(found)) {
+        src = found;
+      } else if(ismap(found)) {
+        for(json::const_iterator it = found.begin(); it != found.end(); ++it) {
+          json item = it.value();
+          if(isnode(item)) {
+            setprop(item, S::BANNO, json({ { S::KEY, it.key() } }));
+          }
+          src.push_back(std::move(item));
+        }
+      } else {
+        return NONE;
+      }
+
+      // Get keypath.
+      const json keypath = getprop(childspec, S::BKEY);
+      delprop(childspec, S::BKEY);
+
+      const json& child = getprop(childspec, S::BVAL, childspec);
+
+      // Build parallel target object.
+      json tval = json::object();
+      json keys = json::array();
+
+      for(size_t sI = 0; sI < src.size(); sI++) {
+        const json& srcnode = src[sI];
+        keys.push_back(pack_key(keypath, sI, srcnode, inj));
+
+        json tchild = child;
+        const json& anno = getprop(srcnode, S::BANNO);
+        if(anno.is_null()) {
+          delprop(tchild, S::BANNO);
+        } else {
+          setprop(tchild, S::BANNO, anno);
+        }
+
+        setprop(tval, keys.back(), std::move(tchild));
+      }
+
+      json rval = json::object();
+
+      if(!isempty(tval)) {
+        // Build parallel source object.
+        json tsrc = json::object();
+        for(size_t sI = 0; sI < src.size(); sI++) {
+          setprop(tsrc, keys[sI], std::move(src[sI]));
+        }
+
+        json dpath, tcur;
+        parallel(inj, srcpath, std::move(tsrc), dpath, tcur);
+
+        Injection tinj = parallel_child(inj, &tval, std::move(dpath), tcur);
+        inject_node(store, tinj);
+
+        rval = std::move(tval);
+      }
+
+      setprop(*target, tkey, std::move(rval));
+
+      // Drop transform key.
+      return NONE;
+    }
+
+    // Reference original spec (enables recursive transformations)
+    // Format: ['`$REF`', '`spec-path`']
+    inline json transform_REF(Injection& inj, const json&, const std::string&, const json& store, const json& spec) {
+      if(M_VAL != inj.mode) {
+        return NONE;
+      }
+
+      // Get arguments: ['`$REF`', 'ref-path'].
+      const json refpath = getprop(*inj.parent, 1);
+      inj.keyI = static_cast<int>(inj.keys->size());
+
+      // Spec reference.
+      json dpath = json::array();
+      for(size_t pI = 1; pI < inj.path.size(); pI++) {
+        dpath.push_back(inj.path[pI]);
+      }
+
+      PathScope scope;
+      scope.inj = true;
+      scope.dpath = &dpath;
+      scope.dparent = &getpath_in(spec, Path(dpath), PathScope());
+
+      const json& ref = getpath_in(spec, Path(refpath), scope);
+      const bool hasSubRef = isnode(ref) && contains(ref, "`$REF`");
+
+      json tref = ref;
+
+      json cpath = dropright(inj.path, 3);
+      const json tpath = dropright(inj.path, 1);
+      PathScope storescope;
+      storescope.top = inj.top;
+      const json& tcur = getpath_in(store, Path(cpath), storescope);
+      const json& tval = getpath_in(store, Path(tpath), storescope);
+      json rval = NONE;
+
+      if(!hasSubRef || !tval.is_null()) {
+        Injection tinj = inj.child(0, std::make_shared<std::vector<std::string>>(1, pathkey(inj, 2)));
+
+        tinj.path.assign(inj.path.begin(), inj.path.end() - 1);
+        tinj.nodes.assign(inj.nodes.begin(), inj.nodes.end() - 1);
+        tinj.parent = ancestor(inj, 2);
+        tinj.val = &tref;
+
+        tinj.dpath = std::move(cpath);
+        tinj.dparent = &tcur;
+
+        inject_node(store, tinj);
+
+        rval = *tinj.val;
+      }
+
+      json* grandparent = inj.setval(rval, 2);
+      inj.detached = true;
+
+      if(nullptr != grandparent && islist(*grandparent) && nullptr != inj.prior) {
+        inj.prior->keyI--;
+      }
+
+      return NONE;
+    }
+
+    // JavaScript string conversion ('' + v) of a scalar.
+    inline std::string jsstring(const json& val) {
+      return val.is_string() ? val.get<std::string>() : val.dump();
+    }
+
+    // JavaScript Number(v), with NaN as 0. Integral results are integers.
+    inline json jsnumber(const json& val) {
+      double n = 0;
+      if(val.is_number()) {
+        return val;
+      } else if(val.is_boolean()) {
+        n = val.get<bool>() ? 1 : 0;
+      } else if(val.is_string()) {
+        const std::string& str = val.get_ref<const std::string&>();
+        const size_t first = str.find_first_not_of(" \t\n\r");
+        if(std::string::npos != first) {
+          const std::string trimmed = str.substr(first, str.find_last_not_of(" \t\n\r") - first + 1);
+          char* end = nullptr;
+          n = std::strtod(trimmed.c_str(), &end);
+          if(end != trimmed.c_str() + trimmed.size() || std::isnan(n)) {
+            n = 0;
+          }
+        }
+      }
+
+      if(n == std::floor(n) && std::fabs(n) < 9007199254740992.0) {
+        return static_cast<int64_t>(n);
+      }
+      return n;
+    }
+
+    inline std::string casefold(std::string str, int (*fold)(int)) {
+      for(char& c : str) {
+        c = static_cast<char>(fold(static_cast<unsigned char>(c)));
+      }
+      return str;
+    }
+
+    // Formatters for $FORMAT, applied with walk (post-order).
+    using Formatter = void(*)(const std::string&, json&, const json&, const WalkPath&);
+
+    inline void format_identity(const std::string&, json&, const json&, const WalkPath&) {}
+
+    inline void format_upper(const std::string&, json& val, const json&, const WalkPath&) {
+      if(!isnode(val)) {
+        val = casefold(jsstring(val), ::toupper);
+      }
+    }
+
+    inline void format_lower(const std::string&, json& val, const json&, const WalkPath&) {
+      if(!isnode(val)) {
+        val = casefold(jsstring(val), ::tolower);
+      }
+    }
+
+    inline void format_string(const std::string&, json& val, const json&, const WalkPath&) {
+      if(!isnode(val)) {
+        val = jsstring(val);
+      }
+    }
+
+    inline void format_number(const std::string&, json& val, const json&, const WalkPath&) {
+      if(!isnode(val)) {
+        val = jsnumber(val);
+      }
+    }
+
+    inline void format_integer(const std::string&, json& val, const json&, const WalkPath&) {
+      if(!isnode(val)) {
+        const json n = jsnumber(val);
+        val = n.is_number_integer() ? n.get<int64_t>() : static_cast<int64_t>(std::trunc(n.get<double>()));
+      }
+    }
+
+    inline void format_concat(const std::string&, json& val, const json&, const WalkPath& path) {
+      if(path.empty() && islist(val)) {
+        std::string out;
+        for(const json& item : val) {
+          out += isnode(item) ? S::empty : jsstring(item);
+        }
+        val = out;
+      }
+    }
+
+    // Apply a formatter post-order. Unlike walk, null children are kept (and formatted).
+    inline void format_node(json& val, Formatter formatter, const std::string& key, const json& parent, WalkPath& path) {
+      if(ismap(val)) {
+        for(json::iterator it = val.begin(); it != val.end(); ++it) {
+          path.push_back(it.key());
+          format_node(it.value(), formatter, path.back(), val, path);
+          path.pop_back();
+        }
+      } else if(islist(val)) {
+        for(size_t i = 0; i < val.size(); i++) {
+          path.push_back(std::to_string(i));
+          format_node(val[i], formatter, path.back(), val, path);
+          path.pop_back();
+        }
+      }
+
+      formatter(key, val, parent, path);
+    }
+
+    inline const hash_table<std::string, Formatter>& formatters() {
+      static const hash_table<std::string, Formatter> table = {
+        { "identity", format_identity },
+        { "upper", format_upper },
+        { "lower", format_lower },
+        { "string", format_string },
+        { "number", format_number },
+        { "integer", format_integer },
+        { "concat", format_concat },
+      };
+      return table;
+    }
+
+    // Format a value.
+    // Format: ['`$FORMAT`', 'name', child]
+    inline json transform_FORMAT(Injection& inj, const json&, const std::string&, const json& store) {
+      // Remove remaining keys to avoid spurious processing.
+      if(1 < inj.keys->size()) {
+        inj.keys->resize(1);
+      }
+
+      if(M_VAL != inj.mode) {
+        return NONE;
+      }
+
+      const json name = getprop(*inj.parent, 1);
+      json child = getprop(*inj.parent, 2);
+
+      // Source data.
+      const std::string tkey = pathkey(inj, 2);
+      json* target = ancestor(inj, 2);
+
+      json out = inject_child(std::move(child), store, inj);
+
+      const hash_table<std::string, Formatter>& table = formatters();
+      hash_table<std::string, Formatter>::const_iterator formatter =
+        name.is_string() ? table.find(name.get<std::string>()) : table.end();
+
+      if(formatter == table.end()) {
+        inj.errs->push_back("$FORMAT: unknown format: " + jsstring(name) + ".");
+        return NONE;
+      }
+
+      WalkPath path;
+      format_node(out, formatter->second, S::empty, NONE, path);
+
+      setprop(*target, tkey, out);
+      inj.detached = true;
+
+      return out;
+    }
+
+    // Apply a function to a value.
+    // Format: ['`$APPLY`', function, child]
+    // NOTE: A json value cannot be a function, so the function argument never type checks.
+    inline json transform_APPLY(Injection& inj, const json&, const std::string&, const json&) {
+      if(!check_placement(M_VAL, "APPLY", T_list, inj)) {
+        return NONE;
+      }
+
+      const std::string err = injector_args({ T_function, T_any }, *inj.parent, 1);
+      if(!err.empty()) {
+        inj.errs->push_back("$APPLY: " + err);
+      }
+
+      return NONE;
+    }
+
+    // Insert current date and time as an ISO string.
+    inline json transform_WHEN(Injection&, const json&, const std::string&, const json&) {
+      const std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+      const std::time_t secs = std::chrono::system_clock::to_time_t(now);
+      const long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+
+      // NOTE: gmtime_r is POSIX, gmtime_s its Windows form; std::gmtime is not thread safe.
+      std::tm utc;
+#if defined(__unix__) || defined(__APPLE__)
+      gmtime_r(&secs, &utc);
+#elif defined(_WIN32)
+      gmtime_s(&utc, &secs);
+#else
+      utc = *std::gmtime(&secs);
+#endif
+
+      char buf[32];
+      std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &utc);
+
+      std::ostringstream out;
+      out << buf << '.' << std::setw(3) << std::setfill('0') << ms << 'Z';
+      return out.str();
+    }
+
+    // The transform commands, with spec as the $SPEC and $REF source.
+    inline Injectors transform_commands(const std::shared_ptr<const json>& spec) {
+      return {
+        { "$SPEC", [spec](Injection&, const json&, const std::string&, const json&) -> json { return *spec; } },
+
+        // Escape backtick and dollar sign (these also work inside backticks).
+        { "$BT", [](Injection&, const json&, const std::string&, const json&) -> json { return "`"; } },
+        { "$DS", [](Injection&, const json&, const std::string&, const json&) -> json { return "$"; } },
+
+        { "$WHEN", transform_WHEN },
+        { "$DELETE", transform_DELETE },
+        { "$COPY", transform_COPY },
+        { "$KEY", transform_KEY },
+        { "$ANNO", transform_ANNO },
+        { "$MERGE", transform_MERGE },
+        { "$EACH", transform_EACH },
+        { "$PACK", transform_PACK },
+        { "$REF", [spec](Injection& inj, const json& val, const std::string& ref, const json& store) {
+            return transform_REF(inj, val, ref, store, *spec);
+          } },
+        { "$FORMAT", transform_FORMAT },
+        { "$APPLY", transform_APPLY },
+      };
+    }
+
+  }
+
+  // A transform spec compiled for repeated use. Each string of the spec
+  // holding a backtick reference is scanned once, and references naming
+  // commands are resolved then, so apply does no parsing and no command
+  // lookups for spec strings.
+  class CompiledTransform {
+    public:
+      // commands adds to (or overrides) the standard transform commands.
+      // An empty command removes the standard one.
+      explicit CompiledTransform(const json& spec, const Injectors& commands = Injectors()) :
+        spec{std::make_shared<const json>(spec)} {
+
+        this->commands = Auxiliary::transform_commands(this->spec);
+        for(const Injectors::value_type& cmd : commands) {
+          if(cmd.second) {
+            custom = true;
+            this->commands[cmd.first] = cmd.second;
+          } else {
+            this->commands.erase(cmd.first);
+          }
+        }
+
+        Auxiliary::compile_tokens(*this->spec, this->commands, tokens);
+      }
+
+      // Does the spec refer to name (such as "$WHEN") in any of its strings?
+      bool references(const std::string& name) const {
+        for(const InjectTokens::value_type& token : tokens) {
+          for(const Auxiliary::InjectRef& ref : token.second.refs) {
+            if(name == ref.name) {
+              return true;
+            }
+          }
+        }
+        return false;
+      }
+
+      // NOTE: Tokens refer to commands, so a copy would refer to the original.
+      CompiledTransform(const CompiledTransform&) = delete;
+      CompiledTransform& operator=(const CompiledTransform&) = delete;
+      CompiledTransform(CompiledTransform&&) = default;
+      CompiledTransform& operator=(CompiledTransform&&) = default;
+
+      // Transform data (not modified). injdef.commands is not used: pass commands when compiling.
+      json apply(const json& data, const InjectDef& injdef = InjectDef()) const {
+        json store = json::object();
+
+        // Extra data (keys without a $ prefix) is merged under the source data.
+        json extra = json::object();
+        if(ismap(injdef.extra)) {
+          for(json::const_iterator it = injdef.extra.begin(); it != injdef.extra.end(); ++it) {
+            if(0 != it.key().compare(0, 1, "$")) {
+              extra[it.key()] = it.value();
+            }
+          }
+        }
+
+        // The inject function recognises this special location for the root of the source data.
+        // NOTE: to escape data that contains "`$FOO`" keys at the top level,
+        // place that data inside a holding map: { myholder: mydata }.
+        // The standard commands find $TOP by reference, so data is only copied
+        // into the store for custom commands, which may read it from there.
+        const json* top = nullptr;
+        if(!extra.empty()) {
+          store[S::DTOP] = merge(json::array({ std::move(extra), data }));
+        } else if(custom) {
+          store[S::DTOP] = data;
+        } else {
+          top = &data;
+        }
+
+        json errs = json::array();
+        json* errp = nullptr != injdef.errs ? injdef.errs : &errs;
+
+        json out = Auxiliary::inject_root(json(*spec), store, injdef, errp, &commands, &tokens, top);
+
+        if(nullptr == injdef.errs && !errs.empty()) {
+          throw std::runtime_error(join(errs, " | "));
+        }
+
+        return out;
+      }
+
+    private:
+      std::shared_ptr<const json> spec;
+      Injectors commands;
+      InjectTokens tokens;
+      bool custom = false;  // Commands beyond the standard ones were given.
+  };
+
+  // Transform data using spec. Only operates on static JSON-like data.
+  // Arrays are treated as if they are objects with indices as keys.
+  // The spec is cloned, and the clone injected with the data at $TOP.
+  // Errors are thrown, joined by " | ", unless collected in injdef.errs.
+  inline json transform(const json& data, const json& spec, const InjectDef& injdef = InjectDef()) {
+    VOXGIG_STAT(TRANSFORM);
+
+    return CompiledTransform(spec, injdef.commands).apply(data, injdef);
+  }
+
+  inline json transform(args_container&& args) {
+    return transform(args.size() == 0 ? NONE : args[0], args.size() < 2 ? NONE : args[1]);
+  }
+
+  // A transform that keeps its results by the struct_hash of the data, so
+  // transforming data equal to data seen before copies the earlier result.
+  // Only the standard commands are used. Their results depend on the data
+  // alone, except for $WHEN (the time), so the results of a spec that uses
+  // it are not kept. Once capacity results are kept they are all dropped,
+  // and kept again as they come. Not safe to use from several threads at once.
+  class MemoTransform {
+    public:
+      explicit MemoTransform(const json& spec, size_t capacity = 1024) :
+        compiled(spec), capacity{capacity}, timed{compiled.references("$WHEN")} {}
+
+      json apply(const json& data) {
+        if(timed) {
+          return compiled.apply(data);
+        }
+
+        const std::uint64_t hash = struct_hash(data);
+        std::vector<std::pair<json, json>>& held = results[hash];
+        for(const std::pair<json, json>& result : held) {
+          if(result.first == data) {
+            hits++;
+            return result.second;
+          }
+        }
+
+        json out = compiled.apply(data);
+        if(capacity <= count) {
+          results.clear();
+          count = 0;
+        }
+        results[hash].emplace_back(data, out);
+        count++;
+        return out;
+      }
+
+      // The number of results kept, and of the calls that used one.
+      size_t size() const {
+        return count;
+      }
+
+      size_t reused() const {
+        return hits;
+      }
+
+    private:
+      CompiledTransform compiled;
+      std::unordered_map<std::uint64_t, std::vector<std::pair<json, json>>> results;
+      size_t capacity;
+      bool timed;  // The spec uses $WHEN, so no result is kept.
+      size_t count = 0;
+      size_t hits = 0;
+  };
+
+  // Async transform
+  // ===============
+
+  // The result of an $APPLY handler of transform_async: a value now, or a
+  // future value, placed once it is ready.
+  class AsyncJson {
+    public:
+      AsyncJson(json val) : val(std::move(val)) {}
+
+      AsyncJson(std::future<json>&& later) : later(std::move(later)) {}
+
+      bool ready() const {
+        return !later.valid();
+      }
+
+      // The value, waiting for it if need be.
+      json get() {
+        return ready() ? std::move(val) : later.get();
+      }
+
+      std::future<json>& future() {
+        return later;
+      }
+
+    private:
+      json val;
+      std::future<json> later;
+  };
+
+  // An $APPLY handler, called as f(val, store) with the injected child value,
+  // valid only during the call. The store is shared by every handler of the
+  // transform, and may be kept (it is a cheap copy) by a result still to come.
+  using AsyncApply = std::function<AsyncJson(const json&, const FrozenJson&)>;
+
+  using AsyncApplies = hash_table<std::string, AsyncApply>;
+
+  // A handler that runs f(val, store) as a task of pool (by default, the pool
+  // of walk_parallel), for functions that block, such as lookups: the
+  // transform goes on while f runs, and no more of them run at once than the
+  // pool has workers. The task gets a copy of the value, and shares the store.
+  inline AsyncApply async_apply(std::function<json(const json&, const json&)> f, TaskPool* pool = nullptr) {
+    return [f, pool](const json& val, const FrozenJson& store) -> AsyncJson {
+      std::shared_ptr<std::packaged_task<json()>> task = std::make_shared<std::packaged_task<json()>>(
+          [f, val, store]() { return f(val, store.value()); });
+      std::future<json> later = task->get_future();
+      (nullptr == pool ? Auxiliary::default_pool() : *pool).submit([task]() { (*task)(); });
+      return AsyncJson(std::move(later));
+    };
+  }
+
+  namespace Auxiliary {
+
+    // Stands in the output for a result still to come: a binary value (which
+    // JSON text cannot hold), with the index of the result as its subtype.
+    inline json async_placeholder(size_t index) {
+      static const json::binary_t::container_type marker = { '$', 'A', 'P', 'P', 'L', 'Y' };
+      return json::binary(marker, static_cast<std::uint64_t>(index));
+    }
+
+    inline bool async_index(const json& val, size_t& index) {
+      if(!val.is_binary() || !val.get_binary().has_subtype()) {
+        return false;
+      }
+      index = static_cast<size_t>(val.get_binary().subtype());
+      return val == async_placeholder(index);
+    }
+
+    // The results of transform_async still to come, with where each was left
+    // in the output (a path from the root of the spec), and the shared store.
+    struct AsyncPending {
+      std::vector<std::future<json>> results;
+      std::vector<WalkPath> paths;
+      std::unique_ptr<FrozenJson> store;
+    };
+
+    // The node at path in val, or nullptr.
+    inline json* async_at(json& val, const WalkPath& path) {
+      json* node = &val;
+      for(const std::string& key : path) {
+        int index;
+        if(node->is_object()) {
+          json::iterator it = node->find(key);
+          node = it == node->end() ? nullptr : &*it;
+        } else if(node->is_array() && ::Auxiliary::parse_index(key, index) &&
+            0 <= index && static_cast<size_t>(index) < node->size()) {
+          node = &(*node)[index];
+        } else {
+          node = nullptr;
+        }
+        if(nullptr == node) {
+          return nullptr;
+        }
+      }
+      return node;
+    }
+
+    // Replace every placeholder in val (nothing else is changed).
+    inline void async_place_all(json& val, std::vector<json>& results) {
+      size_t index;
+      if(async_index(val, index)) {
+        if(index < results.size()) {
+          val = results[index];
+        }
+      } else if(val.is_structured()) {
+        for(json& child : val) {
+          async_place_all(child, results);
+        }
+      }
+    }
+
+    // Put each result in place of its placeholder, at the path it was left
+    // at. Should a later command have moved or copied a placeholder, the
+    // whole output is searched instead.
+    inline void async_place(json& out, AsyncPending& pending) {
+      std::vector<json> results;
+      results.reserve(pending.results.size());
+      for(std::future<json>& later : pending.results) {
+        results.push_back(later.get());
+      }
+
+      bool moved = false;
+      for(size_t rI = 0; rI < results.size(); rI++) {
+        json* at = async_at(out, pending.paths[rI]);
+        size_t index;
+        if(nullptr != at && async_index(*at, index) && rI == index) {
+          *at = results[rI];
+        } else {
+          moved = true;
+        }
+      }
+
+      if(moved) {
+        async_place_all(out, results);
+      }
+    }
+
+    // Apply the handler named by the first argument to the injected child.
+    // Format: ['`$APPLY`', 'name', child]
+    // Names without a handler are checked (and rejected) as by transform.
+    inline json transform_APPLY_async(Injection& inj, const json& val, const std::string& ref, const json& store,
+        const AsyncApplies& applies, AsyncPending& pending) {
+      const json& name = M_VAL == inj.mode && nullptr != inj.parent ? getprop(*inj.parent, 1) : NONE;
+      AsyncApplies::const_iterator apply = name.is_string() ?
+        applies.find(name.get_ref<const std::string&>()) : applies.end();
+      if(apply == applies.end() || !check_placement(M_VAL, "APPLY", T_list, inj)) {
+        return transform_APPLY(inj, val, ref, store);
+      }
+
+      json child = getprop(*inj.parent, 2);
+      const std::string tkey = pathkey(inj, 2);
+      json* target = ancestor(inj, 2);
+
+      // The store ($TOP, the data) is copied once, for all the handlers.
+      if(nullptr == pending.store) {
+        pending.store.reset(new FrozenJson(store));
+      }
+
+      AsyncJson result = apply->second(inject_child(std::move(child), store, inj), *pending.store);
+
+      // A result ready now is placed now, so handlers that do not wait are synchronous.
+      json out;
+      if(result.ready()) {
+        out = result.get();
+      } else {
+        // The path of the $APPLY list, less the root ($TOP) and the command key.
+        out = async_placeholder(pending.results.size());
+        pending.results.push_back(std::move(result.future()));
+        pending.paths.emplace_back(inj.path.begin() + std::min<size_t>(1, inj.path.size()),
+            inj.path.end() - std::min<size_t>(1, inj.path.size()));
+      }
+
+      // The result replaces the command list as it is, so a null result stays
+      // (setprop would delete it, and shift a list under the injection).
+      json* slot = Injection::slot(target, tkey);
+      if(nullptr != slot) {
+        *slot = out;
+      }
+      inj.keyI = static_cast<int>(inj.keys->size());
+      inj.detached = true;
+
+      return out;
+    }
+
+  }
+
+  // Transform data using spec, as transform does, with `$APPLY` calling the
+  // handler (in applies) its first argument names. A handler that returns a
+  // future does not hold up the transform: its result is left to be placed
+  // once the transform is done, so the other handlers start meanwhile and
+  // run concurrently. The future returned is ready at once if no result was
+  // left. Otherwise its get() waits for those results and places them, so
+  // the output is the one transform would give. Results still to come can be
+  // copied ($EACH, $PACK), but not read by other commands, nor by handlers.
+  // Transform errors are thrown as by transform; a handler's error is
+  // rethrown by get().
+  inline std::future<json> transform_async(const json& data, const json& spec, const AsyncApplies& applies,
+      const InjectDef& injdef = InjectDef()) {
+    VOXGIG_STAT(TRANSFORM);
+
+    std::shared_ptr<Auxiliary::AsyncPending> pending = std::make_shared<Auxiliary::AsyncPending>();
+
+    Injectors commands = injdef.commands;
+    commands["$APPLY"] = [&applies, pending](Injection& inj, const json& val, const std::string& ref, const json& store) {
+      return Auxiliary::transform_APPLY_async(inj, val, ref, store, applies, *pending);
+    };
+
+    json out = CompiledTransform(spec, commands).apply(data, injdef);
+
+    if(pending->results.empty()) {
+      std::promise<json> done;
+      done.set_value(std::move(out));
+      return done.get_future();
+    }
+
+    return std::async(std::launch::deferred, [pending](json out) {
+      Auxiliary::async_place(out, *pending);
+      return out;
+    }, std::move(out));
+  }
+
+  // Incremental injection
+  // =====================
+
+  namespace Auxiliary {
+
+    // A template string that only reads plain store paths, so its output can
+    // be recomputed on its own.
+    struct InjectSlot {
+      WalkPath path;                // Where the string is, in the template and the output.
+      std::string str;
+      std::vector<WalkPath> reads;  // The store paths it references.
+    };
+
+    // The store paths each string of a template reads. A template with any
+    // other reference (commands, relative or special paths, injected keys, or
+    // strings in lists, whose removal shifts their siblings) is not tracked.
+    class InjectDeps {
+      public:
+        explicit InjectDeps(const json& val) {
+          compile_tokens(val, Injectors(), tokens);
+          WalkPath path;
+          tracked = slots_of(val, path, false);
+          if(!tracked) {
+            slots.clear();
+          }
+
+          for(size_t sI = 0; sI < slots.size(); sI++) {
+            for(const WalkPath& read : slots[sI].reads) {
+              std::vector<size_t>& readers = byroot[read[0]];
+              if(readers.empty() || sI != readers.back()) {
+                readers.push_back(sI);
+              }
+            }
+          }
+        }
+
+        // The slots that read a store path at, below or above one of changed,
+        // or false if everything must be recomputed.
+        bool affected(const std::vector<json>& changed, std::vector<size_t>& out) const {
+          if(!tracked) {
+            return false;
+          }
+
+          std::vector<bool> seen(slots.size(), false);
+          for(const json& change : changed) {
+            const Path path(change);
+            if(!path.valid || 0 == path.size()) {
+              return false;
+            }
+
+            hash_table<std::string, std::vector<size_t>>::const_iterator readers = byroot.find(path.parts[0].key);
+            if(readers == byroot.end()) {
+              continue;
+            }
+
+            for(size_t sI : readers->second) {
+              if(seen[sI]) {
+                continue;
+              }
+              for(const WalkPath& read : slots[sI].reads) {
+                if(overlaps(read, path)) {
+                  seen[sI] = true;
+                  out.push_back(sI);
+                  break;
+                }
+              }
+            }
+          }
+
+          return true;
+        }
+
+        std::vector<InjectSlot> slots;
+        InjectTokens tokens;
+        bool tracked = false;
+
+      private:
+        hash_table<std::string, std::vector<size_t>> byroot;
+
+        static bool overlaps(const WalkPath& read, const Path& path) {
+          const size_t common = std::min(read.size(), path.size());
+          for(size_t pI = 0; pI < common; pI++) {
+            if(read[pI] != path.parts[pI].key) {
+              return false;
+            }
+          }
+          return true;
+        }
+
+        bool slots_of(const json& val, WalkPath& path, bool inlist) {
+          if(val.is_object()) {
+            for(json::const_iterator it = val.begin(); it != val.end(); ++it) {
+              if(std::string::npos != it.key().find_first_of("`$")) {
+                return false;
+              }
+              path.push_back(it.key());
+              const bool ok = slots_of(it.value(), path, inlist);
+              path.pop_back();
+              if(!ok) {
+                return false;
+              }
+            }
+          } else if(val.is_array()) {
+            for(size_t i = 0; i < val.size(); i++) {
+              path.push_back(std::to_string(i));
+              const bool ok = slots_of(val[i], path, true);
+              path.pop_back();
+              if(!ok) {
+                return false;
+              }
+            }
+          } else if(val.is_string()) {
+            InjectTokens::const_iterator token = tokens.find(val.get_ref<const std::string&>());
+            if(token == tokens.end()) {
+              return true;
+            } else if(inlist) {
+              return false;
+            }
+
+            InjectSlot slot;
+            slot.path = path;
+            slot.str = val.get<std::string>();
+            for(const InjectRef& ref : token->second.refs) {
+              if(!ref.path.valid || !ref.path.meta.empty() || 0 == ref.path.size()) {
+                return false;
+              }
+              WalkPath read;
+              for(const Path::Part& part : ref.path.parts) {
+                if(Path::KEY != part.kind || part.key.empty() || '$' == part.key[0]) {
+                  return false;
+                }
+                read.push_back(part.key);
+              }
+              slot.reads.push_back(std::move(read));
+            }
+            slots.push_back(std::move(slot));
+          }
+          return true;
+        }
+    };
+
+    // Recompute the affected slots of out, or return false to recompute it all.
+    inline bool inject_update(json& out, const InjectDeps& deps, const json& store, const std::vector<json>& changed) {
+      std::vector<size_t> affected;
+      if(!deps.affected(changed, affected)) {
+        return false;
+      }
+
+      json errs = json::array();
+      for(size_t sI : affected) {
+        const InjectSlot& slot = deps.slots[sI];
+        json val = inject_root(json(slot.str), store, InjectDef(), &errs, nullptr, &deps.tokens);
+
+        if(slot.path.empty()) {
+          out = std::move(val);
+          continue;
+        }
+
+        // The parents of a slot are maps of the template, so are in the output.
+        json* parent = &out;
+        for(size_t pI = 0; pI + 1 < slot.path.size(); pI++) {
+          parent = &(*parent)[slot.path[pI]];
+        }
+        setprop(*parent, Key(slot.path.back()), std::move(val));
+      }
+
+      return true;
+    }
+
+  }
+
+  // An injected template that records which store paths each of its strings
+  // reads, so that after a change to the store, update recomputes only the
+  // strings that read a changed path. Templates with commands, relative or
+  // special paths, injected keys, or references in lists are recomputed in
+  // full on each update (see incremental).
+  class IncrementalInject {
+    public:
+      explicit IncrementalInject(const json& val, const Injectors& commands = Injectors()) :
+        compiled{val, commands}, deps{val} {}
+
+      // Inject the whole template.
+      const json& apply(const json& store) {
+        out = compiled.apply(store);
+        return out;
+      }
+
+      // Recompute the output for a store changed at each of changed (paths
+      // as getpath takes them). Without a prior output, the template is applied.
+      const json& update(const json& store, const std::vector<json>& changed) {
+        if(out.is_null() || !Auxiliary::inject_update(out, deps, store, changed)) {
+          apply(store);
+        }
+        return out;
+      }
+
+      const json& output() const {
+        return out;
+      }
+
+      // Updates recompute only the strings that read a change.
+      bool incremental() const {
+        return deps.tracked;
+      }
+
+    private:
+      CompiledInject compiled;
+      Auxiliary::InjectDeps deps;
+      json out;
+  };
+
+  // As IncrementalInject, for a transform of data: changed are paths into the data.
+  class IncrementalTransform {
+    public:
+      explicit IncrementalTransform(const json& spec, const Injectors& commands = Injectors()) :
+        compiled{spec, commands}, deps{spec} {}
+
+      const json& apply(const json& data) {
+        out = compiled.apply(data);
+        return out;
+      }
+
+      const json& update(const json& data, const std::vector<json>& changed) {
+        // NOTE: Plain references resolve against the data directly (the base
+        // $TOP is not in it), as they do under $TOP in the transform store.
+        if(out.is_null() || !Auxiliary::inject_update(out, deps, data, changed)) {
+          apply(data);
+        }
+        return out;
+      }
+
+      const json& output() const {
+        return out;
+      }
+
+      bool incremental() const {
+        return deps.tracked;
+      }
+
+    private:
+      CompiledTransform compiled;
+      Auxiliary::InjectDeps deps;
+      json out;
+  };
+
+
+  // Validate
+  // ========
+
+  class Validator;
+
+  namespace Auxiliary {
+
+    // Validators of the $ONE alternatives in a schema, by alternative (as JSON).
+    using Alternatives = hash_table<std::string, std::shared_ptr<const Validator>>;
+
+    Injectors validate_commands(const std::shared_ptr<const Alternatives>& alts, const Injectors& commands);
+
+    // Path as a human readable string: keys from start (so 1 skips $TOP),
+    // without the last end keys, joined by ".". An empty path is "<root>".
+    inline std::string pathify(const WalkPath& path, size_t start = 0, size_t end = 0) {
+      if(path.size() <= start + end) {
+        return "<root>";
+      }
+
+      std::string out;
+      for(size_t pI = start; pI + end < path.size(); pI++) {
+        if(path[pI].empty()) {
+          continue;
+        }
+        if(!out.empty()) {
+          out += '.';
+        }
+        for(char c : path[pI]) {
+          if('.' != c) {
+            out += c;
+          }
+        }
+      }
+      return out;
+    }
+
+    // Build a type validation error message.
+    inline std::string invalid_type_msg(const WalkPath& path, const std::string& needtype, int vt, const json& v) {
+      return "Expected " +
+        (1 < path.size() ? "field " + pathify(path, 1) + " to be " : S::empty) +
+        needtype + ", but found " +
+        (v.is_null() ? "no value" : typename_of(vt) + S::viz + stringify(v)) + ".";
+    }
+
+    // Describe alternatives: "`$NAME`" commands are shown as their lowercase name.
+    inline std::string valdesc(const json& tvals) {
+      std::string desc;
+      for(const json& tval : tvals) {
+        desc += (desc.empty() ? "" : ", ") + stringify(tval);
+      }
+
+      std::string out;
+      size_t at = 0;
+      for(size_t open = desc.find("`$"); open != std::string::npos; open = desc.find("`$", open + 1)) {
+        size_t upper = open + 2;
+        while(upper < desc.size() && 'A' <= desc[upper] && desc[upper] <= 'Z') {
+          upper++;
+        }
+        if(open + 2 < upper && upper < desc.size() && '`' == desc[upper]) {
+          out.append(desc, at, open - at);
+          out += casefold(desc.substr(open + 2, upper - open - 2), ::tolower);
+          at = upper + 1;
+        }
+      }
+      out.append(desc, at, std::string::npos);
+
+      return out;
+    }
+
+    // The value at key in the data parent is a (JSON) null, rather than absent.
+    inline bool isnullprop(const json& parent, const std::string& key) {
+      if(parent.is_object()) {
+        json::const_iterator it = parent.find(key);
+        return it != parent.end() && it->is_null();
+      }
+
+      int index;
+      return parent.is_array() && ::Auxiliary::parse_index(key, index) &&
+        index < static_cast<int>(parent.size()) && parent[index].is_null();
+    }
+
+    // The validate_* functions are the validation commands (see Injector).
+
+    // A required string value. NOTE: Rejects empty strings.
+    inline json validate_STRING(Injection& inj, const json&, const std::string&, const json&) {
+      const json& out = getprop(*inj.dparent, inj.key);
+
+      const int t = typify(out);
+      if(0 == (T_string & t)) {
+        inj.errs->push_back(invalid_type_msg(inj.path, S::string_s, t, out));
+        return NONE;
+      }
+
+      if(out.get_ref<const std::string&>().empty()) {
+        inj.errs->push_back("Empty string at " + pathify(inj.path, 1));
+        return NONE;
+      }
+
+      return out;
+    }
+
+    // A value of type tname, resolved to its type bit when the command table is built.
+    inline Injector validate_TYPE(const std::string& tname) {
+      const int typev = 1 << (31 - static_cast<int>(std::find(TYPENAME, TYPENAME + TYPENAME_LEN, tname) - TYPENAME));
+
+      return [typev, tname](Injection& inj, const json&, const std::string&, const json&) -> json {
+        const json& out = getprop(*inj.dparent, inj.key);
+
+        // NOTE: A null in the data is also absent (and so nil); it is still a null.
+        const int t = typify(out) | (isnullprop(*inj.dparent, inj.key) ? T_null : 0);
+        if(0 == (t & typev)) {
+          inj.errs->push_back(invalid_type_msg(inj.path, tname, t, out));
+          return NONE;
+        }
+
+        return out;
+      };
+    }
 
-    if(path == nullptr) {
-      path = json::array();
+    // Allow any value.
+    inline json validate_ANY(Injection& inj, const json&, const std::string&, const json&) {
+      return getprop(*inj.dparent, inj.key);
     }
 
-    if(isnode({ val })) {
-      json _items = items({ val });
+    // Specify child values for map or list.
+    // Map syntax: {'`$CHILD`': child-template }
+    // List syntax: ['`$CHILD`', child-template ]
+    inline json validate_CHILD(Injection& inj, const json&, const std::string&, const json&) {
+      // Map syntax: a clone of the template for each data key.
+      if(M_KEYPRE == inj.mode) {
+        const json childtm = getprop(*inj.parent, inj.key);
+
+        // Get corresponding current object.
+        const json& tval = getprop(*inj.dparent, pathkey(inj, 2));
+
+        if(!tval.is_null() && !ismap(tval)) {
+          WalkPath ppath(inj.path.begin(), inj.path.end() - 1);
+          inj.errs->push_back(invalid_type_msg(ppath, S::object, typify(tval), tval));
+          return NONE;
+        }
+
+        if(ismap(tval)) {
+          for(json::const_iterator it = tval.begin(); it != tval.end(); ++it) {
+            setprop(*inj.parent, it.key(), childtm);
 
-      for(json::iterator item = _items.begin(); item != _items.end(); item++) {
-        json value = item.value();
-        json ckey = value[0];
-        json child = value[1];
+            // NOTE: This extends the child value loop in inject.
+            inj.keys->push_back(it.key());
+          }
+        }
+
+        // Remove $CHILD to cleanup output.
+        inj.setval(NONE);
+        return NONE;
+      }
 
-        json _path = json::array();
-        for(json::iterator p = path.begin(); p != path.end(); p++) {
-          _path.push_back(p.value());
+      // List syntax: a clone of the template for each data element.
+      if(M_VAL == inj.mode) {
+        if(!islist(*inj.parent)) {
+          // $CHILD was not inside a list.
+          inj.errs->push_back("Invalid $CHILD as value");
+          return NONE;
         }
 
-        /*
-        std::cout << "_path:: " << _path << std::endl;
-        std::cout << path << std::endl;
-        std::cout << "ckey:: " << ckey << std::endl;
-        std::cout << "child:: " << child << std::endl;
-        */
+        const json childtm = getprop(*inj.parent, 1);
+        const json& dlist = *inj.dparent;
 
-        try {
-          _path.push_back(ckey.get<std::string>());
-        } catch(const json::exception&) {
-          _path.push_back(ckey.dump());
+        if(dlist.is_null()) {
+          // Empty list as default.
+          inj.parent->clear();
+          return NONE;
         }
 
-        // NOTE: MUST DO "val = setprop(...)" since val as an argument is deep-copied. In other words, reference counting is not supported.
-        val = setprop({ val, ckey, walk({ child, apply, ckey, val, _path})});
+        if(!islist(dlist)) {
+          WalkPath ppath(inj.path.begin(), inj.path.end() - 1);
+          inj.errs->push_back(invalid_type_msg(ppath, S::list, typify(dlist), dlist));
+          inj.keyI = static_cast<int>(inj.parent->size());
+          return dlist;
+        }
+
+        // Restart the child loop over the clones, so that every element
+        // (including the first) is validated against the template.
+        json::array_t& list = *inj.parent->get_ptr<json::array_t*>();
+        list.assign(dlist.size(), childtm);
+        inj.keys->clear();
+        for(size_t i = 0; i < dlist.size(); i++) {
+          inj.keys->push_back(std::to_string(i));
+        }
+        inj.keyI = -1;
 
+        return SKIP;
       }
 
+      return NONE;
     }
 
-    // Nodes are applied *after* their children.
-    // For the root node, key and parent will be UNDEF.
-    return _apply->operator()({ key, val, parent, path });
-  }
+    // The shared checks of $ONE and $EXACT. Replaces the command list with
+    // the data value, and returns the alternatives, or false on error.
+    inline bool validate_alternatives(Injection& inj, const std::string& name, json& tvals) {
+      if(!islist(*inj.parent) || 0 != inj.keyI) {
+        inj.errs->push_back("The $" + name + " validator at field " + pathify(inj.path, 1, 1) +
+            " must be the first element of an array.");
+        return false;
+      }
 
-  json merge(args_container&& args) {
-    /*
-      Merge a list of values into each other. Later values have
-      precedence.  Nodes override scalars. Node kinds (list or map)
-      override each other, and do *not* merge.  The first element is
-      modified.
-    */
+      inj.keyI = static_cast<int>(inj.keys->size());
 
-    json objs = args.size() == 0 ? nullptr : std::move(args[0]);
+      tvals = json::array();
+      for(size_t tI = 1; tI < inj.parent->size(); tI++) {
+        tvals.push_back((*inj.parent)[tI]);
+      }
 
-    if(islist({objs}) == false) {
-      return objs;
-    }
-    if(objs.size() == 0) {
-      return nullptr;
+      // Clean up structure, replacing [$NAME, ...] with the current data.
+      inj.setval(*inj.dparent, 2);
+      inj.detached = true;
+
+      inj.path.pop_back();
+      inj.key = inj.path.back();
+
+      if(tvals.empty()) {
+        inj.errs->push_back("The $" + name + " validator at field " + pathify(inj.path, 1, 1) +
+            " must have at least one argument.");
+        return false;
+      }
+
+      return true;
     }
-    if(objs.size() == 1) {
-      return objs[0];
+
+    // Match at least one of the specified shapes.
+    // Syntax: ['`$ONE`', alt0, alt1, ...]
+    // Declared here, defined once Validator is.
+    json validate_ONE(Injection& inj, const Alternatives& alts, const Injectors& commands);
+
+    // Match exactly one of the specified values.
+    // Syntax: ['`$EXACT`', val0, val1, ...]
+    inline json validate_EXACT(Injection& inj, const json&, const std::string&, const json&) {
+      // Only operate in val mode, since parent is a list.
+      if(M_VAL != inj.mode) {
+        delprop(*inj.parent, inj.key);
+        return NONE;
+      }
+
+      json tvals;
+      if(!validate_alternatives(inj, "EXACT", tvals)) {
+        return NONE;
+      }
+
+      for(const json& tval : tvals) {
+        if(tval == *inj.dparent) {
+          return NONE;
+        }
+      }
+
+      // There was no match.
+      inj.errs->push_back(invalid_type_msg(inj.path,
+            (1 < inj.path.size() ? "" : "value ") + std::string("exactly equal to ") +
+            (1 == tvals.size() ? "" : "one of ") + valdesc(tvals),
+            typify(*inj.dparent), *inj.dparent));
+
+      return NONE;
     }
 
-    json out = json::object();
+    // The modify function of a validation: checks each value of the spec
+    // against the data value in the same place. Runs *after* any commands.
+    inline void validation(const json& pval, const std::string& key, json& parent, Injection& inj, const json&) {
+      if(SKIP == pval) {
+        return;
+      }
+
+      // select needs exact matches
+      const bool exact = nullptr != inj.meta && true == getprop(*inj.meta, S::BEXACT);
+
+      // Current val to verify.
+      const json& cval = getprop(*inj.dparent, key);
+
+      if(!exact && cval.is_null()) {
+        return;
+      }
+
+      const int ptype = typify(pval);
+
+      // Delete any special commands remaining.
+      if(0 != (T_string & ptype) && std::string::npos != pval.get_ref<const std::string&>().find('$')) {
+        return;
+      }
+
+      const int ctype = typify(cval);
+
+      // Type mismatch.
+      if(ptype != ctype && !pval.is_null()) {
+        inj.errs->push_back(invalid_type_msg(inj.path, typename_of(ptype), ctype, cval));
+        return;
+      }
+
+      if(ismap(cval)) {
+        if(!ismap(pval)) {
+          inj.errs->push_back(invalid_type_msg(inj.path, typename_of(ptype), ctype, cval));
+          return;
+        }
 
-    for(int i = 0; i < objs.size(); i++) {
-      out.merge_patch(objs[i]);
+        // Empty spec object {} means object can be open (any keys).
+        if(!pval.empty() && true != getprop(pval, S::BOPEN)) {
+          std::string badkeys;
+          for(json::const_iterator it = cval.begin(); it != cval.end(); ++it) {
+            if(!pval.contains(it.key())) {
+              badkeys += (badkeys.empty() ? "" : ", ") + it.key();
+            }
+          }
+
+          // Closed object, so reject extra keys not in shape.
+          if(!badkeys.empty()) {
+            inj.errs->push_back("Unexpected keys at field " + pathify(inj.path, 1) + S::viz + badkeys);
+          }
+        } else {
+          // Object is open, so merge in extra keys.
+          // NOTE: pval refers to node, and is not used once node is moved.
+          json* node = Injection::slot(&parent, key);
+          *node = merge(json::array({ std::move(*node), cval }));
+          delprop(*node, S::BOPEN);
+        }
+      } else if(islist(cval)) {
+        if(!islist(pval)) {
+          inj.errs->push_back(invalid_type_msg(inj.path, typename_of(ptype), ctype, cval));
+        }
+      } else if(exact) {
+        if(cval != pval) {
+          const std::string pathmsg = 1 < inj.path.size() ? "at field " + pathify(inj.path, 1) + S::viz : S::empty;
+          inj.errs->push_back("Value " + pathmsg + jsstring(cval) + " should equal " + jsstring(pval) + ".");
+        }
+      } else {
+        // Spec value was a default, copy over data.
+        setprop(parent, key, cval);
+      }
     }
 
-    /*
-    if(islist({objs}) == false) {
-      return objs;
+    // The inject handler of a validation: meta path references
+    // ("`name$=path`" for an exact value, "`name$~path`" for a
+    // value of the same type) set the spec value, which is then
+    // validated from the start of the parent.
+    inline json validate_handler(Injection& inj, const json& val, const Injector* cmd, const std::string& ref, const json& store) {
+      const size_t ds = ref.find('$');
+      if(std::string::npos != ds && 0 < ds && ds + 2 < ref.size() &&
+          ('=' == ref[ds + 1] || '~' == ref[ds + 1])) {
+        inj.setval('=' == ref[ds + 1] ? json::array({ S::BEXACT, val }) : val);
+        inj.keyI = -1;
+        return SKIP;
+      }
+
+      return inject_handler(inj, val, cmd, ref, store);
     }
-    if(objs.size() == 0) {
-      return nullptr;
+
+  }
+
+  // A validation schema compiled for repeated use. Type commands are
+  // resolved to their bitfield constants, and each $ONE alternative is
+  // compiled to a nested Validator, when the schema is compiled.
+  //
+  // Validation follows the "by example" principle: plain data in the schema
+  // is a default value that also specifies the required type. Thus {a:1}
+  // validates {a:2}, but not {a:'A'}, and against {} gives {a:1}. Commands
+  // ($STRING, $NUMBER, $CHILD, $ONE, $EXACT, ...) specify required values.
+  // Maps are closed unless empty or marked with "`$OPEN`": true.
+  class Validator {
+    public:
+      // commands adds to (or overrides) the validation commands.
+      explicit Validator(const json& schema, const Injectors& commands = Injectors()) :
+        alts{compile(schema, commands)},
+        transform{schema, Auxiliary::validate_commands(alts, commands)} {}
+
+      // Validate data (not modified), returning it with any defaults from the schema.
+      // Throws the errors, joined by " | ". Validation stops once max_errors
+      // errors are found (0: no limit).
+      json check(const json& data, size_t max_errors = 0) const {
+        InjectDef injdef;
+        injdef.maxerrs = max_errors;
+        return check(data, injdef);
+      }
+
+      // As above, with errors collected in injdef.errs (if given), and
+      // injdef.maxerrs, meta and extra applied.
+      json check(const json& data, const InjectDef& injdef) const {
+        json meta = json::object();
+        json errs = json::array();
+
+        InjectDef vdef;
+        vdef.meta = nullptr != injdef.meta && ismap(*injdef.meta) ? injdef.meta : &meta;
+        vdef.errs = nullptr != injdef.errs ? injdef.errs : &errs;
+        vdef.extra = injdef.extra;
+        vdef.modify = Auxiliary::validation;
+        vdef.handler = Auxiliary::validate_handler;
+        vdef.maxerrs = injdef.maxerrs;
+
+        if(!vdef.meta->contains(S::BEXACT)) {
+          (*vdef.meta)[S::BEXACT] = false;
+        }
+
+        json out = transform.apply(data, vdef);
+
+        if(nullptr == injdef.errs && !errs.empty()) {
+          if(0 < injdef.maxerrs && injdef.maxerrs < errs.size()) {
+            errs.erase(errs.begin() + injdef.maxerrs, errs.end());
+          }
+          throw std::runtime_error(join(errs, " | "));
+        }
+
+        return out;
+      }
+
+    private:
+      std::shared_ptr<const Auxiliary::Alternatives> alts;
+      CompiledTransform transform;
+
+      static std::shared_ptr<const Auxiliary::Alternatives> compile(const json& schema, const Injectors& commands) {
+        std::shared_ptr<Auxiliary::Alternatives> alts = std::make_shared<Auxiliary::Alternatives>();
+        alternatives(schema, commands, *alts);
+        return alts;
+      }
+
+      static void alternatives(const json& val, const Injectors& commands, Auxiliary::Alternatives& alts) {
+        if(val.is_array() && !val.empty() && S::BONE == val[0]) {
+          // Nested $ONE lists are compiled by the alternative's own Validator.
+          for(size_t tI = 1; tI < val.size(); tI++) {
+            const std::string key = val[tI].dump();
+            if(0 == alts.count(key)) {
+              alts[key] = std::make_shared<const Validator>(val[tI], commands);
+            }
+          }
+        } else if(isnode(val)) {
+          for(const json& child : val) {
+            alternatives(child, commands, alts);
+          }
+        }
+      }
+  };
+
+  // Compile a validation schema (see Validator).
+  inline Validator compile_schema(const json& schema, const Injectors& commands = Injectors()) {
+    return Validator(schema, commands);
+  }
+
+  // Validate data against a schema (see Validator). Errors are thrown,
+  // joined by " | ", unless collected in injdef.errs.
+  inline json validate(const json& data, const json& spec, const InjectDef& injdef = InjectDef()) {
+    VOXGIG_STAT(VALIDATE);
+
+    return Validator(spec, injdef.commands).check(data, injdef);
+  }
+
+  inline json validate(args_container&& args) {
+    return validate(args.size() == 0 ? NONE : args[0], args.size() < 2 ? NONE : args[1]);
+  }
+
+  namespace Auxiliary {
+
+    inline json validate_ONE(Injection& inj, const Alternatives& alts, const Injectors& commands) {
+      // Only operate in val mode, since parent is a list.
+      if(M_VAL != inj.mode) {
+        return NONE;
+      }
+
+      json tvals;
+      if(!validate_alternatives(inj, "ONE", tvals)) {
+        return NONE;
+      }
+
+      // See if we can find a match: one error is enough to reject an alternative.
+      for(const json& tval : tvals) {
+        json terrs = json::array();
+
+        InjectDef tdef;
+        tdef.errs = &terrs;
+        tdef.meta = inj.meta;
+        tdef.maxerrs = 1;
+
+        Alternatives::const_iterator alt = alts.find(tval.dump());
+        if(alt != alts.end()) {
+          alt->second->check(*inj.dparent, tdef);
+        } else {
+          Validator(tval, commands).check(*inj.dparent, tdef);
+        }
+
+        // Accept current value if there was a match.
+        if(terrs.empty()) {
+          return NONE;
+        }
+      }
+
+      // There was no match.
+      inj.errs->push_back(invalid_type_msg(inj.path,
+            (1 < tvals.size() ? "one of " : "") + valdesc(tvals),
+            typify(*inj.dparent), *inj.dparent));
+
+      return NONE;
     }
-    if(objs.size() == 1) {
-      return objs[0];
+
+    inline Injectors validate_commands(const std::shared_ptr<const Alternatives>& alts, const Injectors& commands) {
+      Injectors out = {
+        // Remove the transform commands.
+        { "$DELETE", nullptr },
+        { "$COPY", nullptr },
+        { "$KEY", nullptr },
+        { "$MERGE", nullptr },
+        { "$EACH", nullptr },
+        { "$PACK", nullptr },
+
+        { "$STRING", validate_STRING },
+        { "$ANY", validate_ANY },
+        { "$CHILD", validate_CHILD },
+        { "$ONE", [alts, commands](Injection& inj, const json&, const std::string&, const json&) {
+            return validate_ONE(inj, *alts, commands);
+          } },
+        { "$EXACT", validate_EXACT },
+      };
+
+      for(const std::string& tname : {
+          S::number, S::integer, S::decimal, S::boolean_s, S::null_s, S::nil,
+          S::map, S::list, S::function_s, S::instance }) {
+        out["$" + casefold(tname, ::toupper)] = validate_TYPE(tname);
+      }
+
+      for(const Injectors::value_type& cmd : commands) {
+        out[cmd.first] = cmd.second;
+      }
+
+      return out;
     }
 
-    // Merge a list of values.
-    json out = getprop({ objs, 0, json::object() });
+  }
 
-    for(int i = 1; i < objs.size(); i++) {
-      json& obj = objs[i];
 
-      if(isnode({ obj }) == false) {
-        out = obj;
+  // Select
+  // ======
+
+  namespace Auxiliary {
+
+    // A compiled select query. A map query (NODE) holds its plain keys as fields and its
+    // operators as terms; AND, OR and NOT hold their terms, LIST the list elements.
+    struct SelectTerm {
+      enum Op { EQ, NODE, LIST, AND, OR, NOT, GT, LT, GTE, LTE, LIKE };
+
+      Op op = EQ;
+      json value;                           // EQ and comparisons.
+      std::vector<Key> names;               // NODE: the plain keys of fields.
+      std::vector<SelectTerm> fields;
+      std::vector<SelectTerm> terms;
+      std::shared_ptr<const std::regex> like;
+    };
+
+    inline SelectTerm select_compile(const json& query) {
+      SelectTerm term;
+
+      if(query.is_object()) {
+        term.op = SelectTerm::NODE;
+
+        for(json::const_iterator it = query.begin(); it != query.end(); ++it) {
+          const std::string& key = it.key();
+          const json& val = it.value();
+
+          static const std::map<std::string, SelectTerm::Op> ops = {
+            { "`$AND`", SelectTerm::AND }, { "`$OR`", SelectTerm::OR }, { "`$NOT`", SelectTerm::NOT },
+            { "`$GT`", SelectTerm::GT }, { "`$LT`", SelectTerm::LT },
+            { "`$GTE`", SelectTerm::GTE }, { "`$LTE`", SelectTerm::LTE }, { "`$LIKE`", SelectTerm::LIKE },
+          };
+          std::map<std::string, SelectTerm::Op>::const_iterator op = ops.find(key);
+
+          if(op == ops.end()) {
+            term.names.push_back(Key(key));
+            term.fields.push_back(select_compile(val));
+            continue;
+          }
+
+          SelectTerm opterm;
+          opterm.op = op->second;
+          if(SelectTerm::AND == opterm.op || SelectTerm::OR == opterm.op) {
+            for(const json& sub : islist(val) ? val : json::array()) {
+              opterm.terms.push_back(select_compile(sub));
+            }
+          } else if(SelectTerm::NOT == opterm.op) {
+            opterm.terms.push_back(select_compile(val));
+          } else if(SelectTerm::LIKE == opterm.op) {
+            opterm.like = std::make_shared<const std::regex>(stringify(val));
+          } else {
+            opterm.value = val;
+          }
+          term.terms.push_back(std::move(opterm));
+        }
+      } else if(query.is_array()) {
+        term.op = SelectTerm::LIST;
+        for(const json& sub : query) {
+          term.terms.push_back(select_compile(sub));
+        }
       } else {
+        term.value = query;
+      }
 
-        // Nodes win, also over nodes of a different kind
-        if(isnode({ out }) == false || 
-            (ismap({ obj }).get<bool>() && islist({ obj }).get<bool>()) ||
-            (islist({ obj }).get<bool>() && ismap({ out }).get<bool>())) {
-          out = obj;
-        } else {
+      return term;
+    }
+
+    // Numbers compare with numbers and strings with strings; nothing else is ordered.
+    inline bool select_ordered(const json& a, const json& b) {
+      return (a.is_number() && b.is_number()) || (a.is_string() && b.is_string());
+    }
 
-          json cur = json::array({ out });
-          int cI = 0;
+    // Does point match term? top is the whole query, which matches any child when empty.
+    inline bool select_match(const SelectTerm& term, const json& point, bool top = false) {
+      switch(term.op) {
+        case SelectTerm::EQ:
+          return point == term.value;
 
-          std::cout << "before cI: " << cI << std::endl;
+        case SelectTerm::NODE:
+          // Plain keys (and an empty map, below the top) need a map.
+          if((!term.fields.empty() || (term.terms.empty() && !top)) && !ismap(point)) {
+            return false;
+          }
+          for(size_t fI = 0; fI < term.fields.size(); fI++) {
+            if(!select_match(term.fields[fI], getprop(point, term.names[fI]))) {
+              return false;
+            }
+          }
+          for(const SelectTerm& opterm : term.terms) {
+            if(!select_match(opterm, point)) {
+              return false;
+            }
+          }
+          return true;
 
-          JsonFunction* merger = new JsonFunction([&cur, &cI](args_container&& args) -> json {
-              
-              json key = args.size() == 0 ? nullptr : std::move(args[0]);
-              json val = args.size() < 2 ? nullptr : std::move(args[1]);
-              
-              json parent = args.size() < 3 ? nullptr : std::move(args[2]);
-              json path = args.size() < 4 ? nullptr : std::move(args[3]);
+        case SelectTerm::LIST:
+          if(!islist(point) || point.size() < term.terms.size()) {
+            return false;
+          }
+          for(size_t tI = 0; tI < term.terms.size(); tI++) {
+            if(!select_match(term.terms[tI], point[tI])) {
+              return false;
+            }
+          }
+          return true;
 
+        case SelectTerm::AND:
+          for(const SelectTerm& sub : term.terms) {
+            if(!select_match(sub, point)) {
+              return false;
+            }
+          }
+          return true;
 
-              if(key == nullptr) {
-                return val;
-              }
+        case SelectTerm::OR:
+          for(const SelectTerm& sub : term.terms) {
+            if(select_match(sub, point)) {
+              return true;
+            }
+          }
+          return false;
 
-              int lenpath = path.size();
-              cI = lenpath - 1;
+        case SelectTerm::NOT:
+          return !select_match(term.terms[0], point);
 
-              for(int i = 0; i < 1+cI-cur.size(); i++) {
-                cur.push_back(json(nullptr));
-              }
+        case SelectTerm::GT:
+          return select_ordered(point, term.value) && term.value < point;
 
-              if(cur[cI] == nullptr) {
-                // cur[cI] = get
-              }
+        case SelectTerm::LT:
+          return select_ordered(point, term.value) && point < term.value;
 
-              if(isnode({val}).get<bool>() && !(isempty({ val }).get<bool>())) {
+        case SelectTerm::GTE:
+          return select_ordered(point, term.value) && !(point < term.value);
 
-                for(int i = 0; i < 2+cI+cur.size(); i++) {
-                  cur.push_back(json(nullptr));
-                }
+        case SelectTerm::LTE:
+          return select_ordered(point, term.value) && !(term.value < point);
+
+        case SelectTerm::LIKE:
+          return std::regex_search(stringify(point), *term.like);
+      }
+
+      return false;
+    }
+
+    // A selected child, with its key (or list index) as $KEY.
+    inline void select_push(json& out, const json& child, const json& key) {
+      out.push_back(child);
+      if(ismap(child)) {
+        out.back()[S::DKEY] = key;
+      }
+    }
 
-                cur[cI] = setprop({ cur[cI], key, cur[cI + 1] });
+  }
+
+  // A select query compiled for repeated use. A query is a map of plain keys, each
+  // matching the child's value at that key (recursively for maps and lists, which need
+  // only hold the query's keys and elements; by equality otherwise), and operators:
+  // "`$AND`", "`$OR`" (lists of queries), "`$NOT`" (a query), "`$GT`", "`$LT`", "`$GTE`",
+  // "`$LTE`" (a number or string) and "`$LIKE`" (a regular expression, over the
+  // stringify text). The empty query matches every child.
+  class Selector {
+    public:
+      explicit Selector(const json& query) : root{Auxiliary::select_compile(query)} {}
+
+      bool match(const json& child) const {
+        return Auxiliary::select_match(root, child, true);
+      }
 
-                cur[cI + 1] = json(nullptr);
+      // The matching children of a list or map (values of a map), in order. Map
+      // children are copied with their key (or list index) as $KEY.
+      json select(const json& children) const {
+        VOXGIG_STAT(SELECT);
+        VOXGIG_STAT_NODES(isnode(children) ? children.size() : 0);
 
+        json out = json::array();
 
-              } else {
-                // Scalar child.
-                cur[cI] = setprop({ cur[cI], key, val });
+        if(ismap(children)) {
+          for(json::const_iterator it = children.begin(); it != children.end(); ++it) {
+            if(match(it.value())) {
+              Auxiliary::select_push(out, it.value(), it.key());
+            }
+          }
+        } else if(islist(children)) {
+          for(size_t cI = 0; cI < children.size(); cI++) {
+            if(match(children[cI])) {
+              Auxiliary::select_push(out, children[cI], static_cast<int>(cI));
+            }
+          }
+        }
+
+        return out;
+      }
+
+      // The plain keys of the query compared by equality with a scalar (not null):
+      // children can only match with those values.
+      std::vector<std::pair<const std::string*, const json*>> equalities() const {
+        std::vector<std::pair<const std::string*, const json*>> out;
+        for(size_t fI = 0; fI < root.fields.size(); fI++) {
+          const Auxiliary::SelectTerm& field = root.fields[fI];
+          if(Auxiliary::SelectTerm::EQ == field.op && !field.value.is_null()) {
+            out.push_back({ &root.names[fI].str(), &field.value });
+          }
+        }
+        return out;
+      }
+
+    private:
+      Auxiliary::SelectTerm root;
+  };
+
+  // Select the children of a list or map that match a query (see Selector).
+  // NOTE: The children are not modified: results are copies, with $KEY added to maps.
+  inline json select(const json& children, const json& query) {
+    return Selector(query).select(children);
+  }
+
+  inline json select(args_container&& args) {
+    return select(args.size() == 0 ? NONE : args[0], args.size() < 2 ? NONE : args[1]);
+  }
+
+  namespace Auxiliary {
+
+    // The index key of a value: equal scalars (1 and 1.0 too) have the same key.
+    inline std::string select_index_key(const json& val) {
+      if(val.is_number_float()) {
+        const double d = val.get<double>();
+        if(std::floor(d) == d && std::fabs(d) < 9007199254740992.0) {
+          return std::to_string(static_cast<long long>(d));
+        }
+      }
+      return val.dump();
+    }
+
+  }
+
+  // Records (a list or map) with hash indexes of the values of chosen fields, so that
+  // a select query comparing an indexed field with a scalar only matches the records
+  // holding that value. Records are changed with setprop and delprop, which keep the
+  // indexes current: in place for maps, and for lists when the other records keep
+  // their index (setting an index, or appending). Otherwise the lists are reindexed.
+  class SelectIndex {
+    public:
+      SelectIndex(json records, const std::vector<std::string>& fields) : data(std::move(records)) {
+        for(const std::string& field : fields) {
+          indexes.push_back({ field, Values() });
+        }
+        reindex();
+      }
+
+      const json& records() const {
+        return data;
+      }
+
+      json select(const Selector& query) const {
+        // The smallest candidate set of an indexed equality.
+        const Slots* best = nullptr;
+        for(const std::pair<const std::string*, const json*>& eq : query.equalities()) {
+          for(const FieldIndex& index : indexes) {
+            if(index.field == *eq.first) {
+              Values::const_iterator found = index.values.find(Auxiliary::select_index_key(*eq.second));
+              if(found == index.values.end()) {
+                return json::array();
               }
+              if(nullptr == best || found->second.size() < best->size()) {
+                best = &found->second;
+              }
+            }
+          }
+        }
+
+        if(nullptr == best) {
+          return query.select(data);
+        }
+
+        VOXGIG_STAT(SELECT);
+        VOXGIG_STAT_NODES(best->size());
+
+        json out = json::array();
+        for(const Slot& slot : *best) {
+          const json& child = record(slot);
+          if(query.match(child)) {
+            Auxiliary::select_push(out, child,
+                ismap(data) ? json(slot.second) : json(static_cast<int>(slot.first)));
+          }
+        }
+        return out;
+      }
+
+      json select(const json& query) const {
+        return select(Selector(query));
+      }
 
-              return val;
-          });
+      // Set (with null, delete) a record, as setprop does.
+      void setprop(const Key& key, json record) {
+        int index;
+        if(!key.iskey()) {
+          return;
+        } else if(record.is_null()) {
+          delprop(key);
+          return;
+        }
+
+        if(ismap(data)) {
+          const Slot slot(0, key.str());
+          unindex(slot);
+          VoxgigStruct::setprop(data, key, std::move(record));
+          add(slot);
+        } else if(islist(data) && key.listindex(index)) {
+          if(0 <= index) {
+            const Slot slot(std::min(static_cast<size_t>(index), data.size()), S::empty);
+            if(slot.first < data.size()) {
+              unindex(slot);
+            }
+            VoxgigStruct::setprop(data, key, std::move(record));
+            add(slot);
+          } else {
+            VoxgigStruct::setprop(data, key, std::move(record));
+            reindex();
+          }
+        }
+      }
+
+      // Delete a record, as delprop does.
+      void delprop(const Key& key) {
+        int index;
+        if(ismap(data)) {
+          unindex(Slot(0, key.str()));
+          VoxgigStruct::delprop(data, key);
+        } else if(islist(data) && key.listindex(index) && 0 <= index && index < static_cast<int>(data.size())) {
+          VoxgigStruct::delprop(data, key);
+          reindex();
+        }
+      }
+
+      size_t size() const {
+        return isnode(data) ? data.size() : 0;
+      }
+
+    private:
+      // A record: list index, or map key. Sets of slots keep the records' order.
+      using Slot = std::pair<size_t, std::string>;
+      using Slots = std::set<Slot>;
+      using Values = std::unordered_map<std::string, Slots>;
 
-          walk({ obj, reinterpret_cast<intptr_t>(merger) });
+      struct FieldIndex {
+        std::string field;
+        Values values;
+      };
 
-          std::cout << "after cI: " << cI << std::endl;
+      json data;
+      std::vector<FieldIndex> indexes;
 
-          delete merger;
+      const json& record(const Slot& slot) const {
+        return ismap(data) ? getprop(data, slot.second) : getprop(data, static_cast<int>(slot.first));
+      }
+
+      void add(const Slot& slot) {
+        const json& rec = record(slot);
+        for(FieldIndex& index : indexes) {
+          const json& val = getprop(rec, index.field);
+          if(!val.is_null() && !isnode(val)) {
+            index.values[Auxiliary::select_index_key(val)].insert(slot);
+          }
+        }
+      }
 
+      void unindex(const Slot& slot) {
+        const json& rec = record(slot);
+        for(FieldIndex& index : indexes) {
+          const json& val = getprop(rec, index.field);
+          if(val.is_null() || isnode(val)) {
+            continue;
+          }
+          Values::iterator found = index.values.find(Auxiliary::select_index_key(val));
+          if(found != index.values.end() && 0 < found->second.erase(slot) && found->second.empty()) {
+            index.values.erase(found);
+          }
+        }
+      }
 
+      void reindex() {
+        for(FieldIndex& index : indexes) {
+          index.values.clear();
+        }
+        if(ismap(data)) {
+          for(json::const_iterator it = data.begin(); it != data.end(); ++it) {
+            add(Slot(0, it.key()));
+          }
+        } else if(islist(data)) {
+          for(size_t rI = 0; rI < data.size(); rI++) {
+            add(Slot(rI, S::empty));
+          }
         }
+      }
+  };
+
+
+  // Batch
+  // =====
+
+  // Options of the batch functions.
+  struct Batch {
+    bool parallel = false;              // Spread the documents over the threads of pool.
+    TaskPool* pool = nullptr;           // Default: the pool of walk_parallel.
+    size_t grain = 8;                   // Documents per task, when parallel.
+    std::vector<json>* errs = nullptr;  // Collect the errors of each document (a list each), rather than throwing.
+  };
+
+  namespace Auxiliary {
+
+    // Call f(dI) for each of n documents. Without errs, the first error is thrown:
+    // in sequence, later documents are not processed.
+    inline void batch_run(size_t n, const Batch& options, const std::function<void(size_t)>& f) {
+      if(nullptr != options.errs) {
+        options.errs->assign(n, json::array());
+      }
 
+      if(!options.parallel) {
+        for(size_t dI = 0; dI < n; dI++) {
+          f(dI);
+        }
+        return;
       }
 
+      const size_t grain = 0 == options.grain ? 1 : options.grain;
+      TaskPool& pool = nullptr == options.pool ? default_pool() : *options.pool;
+      pool.run((n + grain - 1) / grain, [n, grain, &f](size_t cI) {
+        for(size_t dI = cI * grain; dI < n && dI < (cI + 1) * grain; dI++) {
+          f(dI);
+        }
+      });
+    }
+
+  }
+
+  // The value at path in each document, as with getpath: a pointer into the
+  // document, or to NONE.
+  inline std::vector<const json*> getpath_batch(const std::vector<json>& docs, const Path& path) {
+    std::vector<const json*> out;
+    out.reserve(docs.size());
+    for(const json& doc : docs) {
+      out.push_back(&getpath(doc, path));
     }
-  */
+    return out;
+  }
+
+  inline std::vector<const json*> getpath_batch(const std::vector<json>& docs, const json& path) {
+    return getpath_batch(docs, Path(path));
+  }
 
+  // Transform each document with a compiled spec, as with CompiledTransform::apply.
+  inline std::vector<json> transform_batch(const std::vector<json>& docs, const CompiledTransform& spec,
+      const Batch& options = Batch()) {
+    std::vector<json> out(docs.size());
+    Auxiliary::batch_run(docs.size(), options, [&](size_t dI) {
+      InjectDef injdef;
+      injdef.errs = nullptr == options.errs ? nullptr : &(*options.errs)[dI];
+      out[dI] = spec.apply(docs[dI], injdef);
+    });
+    return out;
+  }
 
+  // As above, compiling spec once for the batch.
+  inline std::vector<json> transform_batch(const std::vector<json>& docs, const json& spec,
+      const Batch& options = Batch()) {
+    return transform_batch(docs, CompiledTransform(spec), options);
+  }
 
+  // Validate each document with a compiled schema, as with Validator::check.
+  inline std::vector<json> validate_batch(const std::vector<json>& docs, const Validator& schema,
+      const Batch& options = Batch()) {
+    std::vector<json> out(docs.size());
+    Auxiliary::batch_run(docs.size(), options, [&](size_t dI) {
+      InjectDef injdef;
+      injdef.errs = nullptr == options.errs ? nullptr : &(*options.errs)[dI];
+      out[dI] = schema.check(docs[dI], injdef);
+    });
     return out;
   }
 
+  // As above, compiling schema once for the batch.
+  inline std::vector<json> validate_batch(const std::vector<json>& docs, const json& schema,
+      const Batch& options = Batch()) {
+    return validate_batch(docs, Validator(schema), options);
+  }
+
+
+  // Registry
+  // ========
+
+  // The struct utilities (the args_container versions), sorted by name.
+  constexpr UtilityEntry STRUCT_UTILITIES[] = {
+    { "clone", clone },
+    { "delprop", delprop },
+    { "escre", escre },
+    { "escurl", escurl },
+    { "getpath", getpath },
+    { "getprop", getprop },
+    { "haskey", haskey },
+    { "inject", inject },
+    { "isempty", isempty },
+    { "isfunc", isfunc<args_container&&> },
+    { "iskey", iskey },
+    { "islist", islist },
+    { "ismap", ismap },
+    { "isnode", isnode },
+    { "items", items },
+    { "join", join },
+    { "joinurl", joinurl },
+    { "keysof", keysof },
+    { "merge", merge },
+    { "select", select },
+    { "setpath", setpath },
+    { "setprop", setprop },
+    { "stringify", stringify },
+    { "strkey", strkey },
+    { "transform", transform },
+    { "validate", validate },
+    { "walk", walk },
+  };
+
+  constexpr size_t STRUCT_UTILITIES_LEN = sizeof(STRUCT_UTILITIES) / sizeof(STRUCT_UTILITIES[0]);
+
+  namespace Auxiliary {
+
+    constexpr int strcmp_c(const char* a, const char* b) {
+      return *a != *b ? (static_cast<unsigned char>(*a) < static_cast<unsigned char>(*b) ? -1 : 1) :
+        0 == *a ? 0 : strcmp_c(a + 1, b + 1);
+    }
+
+    constexpr bool utilities_sorted(size_t i = 1) {
+      return STRUCT_UTILITIES_LEN <= i ||
+        (0 > strcmp_c(STRUCT_UTILITIES[i - 1].name, STRUCT_UTILITIES[i].name) && utilities_sorted(i + 1));
+    }
+
+    // Binary search of [lo, hi).
+    constexpr int utility_index(const char* name, size_t lo, size_t hi) {
+      return hi <= lo ? -1 :
+        0 == strcmp_c(name, STRUCT_UTILITIES[(lo + hi) / 2].name) ? static_cast<int>((lo + hi) / 2) :
+        0 > strcmp_c(name, STRUCT_UTILITIES[(lo + hi) / 2].name) ? utility_index(name, lo, (lo + hi) / 2) :
+        utility_index(name, (lo + hi) / 2 + 1, hi);
+    }
+
+  }
+
+  static_assert(Auxiliary::utilities_sorted(), "STRUCT_UTILITIES must be sorted by name");
+
+  // The index of a struct utility in STRUCT_UTILITIES, or -1. In a constant
+  // expression the name is resolved at compile time:
+  // constexpr int ITEMS = utility_index("items"); STRUCT_UTILITIES[ITEMS].fn(...).
+  constexpr int utility_index(const char* name) {
+    return Auxiliary::utility_index(name, 0, STRUCT_UTILITIES_LEN);
+  }
 
 }
+
+#endif
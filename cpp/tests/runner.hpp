@@ -6,21 +6,43 @@
 #define FOR(entry, OBJ) for(json::iterator entry = OBJ.begin(); entry != OBJ.end(); ++entry)
 
 json fixJSON(const json&);
+void fixJSON_inplace(json&);
+bool matchval(const json&, const std::string&);
+void runner_entry(const json&, const JsonFunction&, bool, function_pointer);
+json runner_shown(const json&, const json&, const char* = nullptr);
 json unfixJSON(const json&); // UNUSED
 
+// Runner settings for the process, from the command line (see runner_options).
+struct RunnerOptions {
+  int repeat = 1; // Run each test set this many times, reporting the throughput.
+};
+
+RunnerOptions& runner_options() {
+  static RunnerOptions options;
+  return options;
+}
+
+// Usage: test.out [--repeat N]
+void runner_options(int argc, char** argv) {
+  for(int aI = 1; aI < argc; aI++) {
+    if(0 == std::strcmp("--repeat", argv[aI]) && aI + 1 < argc) {
+      runner_options().repeat = std::max(1, std::atoi(argv[++aI]));
+    }
+  }
+}
+
 struct RunnerResult {
   using Function = std::function<void(const json&, JsonFunction, json&&)>;
 
-  json spec;
+  // The spec, shared by every runner of it (see runner_load).
+  std::shared_ptr<const json> spec;
   Function runset;
   // TODO: TBD: function_pointer subject
 
   RunnerResult() = default;
 
-  RunnerResult(json&& spec, Function&& runset) : runset{std::move(runset)} {
-    // NOTE: NEVER DO spec{...} in the constructor - it will treat it as an json::array. e.g. evaluates to [spec]
-    this->spec = std::move(spec);
-  }
+  RunnerResult(std::shared_ptr<const json> spec, Function&& runset) :
+    spec{std::move(spec)}, runset{std::move(runset)} {}
 };
 
 
@@ -37,38 +59,50 @@ class assertion_error : public std::exception {
 
 };
 
+// The spec for name in the test file, parsed once per process and then shared.
+// The file is mapped as a LazyJson, so only the spec is parsed.
+std::shared_ptr<const json> runner_load(const std::string& testfile, const std::string& name) {
+  static std::map<std::string, VoxgigStruct::LazyJson> files;
+  static std::map<std::pair<std::string, std::string>, std::shared_ptr<const json>> loaded;
+
+  std::shared_ptr<const json>& spec = loaded[{ testfile, name }];
+  if(nullptr == spec) {
+    VoxgigStruct::LazyJson& alltests = files[testfile];
+    if(!alltests.isvalid()) {
+      alltests = VoxgigStruct::LazyJson::open(testfile);
+    }
+
+    // Attempt to find the requested spec in the JSON
+    VoxgigStruct::LazyJson found = alltests.getprop("primary").getprop(name);
+    if(!found.isvalid()) {
+      found = alltests.getprop(name);
+    }
+    if(!found.isvalid()) {
+      found = alltests;
+    }
+
+    spec = std::make_shared<const json>(found.to_json());
+  }
+
+  return spec;
+}
+
 RunnerResult runner(const std::string& name, const json& store, const std::string& testfile, const Provider& provider) {
 
   using hash_utility = hash_table<std::string, Utility>;
 
   Provider client = provider.test();
 
-  hash_utility utility = client.utility();
+  const hash_utility& utility = client.utility();
 
-  Utility _struct = utility["struct"];
+  const Utility& _struct = utility.at("struct");
 
   function_pointer items = _struct["items"];
   function_pointer stringify = _struct["stringify"];
-  function_pointer clone = _struct["clone"];
-
 
-  // Read and parse the test JSON file
-  std::ifstream f(testfile);
 
-  json alltests = json::parse(f);
-
-  json spec;
-
-  // TODO: Copy by reference the first two conditons
-  // Attempt to find the requested spec in the JSON
-  if(alltests.contains("primary") && alltests["primary"].contains(name)) {
-    spec = alltests["primary"][name];
-  }
-  else if(alltests.contains(name)) {
-    spec = alltests[name];
-  } else {
-    spec = std::move(alltests);
-  }
+  // The test JSON spec, parsed once per process.
+  const std::shared_ptr<const json> spec = runner_load(testfile, name);
 
   // std::cout << "spec DEF: " << (spec["DEF"]) << std::endl;
   /*
@@ -97,7 +131,7 @@ clients[c_name] = provider.test(copts)
     }
 
     // JS: flags["fixjson"] = flags["fixjson"] || true
-    flags["fixjson"] = flags.value("fixjson", true);
+    const bool fixjson = flags.value("fixjson", true);
 
     /*
     // TODO
@@ -106,72 +140,58 @@ clients[c_name] = provider.test(copts)
     }
      */
 
+    static const json noset = json::array();
+    const json& set = testspec.contains("set") ? testspec.at("set") : noset;
+
+    const int repeat = runner_options().repeat;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-    json set = testspec.value("set", json::array());
+    for(int rI = 0; rI < repeat; rI++) {
+      // Each testspec should have a "set" array of test entries
+      for(const json& entry : set) {
+        runner_entry(entry, testsubject, fixjson, stringify);
+      }
+    }
 
-    // Each testspec should have a "set" array of test entries
-    FOR(entry, set) {
-      try {
-        if(!entry->contains("out")) {
-          (*entry)["out"] = nullptr; // OR: entry->at("out") = nullptr;
-        }
+    if(1 < repeat && !set.empty()) {
+      const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+      std::cout << "  " << set.size() << " entries x " << repeat << ": " <<
+        static_cast<long long>(ns / (set.size() * repeat)) << " ns/entry" << std::endl;
+    }
 
-        if(flags["fixjson"] == true) {
-          *entry = fixJSON(*entry);
-        }
+  };
 
-        Provider testclient = client;
-        // TODO
-        /*
+  return RunnerResult(spec, std::move(runset));
+
+}
+
+// Run one test entry, which is shared (a part of the parsed test file): only the
+// arguments and the expected output are copied (fixed, if fixjson). The subject is
+// given the arguments to own, so it may move from or mutate them.
+void runner_entry(const json& entry, const JsonFunction& testsubject, bool fixjson, function_pointer stringify) {
+  json res;
+
+  try {
+    // TODO
+    /*
 # If a particular entry wants to use a different client:
 if 'client' in entry:
 testclient = clients[entry['client']]
 testsubject = testclient.utility()[name]
-         */
+     */
 
-        json args = json::array();
-
-        // TODO: Refactor double lookup
-        // Build up the call arguments
-        if(entry->contains("ctx")) {
-          args = json::array({ (*entry)["ctx"] });
-        } else if(entry->contains("args") && entry->at("args").is_array()) {
-          args = (*entry)["args"];
-        } else {
-          if(entry->contains("in")) {
-            // TODO: Ensure clone. However, it is still cloning by default so we double the memory
-            // args = [clone(entry['in'])] if 'in' in entry else []
-            // json in = (*entry)["in"];
-            args = json::array({ clone({ (*entry)["in"] }) });
-          } else {
-            args = json::array();
-          }
-        }
-
-        if(entry->contains("ctx") || entry->contains("args")) {
-          json first_arg;
-
-         if(args.is_null() || args.size() == 0) {
-           first_arg = nullptr;
-         } 
-
-         if(first_arg.is_object()) {
-           // Deep clone first_arg
-           first_arg = clone({ first_arg });
-         
-           args[0] = first_arg;
-           (*entry)["ctx"] = first_arg;
-
-           if(first_arg.is_object()) {
-             // first_arg["client"] = testclient;
-           }
-         
-         }
-
-        }
+    // Build up the call arguments
+    args_container args;
+    if(entry.contains("ctx")) {
+      args.push_back(entry.at("ctx"));
+    } else if(entry.contains("args") && entry.at("args").is_array()) {
+      args.assign(entry.at("args").begin(), entry.at("args").end());
+    } else if(entry.contains("in")) {
+      args.push_back(entry.at("in"));
+    }
 
-        /*
-        // TODO
+    /*
+    // TODO
 # If we have a context or arguments, we might need to patch them:
 if 'ctx' in entry or 'args' in entry:
 first_arg = None if args is None or 0 == len(args) else args[0]
@@ -184,47 +204,34 @@ entry['ctx'] = first_arg
 if isinstance(first_arg, dict):
 first_arg["client"] = testclient
 first_arg["utility"] = testclient.utility()
-         */
-
-        // std::cout << "json::args: " << args << std::endl;
-
-        json res;
-
-        if(args.is_array()) {
-          res = testsubject(
-            std::move(args.get<std::vector<json>>())
-          );
-        } else {
-          res = testsubject({ std::move(args) });
-        }
-
-        res = fixJSON(res);
-
+     */
 
-        // NOTE: COPY ENFORCED
-        (*entry)["res"] = res;
+    if(fixjson) {
+      for(json& arg : args) {
+        fixJSON_inplace(arg);
+      }
+    }
 
-        if(!entry->contains("match") || entry->contains("out")) {
-          // Remove functions/etc. by JSON round trip - even though "json cleaned_res = res;" is good enough for C++
-          json cleaned_res = json::parse(res.dump());
-          json expected_out = entry->at("out");
+    res = testsubject(std::move(args));
 
-          // cleaned_res = false;
-          // cleaned_res[0];
-          // std::cout << "CHECK: " << (cleaned_res == expected_out) << std::endl;
-          // std::cout << cleaned_res << std::endl;
-          // std::cout << expected_out << std::endl;
+    if(fixjson) {
+      fixJSON_inplace(res);
+    }
 
-          if(cleaned_res != expected_out) {
-            throw assertion_error(
-                "Expected " + expected_out.dump() + " got " + cleaned_res.dump() + "\n" +
-                "Entry: " + entry->dump(2));
-          }
+    json expected_out = entry.contains("out") ? entry.at("out") : json(nullptr);
+    if(fixjson) {
+      fixJSON_inplace(expected_out);
+    }
 
-        }
+    // NOTE: A JSON round trip (as in the other runners) only matters when the values differ.
+    if(res != expected_out && json::parse(res.dump()) != expected_out) {
+      throw assertion_error(
+          "Expected " + expected_out.dump() + " got " + res.dump() + "\n" +
+          "Entry: " + runner_shown(entry, res).dump(2));
+    }
 
-        // TODO
-        /*
+    // TODO
+    /*
 # If we also need to do "match" checks
 if 'match' in entry:
 match(entry['match'], {
@@ -232,82 +239,88 @@ match(entry['match'], {
 'out': entry.get('res'),
 'ctx': entry.get('ctx')
 })
-         */
-
+     */
 
+  } /* catch(const assertion_error& err) {
+       std::cout << err.what() << std::endl; } */
+  catch(const std::exception& err) {
 
-} /* catch(const assertion_error& err) {
-     std::cout << err.what() << std::endl; } */
-catch(const std::exception& err) {
+    json entry_err = entry.value("err", json(nullptr));
 
-  (*entry)["thrown"] = err.what();
-  json entry_err = entry->value("err", json(nullptr));
+    if(entry_err != nullptr) {
+      if(entry_err == true || matchval(entry_err, err.what())) {
+        // TODO
+        /*
+           if 'match' in entry:
+           match(entry['match'], {
+           'in': entry.get('in'),
+           'out': entry.get('res'),
+           'ctx': entry.get('ctx'),
+           'err': str(err)
+           })
+         */
 
-  if(entry_err != nullptr) {
-    // TODO: if entry_err is True or matchval(entry_err, str(err))
-    if(entry_err == true) {
-      // TODO
-      /*
-         if 'match' in entry:
-         match(entry['match'], {
-         'in': entry.get('in'),
-         'out': entry.get('res'),
-         'ctx': entry.get('ctx'),
-         'err': str(err)
-         })
-       */
+        return;
+      } else {
+        throw assertion_error(
+            "ERROR MATCH: [" + stringify({ entry_err }).get<std::string>() + "] <=> [" + err.what() + "]\n" +
+            "Entry: " + runner_shown(entry, res, err.what()).dump(2)
+            );
+      }
 
-      continue;
     } else {
       throw assertion_error(
-          "ERROR MATCH: [" + stringify(entry_err).get<std::string>() + "] <=> [" + err.what() + "]\n" +
-          "Entry: " + entry->dump(2)
-      );
+          std::string(err.what()) + "\n\nENTRY: " + runner_shown(entry, res, err.what()).dump(2));
     }
 
-
-  } else {
-    throw assertion_error(
-        std::string(err.what()) + "\n\nENTRY: " + entry->dump(2));
   }
-
 }
 
+// The entry as shown in a failure: with the result, and what was thrown.
+json runner_shown(const json& entry, const json& res, const char* thrown) {
+  json shown = entry;
+  shown["res"] = res;
+  if(nullptr != thrown) {
+    shown["thrown"] = thrown;
+  }
+  return shown;
 }
 
-};
-
-
+// A string check matches if it is contained in base (ignoring case), or as /regex/.
+bool matchval(const json& check, const std::string& base) {
+  if(!check.is_string()) {
+    return false;
+  }
 
+  const std::string& str = check.get_ref<const std::string&>();
 
-RunnerResult out = RunnerResult(
-    std::move(spec), 
-    std::move(runset));
+  if(2 < str.size() && '/' == str.front() && '/' == str.back()) {
+    return std::regex_search(base, std::regex(str.substr(1, str.size() - 2)));
+  }
 
-return out;
+  std::string lbase = base;
+  std::string lcheck = str;
+  std::transform(lbase.begin(), lbase.end(), lbase.begin(), ::tolower);
+  std::transform(lcheck.begin(), lcheck.end(), lcheck.begin(), ::tolower);
 
+  return std::string::npos != lbase.find(lcheck);
 }
 
-json fixJSON(const json& obj) {
+// Replace nulls with "__NULL__", in place: only the nulls are rebuilt.
+void fixJSON_inplace(json& obj) {
   if(obj.is_null()) {
-    return "__NULL__";
-  } else if(obj.is_array()) {
-    json arr = json::array();
-    for(json::const_iterator item = obj.begin(); item != obj.end(); item++) {
-      arr.push_back(
-          fixJSON(item.value()));
-    }
-    return arr;
-  } else if(obj.is_object()) {
-    json _obj = json::object();
-    for(json::const_iterator item = obj.begin(); item != obj.end(); item++) {
-      _obj[item.key()] = fixJSON(item.value());
+    obj = "__NULL__";
+  } else if(obj.is_structured()) {
+    for(json& item : obj) {
+      fixJSON_inplace(item);
     }
-    return _obj;
-  } else {
-    return obj;
   }
+}
 
+json fixJSON(const json& obj) {
+  json fixed = obj;
+  fixJSON_inplace(fixed);
+  return fixed;
 }
 
 
@@ -4,6 +4,7 @@
 #include <nlohmann/json.hpp>
 
 #include <voxgig_struct.hpp>
+#include <voxgig_lazy.hpp>
 #include <runner.hpp>
 
 
@@ -14,54 +15,6 @@
 
 using namespace VoxgigStruct;
 
-inline void Utility::set_key(const std::string& key, function_pointer p) {
-  table[key] = p;
-}
-
-inline function_pointer& Utility::get_key(const std::string& key) {
-  return table[key];
-}
-
-inline function_pointer& Utility::operator[](const std::string& key) {
-  return get_key(key);
-}
-
-inline void Utility::set_table(hash_table<std::string, function_pointer>&& new_table) {
-  table = std::move(new_table);
-}
-
-struct Struct : public Utility {
-
-  Struct() {
-    set_table({
-        { "isnode", isnode },
-        { "ismap",  ismap  },
-        { "islist", islist },
-        { "iskey", iskey },
-        { "isempty", isempty },
-        { "isfunc", isfunc<args_container&&> },
-        { "getprop", getprop },
-        { "keysof", keysof },
-        { "haskey", haskey },
-        { "items", items },
-        { "escre", escre },
-        { "joinurl", joinurl },
-        { "stringify", stringify },
-        { "clone", clone },
-        { "setprop", setprop },
-
-        { "walk", walk },
-        { "merge", merge },
-
-    });
-
-  }
-
-  ~Struct() = default;
-
-};
-
-
 // NOTE: More dynamic approach compared to function overloading
 Provider::Provider(const json& opts = nullptr) {
   // Do opts
@@ -76,82 +29,112 @@ Provider Provider::test(void) {
 }
 
 
-hash_table<std::string, Utility> Provider::utility() {
-  return { 
-    {
-      "struct", Struct()
-    }
+const hash_table<std::string, Utility>& Provider::utility() const {
+  static const hash_table<std::string, Utility> utilities = {
+    { "struct", Utility(STRUCT_UTILITIES) },
   };
 
+  return utilities;
 }
 
-json walkpath(args_container&& args) {
-  json _key = args.size() == 0 ? nullptr : std::move(args[0]);
-  json val = args.size() < 2 ? nullptr : std::move(args[1]);
-  json _parent = args.size() < 3 ? nullptr : std::move(args[2]);
-  json path = args.size() < 4 ? nullptr : std::move(args[3]);
+std::string pathify(const WalkPath& path) {
+  if(path.empty()) {
+    return "<root>";
+  }
 
-  if(val.is_string()) {
-    std::string out = val.get<std::string>() + "~";
+  std::string out;
+  for(size_t i = 0; i < path.size(); i++) {
+    out += (0 < i ? "." : "") + path[i];
+  }
+  return out;
+}
 
+void walkpath(const std::string&, json& val, const json&, const WalkPath& path) {
+  if(val.is_string()) {
     std::string path_joint;
 
-    int i = 0;
-    int size = path.size();
-
-    // std::cout << "path::: " << path << std::endl;
-
-    for(json::iterator p = path.begin(); p != path.end(); p++, i++) {
-      path_joint += p->get<std::string>();
-
-      if(i < size-1) {
-        path_joint += '.';
-      }
+    for(size_t i = 0; i < path.size(); i++) {
+      path_joint += (0 < i ? "." : "") + path[i];
     }
 
-    out += path_joint;
-
-    // std::cout << "out:: " << out << std::endl;
-
-
+    val = val.get<std::string>() + "~" + path_joint;
+  }
+}
 
-    return out;
+// Replace fixJSON null markers (see runner.hpp).
+void nullModifier(const json& val, const std::string& key, json& parent, Injection&, const json&) {
+  if("__NULL__" == val) {
+    setprop(parent, key, NONE);
+  } else if(val.is_string()) {
+    std::string str = val.get<std::string>();
+    for(size_t at = str.find("__NULL__"); at != std::string::npos; at = str.find("__NULL__", at + 4)) {
+      str.replace(at, 8, "null");
+    }
+    setprop(parent, key, str);
   }
+}
 
-  return val;
+std::string casefold_upper(std::string str) {
+  for(char& c : str) {
+    c = static_cast<char>(::toupper(static_cast<unsigned char>(c)));
+  }
+  return str;
+}
 
-};
+// Usage: out.out [--repeat N] (see runner_options).
+int main(int argc, char** argv) {
 
-int main() {
+  runner_options(argc, argv);
 
   Provider provider = Provider::test();
 
   RunnerResult runparts = runner("struct", {}, "../build/test/test.json", provider);
 
-  json spec = std::move(runparts.spec);
+  const json& spec = *runparts.spec;
   auto runset = runparts.runset;
 
+  const Utility& _struct = provider.utility().at("struct");
+
 
   TEST_SUITE("TEST_STRUCT") {
 
+    TEST_CASE("test_registry") {
+      assert(&provider.utility() == &provider.utility());
+      assert(STRUCT_UTILITIES_LEN == _struct.size());
+
+      for(const UtilityEntry& entry : _struct) {
+        assert(entry.fn == _struct[entry.name]);
+        assert(entry.fn == STRUCT_UTILITIES[utility_index(entry.name)].fn);
+      }
+      assert(nullptr == _struct["nothing"] && nullptr == _struct[""] && -1 == utility_index("zzz"));
+
+      constexpr int ITEMS = utility_index("items");
+      static_assert(0 <= ITEMS, "items is a struct utility");
+      assert(json::array({ json::array({ "0", 1 }) }) == STRUCT_UTILITIES[ITEMS].fn({ json::array({ 1 }) }));
+    }
+
     TEST_CASE("test_minor_isnode") {
-      runset(spec["minor"]["isnode"], isnode, { { "fixjson", false } });
+      runset(spec["minor"]["isnode"], _struct["isnode"], { { "fixjson", false } });
     }
 
     TEST_CASE("test_minor_ismap") {
-      runset(spec["minor"]["ismap"], ismap, { { "fixjson", false } });
+      runset(spec["minor"]["ismap"], _struct["ismap"], { { "fixjson", false } });
     }
 
     TEST_CASE("test_minor_islist") {
-      runset(spec["minor"]["islist"], islist, { { "fixjson", false } });
+      runset(spec["minor"]["islist"], _struct["islist"], { { "fixjson", false } });
     }
 
     TEST_CASE("test_minor_iskey") {
-      runset(spec["minor"]["iskey"], iskey, { { "fixjson", false } });
+      runset(spec["minor"]["iskey"], _struct["iskey"], { { "fixjson", false } });
+    }
+
+    TEST_CASE("test_minor_strkey") {
+      runset(spec["minor"]["strkey"], _struct["strkey"], { { "fixjson", false } });
     }
 
     TEST_CASE("test_minor_isempty") {
-      runset(spec["minor"]["isempty"], isempty, { { "fixjson", false } });
+      runset(spec["minor"]["isempty"], _struct["isempty"], { { "fixjson", false } });
     }
 
     TEST_CASE("test_minor_isfunc") {
@@ -162,116 +145,505 @@ int main() {
           );
     }
 
+    TEST_CASE("test_minor_typename") {
+      JsonFunction typename_wrapper = [](args_container&& args) -> json {
+        return typename_of(args[0].get<int>());
+      };
+
+      runset(spec["minor"]["typename"], typename_wrapper, { { "fixjson", false } });
+
+      static_assert(0 == std::strcmp("map", typename_cstr(T_node | T_map)), "highest bit names the type");
+      static_assert(0 == std::strcmp("any", typename_cstr(0)), "no bits is any");
+      assert(&S::any == &typename_of(T_node >> 1) && "scalar" == typename_of(T_scalar));
+    }
+
+    TEST_CASE("test_minor_typify") {
+      // NOTE: JSON null is absent in C++ (T_noval), so the null entries are skipped.
+      json typify_spec = { { "set", json::array() } };
+      for(const json& entry : spec["minor"]["typify"]["set"]) {
+        if(!getprop(entry, "in").is_null()) {
+          typify_spec["set"].push_back(entry);
+        }
+      }
+
+      JsonFunction typify_wrapper = [](args_container&& args) -> json {
+        return typify(args[0]);
+      };
+
+      runset(typify_spec, typify_wrapper, { { "fixjson", false } });
+      assert(T_noval == typify(NONE) && T_noval == typify(std::nan("")));
+    }
+
     TEST_CASE("test_minor_getprop") {
       JsonFunction getprop_wrapper = [](args_container&& args) -> json {
         json& vin = args[0];
-        // std::cout << "json vin: " << vin << std::endl;
         // NOTE: operator[] is not good (isn't the best lookup) for auxiliary space since it creates an empty entry if the value is not found
-        if(!vin.contains("alt")) {
-          return getprop({
-              vin.value("val", json(nullptr)),
-              vin.value("key", json(nullptr))
-              });
-        } else {
-          return getprop({
-              vin.value("val", json(nullptr)), 
-              vin.value("key", json(nullptr)),
-              vin.value("alt", json(nullptr))
-              });
-        }
+        return getprop(
+            getprop(vin, "val"),
+            getprop(vin, "key"),
+            getprop(vin, "alt"));
       };
 
-      // TODO: Use nullptr for now since we can't have std::function with optional arguments. Instead, we need to rewrite the entire class to implement our own closure and "operator()"
       runset(spec["minor"]["getprop"], getprop_wrapper, nullptr);
     }
 
     TEST_CASE("test_minor_keysof") {
-      runset(spec["minor"]["keysof"], keysof, nullptr);
+      runset(spec["minor"]["keysof"], _struct["keysof"], nullptr);
     }
 
     TEST_CASE("test_minor_haskey") {
-      runset(spec["minor"]["haskey"], haskey, nullptr);
+      JsonFunction haskey_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+        return haskey(getprop(vin, "src"), getprop(vin, "key"));
+      };
+
+      runset(spec["minor"]["haskey"], haskey_wrapper, { { "fixjson", false } });
     }
 
     TEST_CASE("test_minor_items") {
-      runset(spec["minor"]["items"], items, nullptr);
+      runset(spec["minor"]["items"], _struct["items"], nullptr);
+    }
+
+    TEST_CASE("test_minor_items_view") {
+      JsonFunction items_wrapper = [](args_container&& args) -> json {
+        json out = json::array();
+        for(auto item : items_view(args.empty() ? NONE : args[0])) {
+          out.push_back({ item.key, item.val });
+        }
+        return out;
+      };
+
+      JsonFunction keys_wrapper = [](args_container&& args) -> json {
+        json out = json::array();
+        for(const std::string& key : keys_view(args.empty() ? NONE : args[0])) {
+          out.push_back(key);
+        }
+        return out;
+      };
+
+      runset(spec["minor"]["items"], items_wrapper, nullptr);
+      runset(spec["minor"]["keysof"], keys_wrapper, nullptr);
+
+      json list = json::array();
+      for(int i = 0; i < 12; i++) {
+        list.push_back(i);
+      }
+
+      size_t count = 0;
+      for(auto item : items_view(list)) {
+        assert(std::to_string(count++) == item.key);
+        item.val = item.val.get<int>() * 2;
+      }
+      assert(12 == count && 22 == list[11]);
+      assert(items_view(json("scalar")).empty() && 0 == keys_view(NONE).size());
     }
 
     TEST_CASE("test_minor_escre") {
-      runset(spec["minor"]["escre"], escre, nullptr);
+      runset(spec["minor"]["escre"], _struct["escre"], nullptr);
     }
 
     TEST_CASE("test_minor_escurl") {
-      runset(spec["minor"]["escurl"], escurl, nullptr);
+      runset(spec["minor"]["escurl"], _struct["escurl"], nullptr);
     }
 
-    TEST_CASE("test_minor_joinurl") {
-      runset(spec["minor"]["joinurl"], joinurl, { { "fixjson", false } });
+    TEST_CASE("test_minor_byteset") {
+      // Longer than one 16 byte block, with escapes in the first, a later and the last block.
+      const std::string safe = "abcdefghijklmnopqrstuvwxyz-ABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789.~";
+      assert(safe == escurl(safe));
+      assert("%20" + safe + "%2F%C3%A9" + safe + "%00" == escurl(" " + safe + "/\xC3\xA9" + safe + std::string(1, '\0')));
+      const std::string word = "abcdefghijklmnopqrstuvwxyz_ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+      assert("a\\.b\\*" + word + "\\[\\]\\\\" == escre("a.b*" + word + "[]\\"));
+      assert("q" + word + "\\[" + word + "\\^\\$" == escre("q" + word + "[" + word + "^$"));
+      assert("[" + safe + "\\n" + safe + "\\u0001\\\\]" ==
+          stringify(json::array({ safe + "\n" + safe + "\x01\\" })));
+
+      // More runs than the vector scan tests are scanned by table.
+      const VoxgigStruct::Auxiliary::ByteSet many("acegikmoqsuw");
+      const std::string text = safe + safe;
+      assert(text.data() + text.find_first_of("acegikmoqsuw", 28) == many.scan(text.data() + 28, text.data() + text.size()));
+      assert(many.has('w') && !many.has('b'));
+    }
+
+    TEST_CASE("test_minor_join") {
+      JsonFunction join_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+        const json& sep = getprop(vin, "sep");
+        return join(
+            getprop(vin, "val"),
+            sep.is_string() ? sep.get<std::string>() : ",",
+            getprop(vin, "url", false).get<bool>());
+      };
+
+      runset(spec["minor"]["join"], join_wrapper, { { "fixjson", false } });
     }
 
     TEST_CASE("test_minor_stringify") {
       JsonFunction stringify_wrapper = [](args_container&& args) -> json {
         json& vin = args[0];
-        // std::cout << "json vin: " << vin << std::endl;
-        // NOTE: operator[] is not good (isn't the best lookup) for auxiliary space since it creates an empty entry if the value is not found
-        if(!vin.contains("max")) {
-          // NOTE: edge case "{ in: { }, out: '' }"
-          if(vin.contains("val")) {
-            return stringify({
-                vin.value("val", json(nullptr))
-               });
-          } else {
-            return stringify({});
-          }
-        } else {
-          return stringify({
-              vin.value("val", json(nullptr)),
-              vin.value("max", json(nullptr))
-              });
+        // NOTE: edge case "{ in: { }, out: '' }"
+        if(!vin.contains("val")) {
+          return S::empty;
         }
+
+        return stringify(vin["val"], getprop(vin, "max", -1).get<int>());
       };
 
-      // TODO: Use nullptr for now since we can't have std::function with optional arguments. Instead, we need to rewrite the entire class to implement our own closure and "operator()"
       runset(spec["minor"]["stringify"], stringify_wrapper, { { "fixjson", false } });
     }
 
+    TEST_CASE("test_minor_stringify_to") {
+      const json val = { { "b", "q\"\\\n\x01\u00e9" }, { "a", { 1.5, nullptr, false } } };
+
+      std::string dumped = val.dump();
+      dumped.erase(std::remove(dumped.begin(), dumped.end(), '"'), dumped.end());
+      assert(stringify(val) == dumped);
+
+      // Appends, and stops once past maxlen.
+      std::string out = "> ";
+      assert(stringify_to(out, val, 8) == "> {a:[1...");
+
+      json big = json::array();
+      for(int i = 0; i < 10000; i++) {
+        big.push_back({ { "i", i } });
+      }
+      assert(stringify(big, 12) == "[{i:0},{i...");
+
+      std::ostringstream os;
+      stringify_to(os, json::array({ 1, "a" }));
+      assert(os.str() == "[1,a]");
+
+      // Written out in chunks, as the string form would be.
+      for(bool pretty : { false, true }) {
+        std::ostringstream bigos;
+        stringify_to(bigos, big, -1, pretty);
+        assert(bigos.str() == stringify(big, -1, pretty));
+      }
+
+      assert(stringify(json::array({ 1 }), -1, true) ==
+          "\x1b[38;5;81m\x1b[38;5;118m[\x1b[38;5;118m1\x1b[38;5;118m]\x1b[0m");
+    }
+
     TEST_CASE("test_minor_clone") {
-      runset(spec["minor"]["clone"], static_cast<function_pointer>(clone), nullptr);
+      runset(spec["minor"]["clone"], _struct["clone"], nullptr);
     }
 
     TEST_CASE("test_minor_setprop") {
       JsonFunction setprop_wrapper = [](args_container&& args) -> json {
         json& vin = args[0];
-        return setprop({
-            vin.value("parent", json(nullptr)),
-            vin.value("key", json(nullptr)),
-            vin.value("val", json(nullptr))
-            });
+        json parent = vin.value("parent", json(nullptr));
+        return setprop(parent, getprop(vin, "key"), vin.value("val", json(nullptr)));
       };
 
       // TODO: Use nullptr for now since we can't have std::function with optional arguments. Instead, we need to rewrite the entire class to implement our own closure and "operator()"
       runset(spec["minor"]["setprop"], setprop_wrapper, nullptr);
     }
 
+    TEST_CASE("test_minor_delprop") {
+      JsonFunction delprop_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+        json parent = vin.value("parent", json(nullptr));
+        return delprop(parent, getprop(vin, "key"));
+      };
+
+      runset(spec["minor"]["delprop"], delprop_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_minor_key") {
+      KeyTable table;
+
+      JsonFunction getprop_wrapper = [&table](args_container&& args) -> json {
+        json& vin = args[0];
+        return getprop(getprop(vin, "val"), table.key(getprop(vin, "key")), getprop(vin, "alt"));
+      };
+
+      JsonFunction setprop_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+        json parent = vin.value("parent", json(nullptr));
+        return setprop(parent, Key(getprop(vin, "key")), vin.value("val", json(nullptr)));
+      };
+
+      JsonFunction delprop_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+        json parent = vin.value("parent", json(nullptr));
+        return delprop(parent, Key(getprop(vin, "key")));
+      };
+
+      runset(spec["minor"]["getprop"], getprop_wrapper, nullptr);
+      runset(spec["minor"]["setprop"], setprop_wrapper, nullptr);
+      runset(spec["minor"]["delprop"], delprop_wrapper, nullptr);
+
+      const json doc = { { "a", 1 }, { "1", "one" }, { "1.5", "decimal" } };
+      const json list = { "x", "y" };
+      assert(1 == getprop(doc, Key("a")));
+      assert("one" == getprop(doc, Key(1)) && "y" == getprop(list, Key(1)));
+      assert("decimal" == getprop(doc, Key(json(1.5))) && "y" == getprop(list, Key(json(1.5))));
+      assert(getprop(list, Key("a")).is_null() && getprop(doc, Key()).is_null());
+      assert(haskey(doc, table.key("a")) && !haskey(doc, table.key("b")));
+
+      const size_t names = table.size();
+      assert(table.key("a").str() == "a" && &table.key("a").str() == &table.key("a").str());
+      assert(names == table.size());
+
+      json prepend = list;
+      setprop(prepend, Key(-1), "w");
+      assert(json({ "w", "x", "y" }) == prepend);
+    }
+
+    TEST_CASE("test_minor_setpath") {
+      JsonFunction setpath_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+        json store = vin.value("store", json(nullptr));
+        json* parent = setpath(store, getprop(vin, "path"), vin.value("val", json(nullptr)));
+        return nullptr == parent ? NONE : *parent;
+      };
+
+      runset(spec["minor"]["setpath"], setpath_wrapper, { { "fixjson", false } });
+    }
+
     // -------------------------------------------------
     // walk tests
     // -------------------------------------------------
 
+    TEST_CASE("test_walk_log") {
+      json test = clone(spec["walk"]["log"]);
+
+      json log = json::array();
+
+      auto walklog = [&log](const std::string& key, json& val, const json& parent, const WalkPath& path) {
+        log.push_back("k=" + key +
+            ", v=" + stringify(val) +
+            ", p=" + (path.empty() ? S::empty : stringify(parent)) +
+            ", t=" + pathify(path));
+      };
+
+      json val = test["in"];
+      walk(val, nullptr, walklog);
+      assert(log == test["out"]["after"]);
+
+      log = json::array();
+      walk(val, walklog, nullptr);
+      assert(log == test["out"]["before"]);
+
+      log = json::array();
+      walk(val, walklog, walklog);
+      assert(log == test["out"]["both"]);
+    }
+
     TEST_CASE("test_walk_basic") {
-      JsonFunction* _walkpath = new JsonFunction(walkpath);
+      JsonFunction walk_wrapper = [](args_container&& args) -> json {
+        json vin = args.size() == 0 ? nullptr : std::move(args[0]);
+        return walk(vin, walkpath, nullptr);
+      };
+
+      runset(spec["walk"]["basic"], walk_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_walk_depth") {
+      JsonFunction walk_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+
+        json top;
+        json* cur = nullptr;
+
+        auto copy = [&top, &cur](const std::string& key, json& val, const json&, const WalkPath& path) {
+          if(path.empty() || isnode(val)) {
+            json child = islist(val) ? json::array() : json::object();
+            if(path.empty()) {
+              top = std::move(child);
+              cur = &top;
+            } else {
+              cur = &((*cur)[key] = std::move(child));
+            }
+          } else {
+            (*cur)[key] = val;
+          }
+        };
+
+        json src = vin.value("src", json(nullptr));
+        walk(src, copy, nullptr, vin.value("maxdepth", -1));
+        return top;
+      };
+
+      runset(spec["walk"]["depth"], walk_wrapper, { { "fixjson", false } });
+    }
+
+    TEST_CASE("test_walk_copy") {
+      JsonFunction walk_wrapper = [](args_container&& args) -> json {
+        json vin = args.size() == 0 ? nullptr : std::move(args[0]);
+
+        // NOTE: Pointers into the copy stand in for the shared references of the TS version.
+        json top;
+        std::vector<json*> cur;
+
+        auto walkcopy = [&top, &cur](const std::string& key, json& val, const json&, const WalkPath& path) {
+          if(path.empty()) {
+            top = ismap(val) ? json::object() : islist(val) ? json::array() : val;
+            cur.assign(1, &top);
+            return;
+          }
+
+          size_t i = path.size();
+          json& target = *cur[i - 1];
+          json& slot = islist(target) ? target[target.size()] : target[key];
+
+          if(isnode(val)) {
+            slot = ismap(val) ? json::object() : json::array();
+            cur.resize(i + 1);
+            cur[i] = &slot;
+          } else {
+            slot = val;
+          }
+        };
+
+        walk(vin, walkcopy, nullptr);
+        return top;
+      };
+
+      runset(spec["walk"]["copy"], walk_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_walk_parallel") {
+      TaskPool pool(4);
 
-      JsonFunction walk_wrapper = [=](args_container&& args) -> json {
+      JsonFunction walk_wrapper = [&pool](args_container&& args) -> json {
         json vin = args.size() == 0 ? nullptr : std::move(args[0]);
-        return walk({
-            std::move(vin),
-            reinterpret_cast<intptr_t>(_walkpath),
-            });
+        Parallel options;
+        options.pool = &pool;
+        options.threshold = 1;
+        return walk_parallel(vin, walkpath, nullptr, MAXDEPTH, options);
       };
 
-      // TODO: Use nullptr for now since we can't have std::function with optional arguments. Instead, we need to rewrite the entire class to implement our own closure and "operator()"
       runset(spec["walk"]["basic"], walk_wrapper, nullptr);
 
-      delete _walkpath;
+      json doc = json::object();
+      for(int i = 0; i < 40; i++) {
+        doc["k" + std::to_string(i)] = { { "a", { i, "x", { { "b", i } } } }, { "c", nullptr }, { "d", "y" } };
+      }
+
+      // Each top level subtree is applied in the order of walk.
+      std::mutex mutex;
+      std::map<std::string, std::vector<std::string>> logs;
+      auto logger = [&logs, &mutex](std::map<std::string, std::vector<std::string>>& into) {
+        return [&into, &mutex](const std::string&, json& val, const json&, const WalkPath& path) {
+          if(path.empty()) {
+            return;
+          }
+          if(val.is_string()) {
+            val = val.get<std::string>() + "~" + pathify(path);
+          }
+          std::lock_guard<std::mutex> lock(mutex);
+          into[path[0]].push_back(pathify(path));
+        };
+      };
+
+      json sequential = doc;
+      std::map<std::string, std::vector<std::string>> expected;
+      walk(sequential, logger(expected), logger(expected));
+
+      Parallel options;
+      options.pool = &pool;
+      walk_parallel(doc, logger(logs), logger(logs), MAXDEPTH, options);
+      assert(doc == sequential && logs == expected);
+
+      json depth = { { "a", { { "b", 1 } } } };
+      walk_parallel(depth, walkpath, nullptr, 1, options);
+      assert(depth == json({ { "a", { { "b", 1 } } } }));
+    }
+
+    TEST_CASE("test_walk_stream") {
+      // With nodes shown by type, walk_stream logs as walk does.
+      std::vector<std::string> log;
+      auto walklog = [&log](const std::string& key, json& val, const json& parent, const WalkPath& path) {
+        log.push_back("k=" + key +
+            ", v=" + (isnode(val) ? typename_of(typify(val)) : stringify(val)) +
+            ", p=" + (path.empty() ? S::empty : typename_of(typify(parent))) +
+            ", t=" + pathify(path));
+      };
+
+      json doc = spec["walk"]["log"]["in"];
+      doc["z"] = { nullptr, { { "q", { true, 1.5, -2 } } }, json::object() };
+      const std::string text = doc.dump();
+
+      for(int maxdepth : { -1, 0, 1, 2, 3 }) {
+        log.clear();
+        json val = doc;
+        walk(val, walklog, walklog, maxdepth);
+        const std::vector<std::string> expected = log;
+
+        log.clear();
+        walk_stream(text, walklog, walklog, maxdepth);
+        assert(log == expected);
+
+        log.clear();
+        val = doc;
+        walk(val, walklog, nullptr, maxdepth);
+        const std::vector<std::string> before = log;
+
+        log.clear();
+        std::istringstream in(text);
+        walk_stream(in, walklog, nullptr, maxdepth);
+        assert(log == before);
+      }
+
+      // Values at maxdepth are built whole; nodes above it are stubs.
+      std::vector<json> events;
+      walk_stream("{\"events\":[{\"a\":1},{\"a\":[2,{\"b\":3}]}]}",
+          [&events](const std::string&, json& val, const json&, const WalkPath& path) {
+            if(2 == path.size()) {
+              events.push_back(val);
+            } else {
+              assert(isnode(val) && isempty(val));
+            }
+          }, nullptr, 2);
+      assert(events == json::parse("[{\"a\":1},{\"a\":[2,{\"b\":3}]}]").get<std::vector<json>>());
+
+      // A node that before asks for is built, and walked as walk walks it:
+      // whole values and parents below it (only its own parent is a stub).
+      auto wholelog = [&log, &walklog](const std::string& key, json& val, const json& parent, const WalkPath& path) {
+        walklog(key, val, parent, path);
+        if(!path.empty() && "c" == path[0]) {
+          log.back() += ", w=" + stringify(val) + (1 < path.size() ? ", q=" + stringify(parent) : S::empty);
+        }
+      };
+      const std::string asktext = "{\"a\":[{\"b\":1}],\"c\":{\"d\":[2,null],\"e\":{}},\"f\":3}";
+      for(int maxdepth : { -1, 2 }) {
+        log.clear();
+        json val = json::parse(asktext);
+        walk(val, walklog, wholelog, maxdepth);
+        const std::vector<std::string> expected = log;
+
+        log.clear();
+        walk_stream(asktext, [&walklog](const std::string& key, json& v, const json& parent, const WalkPath& path) {
+          walklog(key, v, parent, path);
+          if("c" == key && 1 == path.size()) {
+            v = walk_stream_build();
+          }
+        }, wholelog, maxdepth);
+        assert(log == expected);
+      }
+
+      // A node set to null in before is skipped.
+      std::vector<std::string> paths;
+      walk_stream("{\"a\":{\"b\":[1,{\"c\":2}]},\"d\":[3]}",
+          [&paths](const std::string& key, json& val, const json&, const WalkPath& path) {
+            paths.push_back(pathify(path));
+            if("a" == key) {
+              val = nullptr;
+            }
+          },
+          [&paths](const std::string&, json& val, const json&, const WalkPath& path) {
+            paths.push_back(pathify(path) + (val.is_null() ? "=null" : S::empty));
+          });
+      assert(paths == std::vector<std::string>({
+            "<root>", "a", "a=null", "d", "d.0", "d.0", "d", "<root>" }));
+
+      bool thrown = false;
+      try {
+        walk_stream("{\"a\":[1,}", nullptr, nullptr);
+      } catch(const json::parse_error&) {
+        thrown = true;
+      }
+      assert(thrown);
     }
 
     // -------------------------------------------------
@@ -279,15 +651,998 @@ int main() {
     // -------------------------------------------------
     
     TEST_CASE("test_merge_basic") {
+      json test_data = clone(spec["merge"]["basic"]);
+
+      assert(merge(std::move(test_data["in"])) == test_data["out"]);
+    }
+
+    TEST_CASE("test_merge_cases") {
+      runset(spec["merge"]["cases"], _struct["merge"], nullptr);
+    }
+
+    TEST_CASE("test_merge_array") {
+      runset(spec["merge"]["array"], _struct["merge"], nullptr);
+    }
+
+    TEST_CASE("test_merge_integrity") {
+      runset(spec["merge"]["integrity"], _struct["merge"], nullptr);
+    }
+
+    TEST_CASE("test_merge_depth") {
+      JsonFunction merge_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+        return merge(std::move(vin["val"]), vin.value("depth", MAXDEPTH));
+      };
+
+      runset(spec["merge"]["depth"], merge_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_merge_parallel") {
+      TaskPool pool(4);
+      Parallel options;
+      options.pool = &pool;
+      options.threshold = 0;
+
+      JsonFunction merge_wrapper = [&options](args_container&& args) -> json {
+        return merge_parallel(args.empty() ? json(nullptr) : std::move(args[0]), MAXDEPTH, options);
+      };
+
+      runset(spec["merge"]["cases"], merge_wrapper, nullptr);
+      runset(spec["merge"]["array"], merge_wrapper, nullptr);
+      runset(spec["merge"]["integrity"], merge_wrapper, nullptr);
+
+      json parts = json::array();
+      for(int pI = 0; pI < 4; pI++) {
+        json part = json::object();
+        for(int kI = 0; kI < 50; kI++) {
+          part["k" + std::to_string((pI * 37 + kI) % 120)] = { { "p" + std::to_string(pI), kI }, { "v", { pI } } };
+        }
+        parts.push_back(std::move(part));
+      }
+
+      const json expected = merge(parts);
+      assert(merge_parallel(json(parts), MAXDEPTH, options) == expected);
+      assert(merge_parallel(json(parts), 2, options) == merge(parts, 2));
+      assert(merge_parallel(json(parts), 1, options) == merge(parts, 1));
+    }
+
+
+    // -------------------------------------------------
+    // getpath tests
+    // -------------------------------------------------
+
+    TEST_CASE("test_getpath_basic") {
+      JsonFunction getpath_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+        return getpath(getprop(vin, "store"), getprop(vin, "path"));
+      };
+
+      runset(spec["getpath"]["basic"], getpath_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_getpath_relative") {
+      JsonFunction getpath_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+
+        json dpath = NONE;
+        const json& dpath_s = getprop(vin, "dpath");
+        if(dpath_s.is_string()) {
+          dpath = json::array();
+          for(const Path::Part& part : Path(dpath_s).parts) {
+            dpath.push_back(part.key);
+          }
+        }
+
+        return getpath(getprop(vin, "store"), getprop(vin, "path"),
+            { { "dparent", getprop(vin, "dparent") }, { "dpath", dpath } });
+      };
+
+      runset(spec["getpath"]["relative"], getpath_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_getpath_special") {
+      JsonFunction getpath_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+        return getpath(getprop(vin, "store"), getprop(vin, "path"), getprop(vin, "inj"));
+      };
+
+      runset(spec["getpath"]["special"], getpath_wrapper, nullptr);
+    }
+
+    // -------------------------------------------------
+    // inject tests
+    // -------------------------------------------------
+
+    TEST_CASE("test_inject_basic") {
+      json test_data = clone(spec["inject"]["basic"]);
+
+      assert(inject(test_data["in"]["val"], test_data["in"]["store"]) == test_data["out"]);
+    }
+
+    TEST_CASE("test_inject_string") {
+      JsonFunction inject_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+
+        InjectDef injdef;
+        injdef.modify = nullModifier;
+
+        return inject(getprop(vin, "val"), getprop(vin, "store"), injdef);
+      };
+
+      runset(spec["inject"]["string"], inject_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_inject_deep") {
+      JsonFunction inject_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+        return inject(getprop(vin, "val"), getprop(vin, "store"));
+      };
+
+      runset(spec["inject"]["deep"], inject_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_inject_compiled") {
+      JsonFunction inject_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+
+        InjectDef injdef;
+        injdef.modify = nullModifier;
+
+        // Applied twice: the second use of the compiled template parses nothing.
+        const CompiledInject compiled(getprop(vin, "val"));
+        compiled.apply(getprop(vin, "store"), injdef);
+        return compiled.apply(getprop(vin, "store"), injdef);
+      };
+
+      runset(spec["inject"]["string"], inject_wrapper, nullptr);
+      runset(spec["inject"]["deep"], inject_wrapper, nullptr);
+
+      const CompiledInject page({ { "title", "`t`" }, { "k", "x`a`y`b`" }, { "n", 1 } });
+      assert(2 == page.size());
+      assert(page.apply({ { "t", "T" }, { "a", 1 }, { "b", true } }) ==
+          json({ { "title", "T" }, { "k", "x1ytrue" }, { "n", 1 } }));
+      assert(page.apply({ { "t", 2 } }) == json({ { "title", 2 }, { "k", "xy" }, { "n", 1 } }));
+
+      Injectors commands;
+      commands["$UP"] = [](Injection&, const json&, const std::string&, const json&) -> json { return "UP"; };
+      assert(CompiledInject("`$UP`", commands).apply(json::object()) == "UP");
+    }
+
+
+    // -------------------------------------------------
+    // transform tests
+    // -------------------------------------------------
+
+    JsonFunction transform_wrapper = [](args_container&& args) -> json {
+      json& vin = args[0];
+      return transform(getprop(vin, "data"), getprop(vin, "spec"));
+    };
+
+    TEST_CASE("test_transform_basic") {
+      json test_data = clone(spec["transform"]["basic"]);
+
+      assert(transform(test_data["in"]["data"], test_data["in"]["spec"]) == test_data["out"]);
+    }
+
+    TEST_CASE("test_transform_paths") {
+      runset(spec["transform"]["paths"], transform_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_transform_cmds") {
+      runset(spec["transform"]["cmds"], transform_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_transform_each") {
+      runset(spec["transform"]["each"], transform_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_transform_pack") {
+      runset(spec["transform"]["pack"], transform_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_transform_ref") {
+      runset(spec["transform"]["ref"], transform_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_transform_format") {
+      runset(spec["transform"]["format"], transform_wrapper, { { "fixjson", false } });
+    }
+
+    TEST_CASE("test_transform_apply") {
+      runset(spec["transform"]["apply"], transform_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_transform_modify") {
+      JsonFunction modify_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+
+        InjectDef injdef;
+        injdef.modify = [](const json& val, const std::string& key, json& parent, Injection&, const json&) {
+          if(val.is_string()) {
+            setprop(parent, key, "@" + val.get<std::string>());
+          }
+        };
+
+        return transform(getprop(vin, "data"), getprop(vin, "spec"), injdef);
+      };
+
+      runset(spec["transform"]["modify"], modify_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_transform_extra") {
+      InjectDef injdef;
+      injdef.extra = { { "b", 2 } };
+      injdef.commands["$UPPER"] = [](Injection& inj, const json&, const std::string&, const json&) -> json {
+        return casefold_upper(inj.path.back());
+      };
+
+      assert(transform({ { "a", 1 } }, { { "x", "`a`" }, { "b", "`$COPY`" }, { "c", "`$UPPER`" } }, injdef) ==
+          json({ { "x", 1 }, { "b", 2 }, { "c", "C" } }));
+    }
+
+    TEST_CASE("test_transform_incremental") {
+      const json spec = {
+        { "name", "`user.name`" },
+        { "greeting", "Hello `user.name` of `org`" },
+        { "limits", { { "max", "`conf.limits.max`" }, { "all", "`conf.limits`" }, { "fixed", 1 } } },
+        { "none", "`missing`" },
+      };
+
+      json data = {
+        { "user", { { "name", "Ann" } } },
+        { "org", "Acme" },
+        { "conf", { { "limits", { { "max", 10 }, { "min", 1 } } } } },
+      };
+
+      IncrementalTransform live(spec);
+      assert(live.incremental());
+      assert(live.apply(data) == transform(data, spec));
+
+      data["user"]["name"] = "Bob";
+      assert(live.update(data, { "user.name" }) == transform(data, spec));
+
+      data["conf"]["limits"]["max"] = nullptr;
+      data["conf"]["limits"].erase("max");
+      assert(live.update(data, { json::array({ "conf", "limits", "max" }) }) == transform(data, spec));
+
+      data["conf"] = { { "limits", { { "max", 3 } } } };
+      data["missing"] = { 1, 2 };
+      assert(live.update(data, { "conf", "missing" }) == transform(data, spec));
+
+      // An unrelated change recomputes nothing.
+      data["other"] = 1;
+      const json before = live.output();
+      assert(live.update(data, { "other" }) == before);
+
+      // Commands can not be tracked, so those templates are recomputed in full.
+      const json cmdspec = { { "a", "`$COPY`" }, { "b", "`org`" } };
+      IncrementalTransform full(cmdspec);
+      assert(!full.incremental());
+      full.apply(data);
+      data["a"] = "A";
+      assert(full.update(data, { "a" }) == transform(data, cmdspec));
+
+      const json val = { { "x", "`a.b`" }, { "y", { { "z", "=`c`=" } } } };
+      json store = { { "a", { { "b", 1 } } }, { "c", "C" } };
+      IncrementalInject page(val);
+      assert(page.incremental() && page.update(store, {}) == inject(val, store));
+      store["c"] = true;
+      assert(page.update(store, { "c" }) == inject(val, store));
+      store["a"] = 2;
+      assert(page.update(store, { "a" }) == inject(val, store));
+      assert(!IncrementalInject(json::array({ "`a`" })).incremental());
+    }
+
+    TEST_CASE("test_transform_async") {
+      // Names without a handler fail as in transform.
+      JsonFunction async_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+        return transform_async(getprop(vin, "data"), getprop(vin, "spec"), AsyncApplies()).get();
+      };
+      runset(spec["transform"]["apply"], async_wrapper, nullptr);
+      runset(spec["transform"]["paths"], async_wrapper, nullptr);
+
+      // Handlers that return a value are applied at once.
+      AsyncApplies applies;
+      applies["double"] = [](const json& val, const FrozenJson&) -> AsyncJson { return json(2 * val.get<int>()); };
+      std::future<json> now = transform_async({ { "a", 3 } },
+          { { "x", { "`$APPLY`", "double", "`a`" } }, { "y", "`a`" } }, applies);
+      assert(std::future_status::ready == now.wait_for(std::chrono::seconds(0)));
+      assert(now.get() == json({ { "x", 6 }, { "y", 3 } }));
+
+      // Each lookup waits until all four have started: it completes only if
+      // the transform went on to start the others without waiting for it.
+      TaskPool pool(5);
+      std::mutex mutex;
+      std::condition_variable started;
+      int count = 0;
+      applies["lookup"] = async_apply([&mutex, &started, &count](const json& val, const json& store) -> json {
+        std::unique_lock<std::mutex> lock(mutex);
+        count++;
+        started.notify_all();
+        const bool all = started.wait_for(lock, std::chrono::seconds(10), [&count]() { return 4 <= count; });
+        assert(all);
+        return { { "id", val }, { "n", getpath(store, "$TOP.n") } };
+      }, &pool);
+
+      const json data = { { "ids", { "p", "q", "r" } }, { "n", 1 } };
+      const json aspec = {
+        { "a", { "`$APPLY`", "lookup", "`ids.0`" } },
+        { "b", { { "c", { "`$APPLY`", "lookup", "`ids.1`" } }, { "d", { "`$APPLY`", "double", "`n`" } } } },
+        { "e", { 1, { "`$APPLY`", "lookup", "`ids.2`" } } },
+        { "f", { "`$APPLY`", "lookup", "s" } },
+      };
+      assert(transform_async(data, aspec, applies).get() == json({
+            { "a", { { "id", "p" }, { "n", 1 } } },
+            { "b", { { "c", { { "id", "q" }, { "n", 1 } } }, { "d", 2 } } },
+            { "e", { 1, { { "id", "r" }, { "n", 1 } } } },
+            { "f", { { "id", "s" }, { "n", 1 } } } }));
+
+      // Results are placed without changing the rest of the output: nulls in
+      // the data stay, and a null result keeps its place in a list.
+      applies["echo"] = async_apply([](const json& val, const json&) -> json { return val; }, &pool);
+      const json ndata = { { "a", { { "x", nullptr }, { "y", 1 } } } };
+      json nspec = { { "a", "`a`" }, { "b", { "`$APPLY`", "echo", 2 } } };
+      assert(transform_async(ndata, nspec, applies).get() == json({ { "a", { { "x", nullptr }, { "y", 1 } } }, { "b", 2 } }));
+      assert(transform(ndata, { { "a", "`a`" }, { "b", 2 } }) == json({ { "a", { { "x", nullptr }, { "y", 1 } } }, { "b", 2 } }));
+      nspec = { { "a", "`a`" }, { "l", { 1, { "`$APPLY`", "echo", nullptr }, 4 } } };
+      assert(transform_async(ndata, nspec, applies).get() ==
+          json({ { "a", { { "x", nullptr }, { "y", 1 } } }, { "l", { 1, nullptr, 4 } } }));
+      applies["none"] = [](const json&, const FrozenJson&) -> AsyncJson { return json(nullptr); };
+      nspec = { { "l", { 1, { "`$APPLY`", "none", 0 }, 4 } } };
+      assert(transform_async(ndata, nspec, applies).get() == json({ { "l", { 1, nullptr, 4 } } }));
+
+      // Results in the copies $EACH makes are placed in each copy.
+      const json edata = { { "l", { { { "v", 1 } }, { { "v", 2 } } } } };
+      assert(transform_async(edata, { { "out", { "`$EACH`", "l", { { "w", { "`$APPLY`", "echo", "`.v`" } } } } } },
+            applies).get() == json({ { "out", { { { "w", 1 } }, { { "w", 2 } } } } }));
+
+      // A handler's error is thrown by get().
+      applies["fail"] = async_apply([](const json&, const json&) -> json { throw std::runtime_error("lookup failed"); });
+      std::future<json> failed = transform_async(data, { "`$APPLY`", "fail", 1 }, applies);
+      try {
+        failed.get();
+        assert(false);
+      } catch(const std::runtime_error& err) {
+        assert(std::string("lookup failed") == err.what());
+      }
+    }
+
+    TEST_CASE("test_transform_compiled") {
+      CompiledTransform compiled(json({ { "x", "`a`" }, { "y", "`b.c`" }, { "z", "a`a`" } }));
+
+      for(int i = 0; i < 3; i++) {
+        assert(compiled.apply({ { "a", i }, { "b", { { "c", -i } } } }) ==
+            json({ { "x", i }, { "y", -i }, { "z", "a" + std::to_string(i) } }));
+      }
+
+      // $TOP is found by reference, unless a custom command needs it in the store.
+      const json data = json::parse(R"({"a":{"b":1,"c":[1,2]},"d":[{"e":3},{"e":4}]})");
+      const json spec = json::parse(R"({"a":"`$COPY`","c":{"`$MERGE`":"`a`"},
+        "d":["`$EACH`","d",{"E":"`.e`","B":"`...a.b`"}],"f":["`$REF`","a"]})");
+      const Injectors noop = { { "$NOOP", [](Injection&, const json&, const std::string&, const json&) { return NONE; } } };
+      const json byref = CompiledTransform(spec).apply(data);
+      assert(byref == CompiledTransform(spec, noop).apply(data));
+      assert(byref["d"][1] == json({ { "E", 4 }, { "B", 1 } }));
+      assert(CompiledTransform(json("`$COPY`")).apply(data) == data);
+
+      const Injectors top = { { "$TOPB", [](Injection&, const json&, const std::string&, const json& store) {
+        return getpath(store, "$TOP.a.b"); } } };
+      assert(CompiledTransform(json({ { "x", "`$TOPB`" } }), top).apply(data) == json({ { "x", 1 } }));
+    }
+
+
+
+    // -------------------------------------------------
+    // validate tests
+    // -------------------------------------------------
+
+    JsonFunction validate_wrapper = [](args_container&& args) -> json {
+      json& vin = args[0];
+      return validate(getprop(vin, "data"), getprop(vin, "spec"));
+    };
+
+    TEST_CASE("test_validate_basic") {
+      runset(spec["validate"]["basic"], validate_wrapper, { { "fixjson", false } });
+    }
+
+    TEST_CASE("test_validate_child") {
+      runset(spec["validate"]["child"], validate_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_validate_one") {
+      runset(spec["validate"]["one"], validate_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_validate_exact") {
+      runset(spec["validate"]["exact"], validate_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_validate_invalid") {
+      runset(spec["validate"]["invalid"], validate_wrapper, { { "fixjson", false } });
+    }
+
+    TEST_CASE("test_validate_special") {
+      JsonFunction special_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+        json meta = getprop(getprop(vin, "inj"), "meta");
+
+        InjectDef injdef;
+        injdef.meta = meta.is_null() ? nullptr : &meta;
+
+        return validate(getprop(vin, "data"), getprop(vin, "spec"), injdef);
+      };
+
+      runset(spec["validate"]["special"], special_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_validate_edge") {
+      json errs = json::array();
+      InjectDef injdef;
+      injdef.errs = &errs;
+
+      validate({ { "x", 1 } }, { { "x", "`$INSTANCE`" } }, injdef);
+      assert(errs[0] == "Expected field x to be instance, but found integer: 1.");
+
+      errs = json::array();
+      validate({ { "x", json::object() } }, { { "x", "`$INSTANCE`" } }, injdef);
+      assert(errs[0] == "Expected field x to be instance, but found map: {}.");
+
+      errs = json::array();
+      validate({ { "x", json::array() } }, { { "x", "`$INSTANCE`" } }, injdef);
+      assert(errs[0] == "Expected field x to be instance, but found list: [].");
+    }
+
+    TEST_CASE("test_validate_custom") {
+      json errs = json::array();
+      InjectDef injdef;
+      injdef.errs = &errs;
+      injdef.commands["$INTEGER"] = [](Injection& inj, const json&, const std::string&, const json&) -> json {
+        const json& out = getprop(*inj.dparent, inj.key);
+        if(!out.is_number_integer()) {
+          inj.errs->push_back("Not an integer at " + join(WalkPath(inj.path.begin() + 1, inj.path.end()), ".") +
+              ": " + stringify(out));
+          return NONE;
+        }
+        return out;
+      };
+
+      const json shape = { { "a", "`$INTEGER`" } };
+
+      assert(validate({ { "a", 1 } }, shape, injdef) == json({ { "a", 1 } }));
+      assert(errs.empty());
+
+      assert(validate({ { "a", "A" } }, shape, injdef) == json({ { "a", "A" } }));
+      assert(errs == json::array({ "Not an integer at a: A" }));
+    }
+
+    TEST_CASE("test_validate_compiled") {
+      Validator validator = compile_schema({ { "a", "`$NUMBER`" }, { "b", "`$STRING`" }, { "c", true } });
+
+      for(int i = 0; i < 3; i++) {
+        assert(validator.check({ { "a", i }, { "b", "B" } }) ==
+            json({ { "a", i }, { "b", "B" }, { "c", true } }));
+      }
+
+      json errs = json::array();
+      InjectDef injdef;
+      injdef.errs = &errs;
+
+      validator.check({ { "a", "A" }, { "b", 1 }, { "c", 0 } }, injdef);
+      assert(3 == errs.size());
+
+      // Validation stops once the error budget is spent.
+      errs = json::array();
+      injdef.maxerrs = 1;
+      validator.check({ { "a", "A" }, { "b", 1 }, { "c", 0 } }, injdef);
+      assert(errs == json::array({ "Expected field a to be number, but found string: A." }));
+
+      try {
+        validator.check({ { "a", "A" }, { "b", 1 } }, 1);
+        assert(false);
+      } catch(const std::runtime_error& err) {
+        assert(std::string(err.what()) == "Expected field a to be number, but found string: A.");
+      }
+    }
+
+
+    // -------------------------------------------------
+    // select tests
+    // -------------------------------------------------
+
+    JsonFunction select_wrapper = [](args_container&& args) -> json {
+      json& vin = args[0];
+      return select(getprop(vin, "obj"), getprop(vin, "query"));
+    };
+
+    TEST_CASE("test_select_basic") {
+      runset(spec["select"]["basic"], select_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_select_operators") {
+      runset(spec["select"]["operators"], select_wrapper, nullptr);
+    }
 
-      json test_data = clone({ spec["merge"]["basic"] });
-      // std::cout << test_data << std::endl;
+    TEST_CASE("test_select_edge") {
+      runset(spec["select"]["edge"], select_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_select_alts") {
+      runset(spec["select"]["alts"], select_wrapper, nullptr);
+    }
+
+    TEST_CASE("test_select_index") {
+      // The select specs again, with every queried field indexed.
+      JsonFunction index_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+        const json& query = getprop(vin, "query");
+        return SelectIndex(getprop(vin, "obj"), keysof(query).get<std::vector<std::string>>()).select(query);
+      };
+
+      for(const char* name : { "basic", "operators", "edge", "alts" }) {
+        runset(spec["select"][name], index_wrapper, nullptr);
+      }
+
+      json catalog = json::object();
+      for(int i = 0; i < 100; i++) {
+        catalog["p" + std::to_string(100 + i)] = { { "kind", 0 == i % 10 ? "book" : "pen" }, { "price", i } };
+      }
+
+      SelectIndex index(catalog, { "kind", "price" });
+      const Selector books({ { "kind", "book" }, { "price", { { "`$LT`", 50 } } } });
+      assert(5 == index.select(books).size());
+      assert(index.select(books) == books.select(catalog));
+      assert(index.select(json({ { "kind", "none" } })).empty());
+
+      // Changes keep the indexes current.
+      index.setprop(Key("p110"), { { "kind", "pen" }, { "price", 10 } });
+      index.setprop(Key("p999"), { { "kind", "book" }, { "price", 1.0 } });
+      index.delprop(Key("p100"));
+      json keys = json::array();
+      for(const json& book : index.select(books)) {
+        keys.push_back(book[S::DKEY]);
+      }
+      assert(json::array({ "p120", "p130", "p140", "p999" }) == keys);
+      assert(2 == index.select(json({ { "price", 1 } })).size() && 100 == index.size());
+
+      // List records are reindexed when others move.
+      SelectIndex list(json::array({ { { "k", 1 } }, { { "k", 2 } }, { { "k", 1 } } }), { "k" });
+      list.delprop(Key(0));
+      list.setprop(Key(5), { { "k", 1 } });
+      assert(json::array({ { { "k", 1 }, { S::DKEY, 1 } }, { { "k", 1 }, { S::DKEY, 2 } } }) == list.select(json({ { "k", 1 } })));
+    }
+
+
+    // -------------------------------------------------
+    // batch tests
+    // -------------------------------------------------
+
+    TEST_CASE("test_batch") {
+      std::vector<json> docs;
+      for(int i = 0; i < 50; i++) {
+        docs.push_back({ { "a", { { "b", i } } }, { "c", 0 == i % 7 ? json(i) : json("s" + std::to_string(i)) } });
+      }
+
+      const std::vector<const json*> found = getpath_batch(docs, "a.b");
+      for(size_t dI = 0; dI < docs.size(); dI++) {
+        assert(&docs[dI]["a"]["b"] == found[dI]);
+      }
+      assert(&NONE == getpath_batch(docs, "a.x")[0]);
+
+      const json spec = { { "x", "`a.b`" }, { "y", "`$COPY`" } };
+      const CompiledTransform compiled(spec);
+
+      TaskPool pool(4);
+      Batch parallel;
+      parallel.parallel = true;
+      parallel.pool = &pool;
+      parallel.grain = 3;
+
+      const std::vector<json> out = transform_batch(docs, compiled);
+      assert(out == transform_batch(docs, spec, parallel));
+      for(size_t dI = 0; dI < docs.size(); dI++) {
+        assert(out[dI] == transform(docs[dI], spec));
+      }
+
+      const json schema = { { "a", { { "b", "`$NUMBER`" } } }, { "c", "`$STRING`" } };
+      std::vector<json> errs;
+      parallel.errs = &errs;
+      const std::vector<json> valid = validate_batch(docs, compile_schema(schema), parallel);
+      assert(docs.size() == errs.size() && valid[1] == docs[1]);
+      for(size_t dI = 0; dI < docs.size(); dI++) {
+        assert((0 == dI % 7) == !errs[dI].empty());
+      }
+
+      bool thrown = false;
+      try {
+        validate_batch(docs, schema);
+      } catch(const std::exception& err) {
+        thrown = std::string::npos != std::string(err.what()).find("Expected field c to be string");
+      }
+      assert(thrown);
+    }
+
+    // -------------------------------------------------
+    // arena tests
+    // -------------------------------------------------
+
+    TEST_CASE("test_arena_json") {
+      Arena arena(256);
+      arena_json before = arena_json::array({ "before the scope" });
+
+      {
+        ArenaScope scope(arena);
+        arena_json doc = arena_json::parse("{\"a\":[1,2,{\"b\":\"a string past the short buffer\"}]}");
+        assert(0 < arena.used());
+        assert(doc["a"][2]["b"] == "a string past the short buffer");
+
+        // Heap values are still freed to the heap in scope.
+        before = arena_json::object();
+      }
+
+      arena.reset();
+      assert(0 == arena.used());
+      assert(0 < arena.capacity());
+    }
+
+    TEST_CASE("test_arena_pipeline") {
+      Arena arena;
+      json test_data = clone(spec["transform"]["basic"]);
+
+      for(int i = 0; i < 3; i++) {
+        {
+          ArenaScope scope(arena);
+          json data = clone(test_data["in"]["data"]);
+          json out = transform(data, test_data["in"]["spec"]);
+          assert(out == test_data["out"]);
+#ifdef VOXGIG_STRUCT_ARENA
+          assert(0 < arena.used());
+#endif
+        }
+        arena.reset();
+      }
+    }
+
+    // -------------------------------------------------
+    // shared tests
+    // -------------------------------------------------
+
+    TEST_CASE("test_shared_clone") {
+      const json doc = {
+        { "a", { { "b", { { "c", 1 } } }, { "d", { 1, 2, 3 } } } },
+        { "e", { { "f", "F" } } },
+      };
+
+      SharedJson base(doc);
+      SharedJson copy = clone(base);
+      assert(copy.shares(base));
+
+      copy.setpath("a.b.c", SharedJson(json(2)));
+      copy.setpath("a.x.y", SharedJson(json("Y")));
+      copy.getprop("a").getprop("d").setprop(0, 9);
+
+      assert(base.to_json() == doc);
+      assert(2 == copy.getpath("a.b.c").scalar());
+      assert("Y" == copy.getpath("a.x.y").scalar());
+
+      // Only the spine to each change was copied.
+      assert(!copy.getprop("a").shares(base.getprop("a")));
+      assert(copy.getprop("a").getprop("d").shares(base.getprop("a").getprop("d")));
+      assert(copy.getprop("e").shares(base.getprop("e")));
+
+      copy.getprop("e").delprop("f");
+      copy.setprop("e", json(nullptr));
+      assert(copy.getprop("e").is_null());
+      assert(base.getprop("e").to_json() == doc["e"]);
+
+      SharedJson list(json::array({ 1, 2 }));
+      list.setprop(-1, 0).setprop(5, 3).delprop(1);
+      assert(list.to_json() == json::array({ 0, 2, 3 }));
+      assert(json::array({ "0", "1", "2" }) == list.keysof());
+      assert(!list.setpath("a.b", SharedJson(json(1))));
+    }
+
+    TEST_CASE("test_shared_merge") {
+      JsonFunction merge_wrapper = [](args_container&& args) -> json {
+        if(args.empty()) {
+          return NONE;
+        }
+
+        json& vin = args[0];
+        const json& val = ismap(vin) && vin.contains("val") ? vin["val"] : vin;
+        if(!val.is_array()) {
+          return val;
+        }
+
+        std::vector<SharedJson> vals;
+        for(const json& item : val) {
+          vals.push_back(SharedJson(item));
+        }
+        return merge(vals, ismap(vin) && vin.contains("val") ? vin.value("depth", MAXDEPTH) : MAXDEPTH).to_json();
+      };
 
-      assert(merge({ test_data["in"] }) == test_data["out"]);
+      runset(spec["merge"]["cases"], merge_wrapper, nullptr);
+      runset(spec["merge"]["array"], merge_wrapper, nullptr);
+      runset(spec["merge"]["integrity"], merge_wrapper, nullptr);
+      runset(spec["merge"]["depth"], merge_wrapper, nullptr);
+
+      const json over = { { "b", { { "c", 2 } } } };
+      SharedJson base(json({ { "a", { { "x", 1 } } }, { "b", { { "c", 1 }, { "d", 1 } } } }));
+      SharedJson overlay(over);
+      SharedJson merged = merge({ base, overlay });
+
+      assert(merged.to_json() == json({ { "a", { { "x", 1 } } }, { "b", { { "c", 2 }, { "d", 1 } } } }));
+      assert(merged.getprop("a").shares(base.getprop("a")));
+      assert(1 == base.getpath("b.c").scalar());
+      assert(overlay.to_json() == over);
+    }
+
+    TEST_CASE("test_frozen") {
+      const FrozenJson doc(json({ { "a", { { "b", 1 } } }, { "c", { 2, 3 } } }));
+      assert(&doc.getprop("a") == &doc.value()["a"] && &doc.getpath("c.1") == &doc.value()["c"][1]);
+      assert(doc.getprop("x").is_null() && 1 == doc.getpath(json::array({ "a", "b" })));
+
+      std::vector<std::string> keys;
+      for(const std::string& key : doc.keys()) {
+        keys.push_back(key);
+      }
+      assert(keys == std::vector<std::string>({ "a", "c" }));
+
+      const FrozenJson merged = doc.merge({ { "a", { { "d", 4 } } } });
+      assert(merged.value() == json({ { "a", { { "b", 1 }, { "d", 4 } } }, { "c", { 2, 3 } } }));
+      assert(doc.value() == json({ { "a", { { "b", 1 } } }, { "c", { 2, 3 } } }) && !doc.shares(merged));
+
+      // Readers always see a whole version: each has n, and a list of n items.
+      FrozenSlot slot(FrozenJson(json({ { "n", 0 }, { "items", json::array() } })));
+      std::atomic<bool> done(false);
+      std::atomic<int> reads(0);
+      std::vector<std::thread> readers;
+      for(int rI = 0; rI < 4; rI++) {
+        readers.emplace_back([&slot, &done, &reads]() {
+          int last = 0;
+          while(!done.load()) {
+            const FrozenJson snap = slot.snapshot();
+            const int n = snap.getprop("n").get<int>();
+            assert(static_cast<size_t>(n) == snap.getprop("items").size() && last <= n);
+            last = n;
+            reads++;
+          }
+        });
+      }
+
+      for(int uI = 1; uI <= 200; uI++) {
+        const FrozenJson current = slot.snapshot();
+        json items = current.getprop("items");
+        items.push_back(uI);
+        slot.update({ { "n", uI }, { "items", items } });
+      }
+      done = true;
+      for(std::thread& reader : readers) {
+        reader.join();
+      }
+
+      assert(200 == slot.version() && 200 == slot.snapshot().getprop("n") && 0 < reads.load());
+      slot.publish(doc);
+      assert(slot.snapshot().shares(doc) && 201 == slot.version());
+    }
+
+    // -------------------------------------------------
+    // lazy tests
+    // -------------------------------------------------
+
+    TEST_CASE("test_lazy_getpath") {
+      JsonFunction getpath_wrapper = [](args_container&& args) -> json {
+        json& vin = args[0];
+        return LazyJson::parse(getprop(vin, "store").dump(2)).getpath(getprop(vin, "path")).to_json();
+      };
+
+      runset(spec["getpath"]["basic"], getpath_wrapper, nullptr);
+
+      const LazyJson doc = LazyJson::parse(
+          " { \"a\" : [ 1, { \"b\\\"c\" : \"x}]\\\\\" }, [] ], \"d\":{}, \"e\": -1.5e3, \"f\" : null }\n");
+      assert(doc.ismap() && 4 == doc.size());
+      assert("x}]\\" == doc.getpath(json::array({ "a", 1, "b\"c" })).to_json());
+      assert(doc.getpath("a.2").islist() && 0 == doc.getpath("a.2").size() && 3 == doc.getprop("a").size());
+      assert(-1500 == doc.getprop("e").to_json() && "-1.5e3" == doc.getprop("e").text());
+      assert(doc.getprop("f").isvalid() && !doc.getprop("g").isvalid() && !doc.getpath("a.3").isvalid());
+      assert(!doc.getpath("e.x").isvalid() && 0 == doc.getprop("d").size());
+
+      // A null leaf is a value, whether the path is followed lazily or found
+      // in the parsed node ($KEY is a plain key when not injecting).
+      const LazyJson nulls = LazyJson::parse("{\"a\":{\"$KEY\":null,\"k\":null,\"$GET:b\":[2,null]}}");
+      assert(nulls.getpath("a.k").isvalid() && nulls.getpath("a.k").to_json().is_null());
+      assert(nulls.getpath("a.$KEY").isvalid() && "null" == nulls.getpath("a.$KEY").text());
+      assert(nulls.getpath("a.$GET:b.1").isvalid() && nulls.getpath("a.$GET:b.1").to_json().is_null());
+      assert(2 == nulls.getpath("a.$GET:b.0").to_json() && nulls.getpath("a.$GET:b").islist());
+      assert(!nulls.getpath("a.$GET:b.2").isvalid() && !nulls.getpath("a.$GET:c").isvalid());
+      assert(2 == nulls.getpath("a.$GET:b").size() && nulls.getpath("a.$GET:b").getprop(1).isvalid());
+
+      // items visits the children in one scan, with their keys.
+      const std::vector<LazyJson::Item> items = doc.items();
+      assert(4 == items.size() && "a" == items[0].first && "f" == items[3].first);
+      assert(items[0].second.islist() && "-1.5e3" == items[2].second.text() && items[3].second.isvalid());
+      const std::vector<LazyJson::Item> elements = doc.getprop("a").items();
+      assert(3 == elements.size() && "2" == elements[2].first && elements[1].second.to_json() == doc.getpath("a.1").to_json());
+      assert("b\"c" == doc.getpath("a.1").items()[0].first && doc.getprop("e").items().empty() && LazyJson().items().empty());
+
+      // The lazily found corpus specs are those of the parsed corpus.
+      const LazyJson corpus = LazyJson::open("../build/test/test.json");
+      const json& parsed = *runner_load("../build/test/test.json", "struct");
+      for(json::const_iterator group = parsed.begin(); group != parsed.end(); ++group) {
+        for(json::const_iterator test = group->begin(); test != group->end(); ++test) {
+          assert(corpus.getpath(json::array({ "struct", group.key(), test.key() })).to_json() == *test);
+        }
+      }
+
+      try {
+        LazyJson::parse("{\"a\":[1,2}").getprop("b");
+        assert(false);
+      } catch(const std::runtime_error& err) {
+        assert(std::string::npos != std::string(err.what()).find("Invalid JSON at offset"));
+      }
+    }
+
+    // -------------------------------------------------
+    // binary tests
+    // -------------------------------------------------
+
+    TEST_CASE("test_binary") {
+      JsonFunction clone_wrapper = [](args_container&& args) -> json {
+        return clone_via_buffer(args.empty() ? NONE : args[0]);
+      };
+
+      runset(spec["minor"]["clone"], clone_wrapper, nullptr);
+
+      // Every spec of the corpus round trips in both formats.
+      for(BinaryFormat format : { BinaryFormat::CBOR, BinaryFormat::MSGPACK }) {
+        const Binary bytes = to_binary(spec, format);
+        assert(bytes.size() < spec.dump().size() && from_binary(bytes, format) == spec);
+      }
+
+      // The CBOR is standard: nlohmann reads it, and it reads nlohmann's.
+      assert(json::from_cbor(to_binary(spec)) == spec && from_binary(json::to_cbor(spec)) == spec);
+      const json numbers = { 0, 23, 24, 255, 256, 65536, 4294967296LL, -1, -25, -4294967297LL, 0.5, -1e300, 1.0 };
+      assert(from_binary(to_binary(numbers)) == numbers && json::from_cbor(to_binary(numbers)) == numbers);
+      assert(from_binary(to_binary(json(1.0))).is_number_float() && from_binary(to_binary(json(7))).is_number_integer());
+
+      // Integers that are not negative come back unsigned, as from nlohmann's
+      // reader, and still equal; negative integers and floats keep their type.
+      const json kinds = { { "i", 5 }, { "z", 0 }, { "w", 70000 }, { "u", 5u }, { "n", -5 }, { "f", 5.0 } };
+      for(BinaryFormat format : { BinaryFormat::CBOR, BinaryFormat::MSGPACK }) {
+        const json back = from_binary(to_binary(kinds, format), format);
+        assert(back == kinds && back["i"].is_number_unsigned() && back["u"].is_number_unsigned());
+        assert(json::value_t::number_integer == back["n"].type() && back["f"].is_number_float());
+      }
+      assert(clone_via_buffer(kinds) == kinds && clone_via_buffer(kinds)["i"].is_number_unsigned());
+      assert(1 == to_binary(json(5)).size() && 2 == to_binary(json(24)).size() && 3 == to_binary(json(256)).size());
+
+      Binary out = to_binary(json(1));
+      to_binary(out, json("a"));
+      assert(json(1) == from_binary(out.data(), 1) && json("a") == from_binary(out.data() + 1, 2));
+
+      const json doc = json::parse("{\"b\":[1,\"x\",null],\"a\":{\"c\":true}}");
+      assert(16 == binary_digest(doc).size());
+      assert(binary_digest(doc) == binary_digest(json::parse("{\"a\":{\"c\":true},\"b\":[1,\"x\",null]}")));
+      assert(binary_digest(json({ { "a", 1 } })) != binary_digest(json({ { "a", "1" } })));
+      assert(binary_digest(json(1)) != binary_digest(json(1.0)) && binary_digest(NONE) != binary_digest(json::object()));
+
+      bool thrown = false;
+      try {
+        from_binary(Binary({ 0x82, 0x01 }));
+      } catch(const json::parse_error&) {
+        thrown = true;
+      }
+      assert(thrown);
+
+      thrown = false;
+      try {
+        from_binary(Binary({ 0xa1, 0x61 }));
+      } catch(const json::parse_error&) {
+        thrown = true;
+      }
+      assert(thrown);
     }
 
+    // -------------------------------------------------
+    // hash tests
+    // -------------------------------------------------
 
+    TEST_CASE("test_struct_hash") {
+      // Equal values hash alike, whatever their key order and number types.
+      const json doc = json::parse("{\"b\":[1,\"x\",null,{}],\"a\":{\"c\":true,\"d\":-2.5}}");
+      json built = json::object();
+      built["a"]["d"] = -2.5;
+      built["b"] = { 1u, "x", nullptr, json::object() };
+      built["a"]["c"] = true;
+      assert(doc == built && struct_hash(doc) == struct_hash(built) && struct_hash(doc) == struct_hash(clone(doc)));
+      assert(struct_hash(json(1)) == struct_hash(json(1.0)) && struct_hash(json(1)) == struct_hash(json(1u)));
+      assert(struct_hash(json(-3)) == struct_hash(json(-3.0)) && struct_hash(json(0)) == struct_hash(json(-0.0)));
+
+      const std::vector<json> distinct = {
+        NONE, false, true, 0, 1, -1, 0.5, "", "1", json::array(), json::object(), { 1, 2 }, { 2, 1 },
+        { { "a", 1 }, { "b", 2 } }, { { "a", 2 }, { "b", 1 } }, { { "a", json::array() } }, { { "a", json::object() } },
+        json::array({ json::array() }), json::array({ json::object() }),
+      };
+      std::set<std::uint64_t> hashes;
+      for(const json& val : distinct) {
+        hashes.insert(struct_hash(val));
+      }
+      assert(distinct.size() == hashes.size());
 
+      // The corpus specs, by hash.
+      std::unordered_map<json, int, StructHash> counts;
+      for(int i = 0; i < 2; i++) {
+        for(const auto& test : spec.items()) {
+          counts[test.value()]++;
+        }
+      }
+      assert(spec.size() == counts.size() && 2 == counts[spec.begin().value()]);
+
+      HashedJson base(json({ { "a", 1 }, { "b", { { "c", 2 } } } }));
+      assert(base == HashedJson(base.value()) && base != HashedJson(json({ { "a", 1 } })));
+      assert(!base.merge(HashedJson(base.value())) && !base.merge(HashedJson(json({ { "b", { { "c", 2 } } } }))));
+      assert(base.merge(HashedJson(json({ { "b", { { "d", 3 } } } }))));
+      assert(base.value() == json({ { "a", 1 }, { "b", { { "c", 2 }, { "d", 3 } } } }));
+      assert(base.hash() == struct_hash(base.value()));
+      base.mutate()["a"] = 2;
+      assert(base.hash() == struct_hash(base.value()));
+
+      MemoTransform memo(json({ { "x", "`a`" }, { "y", "`b.c`" } }), 2);
+      for(int i = 0; i < 6; i++) {
+        const json data = { { "a", i % 3 }, { "b", { { "c", -i } } } };
+        assert(memo.apply(data) == transform(data, { { "x", "`a`" }, { "y", "`b.c`" } }));
+        assert(memo.apply(json::parse(data.dump())) == json({ { "x", i % 3 }, { "y", -i } }));
+      }
+      assert(6 == memo.reused() && 2 >= memo.size());
+
+      // The time is not kept: a spec with $WHEN is transformed every time.
+      MemoTransform timed(json({ { "t", "`$WHEN`" }, { "x", "`a`" } }));
+      const json first = timed.apply({ { "a", 1 } });
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      const json second = timed.apply({ { "a", 1 } });
+      assert(1 == second["x"] && first["t"] != second["t"] && 0 == timed.reused() && 0 == timed.size());
+    }
+
+    // -------------------------------------------------
+    // stats tests
+    // -------------------------------------------------
+
+    TEST_CASE("test_stats") {
+      stats_reset();
+
+      json doc = { { "a", { 1, 2, { { "b", 3 } } } } };
+      walk(doc, [](const std::string& key, json&, const json& parent, const WalkPath&) {
+        if("b" == key) {
+          getprop(parent, "b");
+          stats_alloc();
+        }
+      });
+      setprop(doc, "x", 1);
+      assert("{a:[1,2,{b:3}],x:1}" == stringify(doc));
+      assert(json({ { "b", { { "c", 2 } } } }) == transform(NONE, { { "b", { { "c", 2 } } } }));
+
+      const json counted = stats();
+      assert(static_cast<size_t>(Stats::COUNT) == counted.size());
+      for(int oI = 0; oI < Stats::COUNT; oI++) {
+        assert(counted.contains(STATS_NAMES[oI]));
+      }
+
+      if(Stats::enabled) {
+        assert(1 == counted["walk"]["calls"] && 6 == counted["walk"]["nodes"] && 1 == counted["walk"]["allocs"]);
+        assert(1 <= counted["getprop"]["calls"] && 0 == counted["getprop"]["allocs"]);
+        assert(1 == counted["stringify"]["calls"] && 7 == counted["stringify"]["nodes"]);
+        assert(1 == counted["transform"]["calls"] && 0 < counted["transform"]["nodes"]);
+        assert(0 == counted["validate"]["calls"] && 0 == counted["merge"]["calls"]);
+      } else {
+        assert(0 == counted["walk"]["calls"] && 0 == counted["getprop"]["calls"]);
+      }
+
+      stats_reset();
+      const json reset = stats();
+      for(const auto& op : reset.items()) {
+        assert(json({ { "allocs", 0 }, { "calls", 0 }, { "nodes", 0 }, { "ns", 0 } }) == op.value());
+      }
+    }
   }
 
   return 0;